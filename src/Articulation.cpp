@@ -11,12 +11,14 @@
 
 #include "Articulation.h"
 #include "Glide.h"
+#include "ParallelFor.h"
 
 #include "version.h"
 
 #include <vector>
 #include <set>
 #include <sstream>
+#include <algorithm>
 
 using std::cerr;
 using std::endl;
@@ -56,6 +58,7 @@ Articulation::Articulation(float inputSampleRate) :
     m_glideThresholdHopMaximum_cents(default_glideThresholdHopMaximum_cents),
     m_glideThresholdDuration_ms(default_glideThresholdDuration_ms),
     m_glideThresholdProximity_ms(default_glideThresholdProximity_ms),
+    m_noteThreadCount(0),
     m_summaryOutput(-1),
     m_noiseTypeOutput(-1),
     m_volumeDevelopmentOutput(-1),
@@ -378,6 +381,24 @@ Articulation::getOutputDescriptors() const
 
 bool
 Articulation::initialise(size_t channels, size_t stepSize, size_t blockSize)
+{
+    if (!initialiseForFeaturesFrom(channels, stepSize, blockSize)) {
+        return false;
+    }
+
+    try {
+        m_coreFeatures.initialise(m_coreParams);
+    } catch (const std::logic_error &e) {
+        cerr << "ERROR: Articulation::initialise: Feature extractor initialisation failed: " << e.what() << endl;
+        return false;
+    }
+    
+    return true;
+}
+
+bool
+Articulation::initialiseForFeaturesFrom(size_t channels, size_t stepSize,
+                                         size_t blockSize)
 {
     if (channels < getMinChannelCount() || channels > getMaxChannelCount()) {
         cerr << "ERROR: Articulation::initialise: unsupported channel count "
@@ -412,14 +433,8 @@ Articulation::initialise(size_t channels, size_t stepSize, size_t blockSize)
     m_stepSize = stepSize;
     m_blockSize = blockSize;
 
-    try {
-        m_coreParams.stepSize = m_stepSize;
-        m_coreParams.blockSize = m_blockSize;
-        m_coreFeatures.initialise(m_coreParams);
-    } catch (const std::logic_error &e) {
-        cerr << "ERROR: Articulation::initialise: Feature extractor initialisation failed: " << e.what() << endl;
-        return false;
-    }
+    m_coreParams.stepSize = m_stepSize;
+    m_coreParams.blockSize = m_blockSize;
     
     return true;
 }
@@ -473,14 +488,14 @@ Articulation::classifyLevelDevelopment(double begin,
 }
 
 Articulation::NoiseRec
-Articulation::classifyOnsetNoise(const vector<vector<int>> &activeBinsAfterOnset,
+Articulation::classifyOnsetNoise(const vector<int> &activeBinCountsAfterOnset,
                                  int binCount,
                                  double plosiveRatio,
                                  double fricativeRatio,
                                  bool forceSonorous)
 {
     NoiseRec rec;
-    int n = activeBinsAfterOnset.size();
+    int n = activeBinCountsAfterOnset.size();
     if (n < 2) return rec;
 
     int maxConsecutiveHopsAboveP = 0;
@@ -489,8 +504,8 @@ Articulation::classifyOnsetNoise(const vector<vector<int>> &activeBinsAfterOnset
     int maxConsecutiveHopsAboveF = 0;
     int currentHopsAboveF = 0;
 
-    for (const auto &active: activeBinsAfterOnset) {
-        double ratio = double(active.size()) / double(binCount);
+    for (int active: activeBinCountsAfterOnset) {
+        double ratio = double(active) / double(binCount);
         if (ratio > plosiveRatio) {
             if (++currentHopsAboveP > maxConsecutiveHopsAboveP) {
                 maxConsecutiveHopsAboveP = currentHopsAboveP;
@@ -554,107 +569,137 @@ Articulation::classifyOnsetNoise(const vector<vector<int>> &activeBinsAfterOnset
 Articulation::FeatureSet
 Articulation::getRemainingFeatures()
 {
-    FeatureSet fs;
-
     m_coreFeatures.finish();
+    return getFeaturesFrom(m_coreFeatures);
+}
+
+Articulation::FeatureSet
+Articulation::getFeaturesFrom(const CoreFeatures &coreFeatures)
+{
+    FeatureSet fs;
 
-    const auto pyinPitch = m_coreFeatures.getPYinPitch_Hz();
+    const auto pyinPitch = coreFeatures.getPYinPitch_Hz();
 
     for (int i = 0; i < int(pyinPitch.size()); ++i) {
         if (pyinPitch[i] <= 0) continue;
         Feature f;
         f.hasTimestamp = true;
-        f.timestamp = m_coreFeatures.timeForStep(i);
+        f.timestamp = coreFeatures.timeForStep(i);
         f.values.push_back(pyinPitch[i]);
         fs[m_pitchTrackOutput].push_back(f);
     }
 
-    auto onsetOffsets = m_coreFeatures.getOnsetOffsets();
-    auto rawPower = m_coreFeatures.getRawPower_dB();
-    auto smoothedPower = m_coreFeatures.getSmoothedPower_dB();
+    auto onsetOffsets = coreFeatures.getNotes();
+    auto rawPower = coreFeatures.getRawPower_dB();
+    auto smoothedPower = coreFeatures.getSmoothedPower_dB();
 
     const auto &analysisPower = smoothedPower;
     
     int n = rawPower.size();
 
-    map<int, NoiseRec> onsetToNoise;
-
-    auto noiseRatioFractions = m_coreFeatures.getOnsetLevelRiseFractions();
-    int noiseWindowSteps = m_coreFeatures.msToSteps
+    auto noiseRatioFractions = coreFeatures.getOnsetLevelRiseFractions();
+    int noiseWindowSteps = coreFeatures.msToSteps
         (m_coreParams.onsetSensitivityNoiseTimeWindow_ms, m_stepSize, false);
 
     double plosiveRatio =
         (m_impulseNoiseRatioPlosive_percent * m_reverbDurationFactor) / 100.0;
     double fricativeRatio =
         (m_impulseNoiseRatioFricative_percent * m_reverbDurationFactor) / 100.0;
+
+    struct LDRec {
+        int sustainBegin;
+        int sustainEnd;
+        double minDiff;
+        double maxDiff;
+        LevelDevelopment development;
+    };
+
+    // One entry per note, in onset order. The following onset and
+    // relative duration depend on the neighbouring notes and are
+    // filled in here; everything else is then calculated from these
+    // and the (read-only) core features, for each note independently
+    struct Note {
+        int onset;
+        int offset;
+        int following;
+        double relativeDuration;
+        NoiseRec noise;
+        LDRec ld;
+        string code;
+        double index;
+        string summary;
+    };
     
-    map<int, int> onsetToFollowingOnset;
+    vector<Note> notes;
+    notes.reserve(onsetOffsets.size());
     for (auto itr = onsetOffsets.begin(); itr != onsetOffsets.end(); ++itr) {
-        int onset = itr->first;
-        int offset = itr->second.first;
-        int following = n;
-        auto probe = itr;
-        if (++probe != onsetOffsets.end()) {
-            following = probe->first;
-        }
-        if (following > onset) {
-            onsetToFollowingOnset[onset] = following;
+        Note note;
+        note.onset = itr->onset;
+        note.offset = itr->offset;
+        int following = onsetOffsets.getFollowingOnset(itr, n);
+        if (following > note.onset) {
+            note.following = following;
         } else {
-            onsetToFollowingOnset[onset] = offset;
+            note.following = note.offset;
         }
+        note.relativeDuration =
+            double(note.offset - note.onset) /
+            double(note.following - note.onset);
+        notes.push_back(note);
     }
+    int noteCount = int(notes.size());
             
-    map<int, double> onsetToRelativeDuration;
     double meanRelativeDuration = 0.0;
-    for (auto pq : onsetToFollowingOnset) {
-        int onset = pq.first;
-        int following = pq.second;
-        int offset = onsetOffsets.at(pq.first).first;
-        double relativeDuration =
-            double(offset - onset) / double(following - onset);
-        onsetToRelativeDuration[onset] = relativeDuration;
-        meanRelativeDuration += relativeDuration;
+    for (const auto &note : notes) {
+        meanRelativeDuration += note.relativeDuration;
     }
-    if (!onsetToFollowingOnset.empty()) {
-        meanRelativeDuration /= onsetToFollowingOnset.size();
+    if (noteCount > 0) {
+        meanRelativeDuration /= noteCount;
     }
 
     Glide::Parameters glideParams;
     glideParams.durationThreshold_steps =
-        m_coreFeatures.msToSteps(m_glideThresholdDuration_ms,
-                                 m_coreParams.stepSize, false);
+        coreFeatures.msToSteps(m_glideThresholdDuration_ms,
+                               m_coreParams.stepSize, false);
     glideParams.onsetProximityThreshold_steps =
-        m_coreFeatures.msToSteps(m_glideThresholdProximity_ms,
-                                 m_coreParams.stepSize, false);
+        coreFeatures.msToSteps(m_glideThresholdProximity_ms,
+                               m_coreParams.stepSize, false);
     glideParams.minimumPitchThreshold_cents = m_glideThresholdPitch_cents;
     glideParams.minimumHopDifference_cents = m_glideThresholdHopMinimum_cents;
     glideParams.maximumHopDifference_cents = m_glideThresholdHopMaximum_cents;
     glideParams.medianFilterLength_steps =
-        m_coreFeatures.msToSteps(m_coreParams.pitchAverageWindow_ms,
-                                 m_coreParams.stepSize, true);
+        coreFeatures.msToSteps(m_coreParams.pitchAverageWindow_ms,
+                               m_coreParams.stepSize, true);
     glideParams.useSmoothing = false;
 
     Glide glide(glideParams);
     Glide::Extents glides = glide.extract_Hz(pyinPitch, onsetOffsets);
     
-    int prevOnset = -1;
-    double meanNoiseRatio = 0.0;
-    for (auto pq: onsetOffsets) {
-        int onset = pq.first;
-        vector<vector<int>> binsAboveFloor;
+    int sustainBeginSteps = coreFeatures.msToSteps
+        (m_coreParams.sustainBeginThreshold_ms, m_stepSize, false);
+    int sustainEndSteps = coreFeatures.msToSteps
+        (m_coreParams.minimumOnsetInterval_ms / 2.0, m_stepSize, false);
+
+    int binCount = coreFeatures.getOnsetBinCount();
+
+    auto classifyNoise = [&](int noteIndex) {
+        Note &note = notes[noteIndex];
+        int onset = note.onset;
+        vector<int> binCountsAboveFloor;
         for (int i = 0; i < noiseWindowSteps; ++i) {
             if (i < n) {
-                binsAboveFloor.push_back
-                    (m_coreFeatures.getOnsetBinsAboveNoiseFloorAt(onset + i));
+                binCountsAboveFloor.push_back
+                    (coreFeatures.countOnsetBinsAboveNoiseFloorAt(onset + i));
             }
         }
         bool lungoPrecedes = false;
         bool lungoAndGlide = false;
-        if (prevOnset >= 0) {
-            if (onsetToRelativeDuration.at(prevOnset) >= 0.95) {
+        if (noteIndex > 0) {
+            const Note &prev = notes[noteIndex - 1];
+            if (prev.relativeDuration >= 0.95) {
 #ifdef DEBUG_ARTICULATION
                 cerr << "Onset " << onset << " has lungo at preceding onset "
-                     << prevOnset << endl;
+                     << prev.onset << endl;
 #endif
                 lungoPrecedes = true;
                 if (glides.find(onset) != glides.end() &&
@@ -672,38 +717,17 @@ Articulation::getRemainingFeatures()
             (lungoPrecedes ?
              fricativeRatio * m_overlapCompensationFactor :
              fricativeRatio);
-        NoiseRec rec = classifyOnsetNoise
-            (binsAboveFloor, m_coreFeatures.getOnsetBinCount(),
+        note.noise = classifyOnsetNoise
+            (binCountsAboveFloor, binCount,
              plosiveRatio, effectiveFricativeRatio, lungoAndGlide);
-        onsetToNoise[onset] = rec;
-        meanNoiseRatio += rec.total;
-        prevOnset = onset;
-    }
-    if (!onsetOffsets.empty()) {
-        meanNoiseRatio /= onsetOffsets.size();
-    }
-    
-    int sustainBeginSteps = m_coreFeatures.msToSteps
-        (m_coreParams.sustainBeginThreshold_ms, m_stepSize, false);
-    int sustainEndSteps = m_coreFeatures.msToSteps
-        (m_coreParams.minimumOnsetInterval_ms / 2.0, m_stepSize, false);
-
-    struct LDRec {
-        int sustainBegin;
-        int sustainEnd;
-        double minDiff;
-        double maxDiff;
-        LevelDevelopment development;
     };
-    
-    map<int, LDRec> onsetToLD;
-    double meanMaxDiff = 0.0;
-    double meanMinDiff = 0.0;
-    for (auto pq: onsetOffsets) {
-        int onset = pq.first;
+
+    auto classifyDevelopment = [&](int noteIndex) {
+        Note &note = notes[noteIndex];
+        int onset = note.onset;
         int sustainBegin = onset + sustainBeginSteps;
-        int sustainEnd = pq.second.first - 1;
-        int following = onsetToFollowingOnset.at(onset);
+        int sustainEnd = note.offset - 1;
+        int following = note.following;
         if (following - sustainEndSteps > sustainBegin &&
             sustainEnd > following - sustainEndSteps) {
             // Volume development is considered until note offset, but
@@ -735,7 +759,7 @@ Articulation::getRemainingFeatures()
             minDiff = min - sbl;
             maxDiff = max - sbl;
         }
-        LDRec rec;
+        LDRec &rec = note.ld;
         rec.development = development;
         rec.sustainBegin = sustainBegin;
         rec.sustainEnd = sustainEnd;
@@ -752,35 +776,108 @@ Articulation::getRemainingFeatures()
         if (rec.development == LevelDevelopment::Unclassifiable) {
             rec.development = LevelDevelopment::Constant;
         }
+    };
+
+    auto calculateIndex = [&](int noteIndex) {
+        Note &note = notes[noteIndex];
+        int onset = note.onset;
+        int offset = note.offset;
+        string code;
+        double index = 1.0;
+
+        NoiseType noise = note.noise.type;
+        code += noiseTypeToCode(noise);
+        index *= noiseTypeToFactor(noise);
+
+        LevelDevelopment development = note.ld.development;
+        code += developmentToCode(development);
+        index *= developmentToFactor(development);
+
+        double relativeDuration = note.relativeDuration;
+        if (relativeDuration < 0.6) {
+            code += "S";
+        } else if (relativeDuration < 0.95) {
+            code += "E";
+        } else {
+            code += "L";
+        }
+        if (relativeDuration > 0.0) {
+            index /= relativeDuration;
+        }
+        
+        index *= m_scalingFactor;
+
+        note.code = code;
+        note.index = index;
         
-        onsetToLD[onset] = rec;
+        double max2dp = round(note.ld.maxDiff * 100.0) / 100.0;
+        double min2dp = round(note.ld.minDiff * 100.0) / 100.0;
+        
+        ostringstream os;
+        os << coreFeatures.timeForStep(onset).toText() << " / "
+           << (coreFeatures.timeForStep(note.following) -
+               coreFeatures.timeForStep(onset)).toText() << "\n"
+           << code << "\n"
+           << int(round(note.noise.total * 100.0)) << "%\n"
+           << max2dp << "dB / " << min2dp << "dB\n"
+           << relativeDuration << " ("
+           << (coreFeatures.timeForStep(offset) -
+               coreFeatures.timeForStep(onset)).toText() << ")\n"
+           << "IArt = " << round(index);
+        note.summary = os.str();
+    };
 
-        meanMaxDiff += rec.maxDiff;
-        meanMinDiff += rec.minDiff;
+    // Each note only reads its own entry and the relative duration of
+    // its predecessor, which is already fixed, so the notes can be
+    // handled in any order. It's only worth starting threads for a
+    // good number of them though
+    int threads = m_noteThreadCount;
+    if (threads <= 0) {
+        threads = std::max(1, std::min(getParallelThreadCount(),
+                                       noteCount / 128));
     }
-    if (!onsetOffsets.empty()) {
-        meanMaxDiff /= onsetOffsets.size();
-        meanMinDiff /= onsetOffsets.size();
+    parallelFor(noteCount, threads, [&](int from, int to) {
+        for (int i = from; i < to; ++i) {
+            classifyNoise(i);
+            classifyDevelopment(i);
+            calculateIndex(i);
+        }
+    });
+
+    // Means are summed in note order, so as to come out the same
+    // however the notes were divided among threads
+    double meanNoiseRatio = 0.0;
+    double meanMaxDiff = 0.0;
+    double meanMinDiff = 0.0;
+    for (const auto &note : notes) {
+        meanNoiseRatio += note.noise.total;
+        meanMaxDiff += note.ld.maxDiff;
+        meanMinDiff += note.ld.minDiff;
+    }
+    if (noteCount > 0) {
+        meanNoiseRatio /= noteCount;
+        meanMaxDiff /= noteCount;
+        meanMinDiff /= noteCount;
     }
 
-    for (auto pq : onsetToNoise) {
+    for (const auto &note : notes) {
         Feature f;
         f.hasTimestamp = true;
-        f.timestamp = m_coreFeatures.timeForStep(pq.first);
+        f.timestamp = coreFeatures.timeForStep(note.onset);
         f.hasDuration = false;
-        f.values.push_back(static_cast<int>(pq.second.type) + 1);
-        f.label = noiseTypeToString(pq.second.type);
+        f.values.push_back(static_cast<int>(note.noise.type) + 1);
+        f.label = noiseTypeToString(note.noise.type);
         fs[m_noiseTypeOutput].push_back(f);
     }
 
-    for (auto pq : onsetToLD) {
+    for (const auto &note : notes) {
         Feature f;
         f.hasTimestamp = true;
-        f.timestamp = m_coreFeatures.timeForStep(pq.second.sustainBegin);
+        f.timestamp = coreFeatures.timeForStep(note.ld.sustainBegin);
         f.hasDuration = true;
         f.duration =
-            m_coreFeatures.timeForStep(pq.second.sustainEnd + 1) - f.timestamp;
-        auto development = pq.second.development;
+            coreFeatures.timeForStep(note.ld.sustainEnd + 1) - f.timestamp;
+        auto development = note.ld.development;
         if (development == LevelDevelopment::Other) {
             f.values.push_back(0);
         } else {
@@ -790,62 +887,19 @@ Articulation::getRemainingFeatures()
         fs[m_volumeDevelopmentOutput].push_back(f);
     }
 
-    for (auto pq : onsetOffsets) {
-        
-        auto onset = pq.first;
-        auto offset = pq.second.first;
-        string code;
-        double index = 1.0;
-
-        NoiseType noise = onsetToNoise[onset].type;
-        code += noiseTypeToCode(noise);
-        index *= noiseTypeToFactor(noise);
-
-        LevelDevelopment development = onsetToLD[onset].development;
-        code += developmentToCode(development);
-        index *= developmentToFactor(development);
-
-        double relativeDuration = onsetToRelativeDuration[onset];
-        if (relativeDuration < 0.6) {
-            code += "S";
-        } else if (relativeDuration < 0.95) {
-            code += "E";
-        } else {
-            code += "L";
-        }
-        if (relativeDuration > 0.0) {
-            index /= relativeDuration;
-        }
-        
-        index *= m_scalingFactor;
-        
+    for (const auto &note : notes) {
         Feature f;
         f.hasTimestamp = true;
-        f.timestamp = m_coreFeatures.timeForStep(onset);
+        f.timestamp = coreFeatures.timeForStep(note.onset);
         f.hasDuration = false;
-        f.label = code;
+        f.label = note.code;
         fs[m_articulationTypeOutput].push_back(f);
 
         f.label = "";
-        f.values.clear();
-        f.values.push_back(round(index));
+        f.values.push_back(round(note.index));
         fs[m_articulationIndexOutput].push_back(f);
 
-        double max2dp = round(onsetToLD.at(onset).maxDiff * 100.0) / 100.0;
-        double min2dp = round(onsetToLD.at(onset).minDiff * 100.0) / 100.0;
-        
-        ostringstream os;
-        os << m_coreFeatures.timeForStep(onset).toText() << " / "
-           << (m_coreFeatures.timeForStep(onsetToFollowingOnset.at(onset)) -
-               m_coreFeatures.timeForStep(onset)).toText() << "\n"
-           << code << "\n"
-           << int(round(onsetToNoise.at(onset).total * 100.0)) << "%\n"
-           << max2dp << "dB / " << min2dp << "dB\n"
-           << relativeDuration << " ("
-           << (m_coreFeatures.timeForStep(offset) -
-               m_coreFeatures.timeForStep(onset)).toText() << ")\n"
-           << "IArt = " << round(index);
-        f.label = os.str();
+        f.label = note.summary;
         f.values.clear();
         fs[m_summaryOutput].push_back(f);
     }
@@ -853,9 +907,9 @@ Articulation::getRemainingFeatures()
     Feature f;
     
     f.hasTimestamp = true;
-    f.timestamp = m_coreFeatures.getStartTime();
+    f.timestamp = coreFeatures.getStartTime();
     f.hasDuration = true;
-    f.duration = m_coreFeatures.timeForStep(n) - f.timestamp;
+    f.duration = coreFeatures.timeForStep(n) - f.timestamp;
     f.values.clear();
     {
         ostringstream os;
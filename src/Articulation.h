@@ -48,6 +48,10 @@ public:
     OutputList getOutputDescriptors() const;
 
     bool initialise(size_t channels, size_t stepSize, size_t blockSize);
+
+    /** As initialise(), but for getFeaturesFrom() only: see Combined.h */
+    bool initialiseForFeaturesFrom(size_t channels, size_t stepSize,
+                                   size_t blockSize);
     void reset();
 
     FeatureSet process(const float *const *inputBuffers,
@@ -55,6 +59,23 @@ public:
 
     FeatureSet getRemainingFeatures();
 
+    /** Features from a shared, finished CoreFeatures: see Combined.h */
+    FeatureSet getFeaturesFrom(const CoreFeatures &coreFeatures);
+
+    /** Parameters getFeaturesFrom() expects: see Combined.h */
+    CoreFeatures::Parameters getCoreParameters() const {
+        return m_coreParams;
+    }
+
+    /** Classify the notes in getFeaturesFrom() on exactly the given
+     *  number of threads, however few notes there are, rather than
+     *  choosing a number according to the note count. Zero, the
+     *  default, restores the automatic choice. Intended for testing.
+     */
+    void setNoteThreadCount(int threads) {
+        m_noteThreadCount = threads;
+    }
+
     enum class NoiseType {
         Unclassifiable,
         Sonorous, Fricative, Plosive, Affricative
@@ -99,8 +120,8 @@ public:
         NoiseRec() : total(0.0), type(NoiseType::Unclassifiable) { }
     };
         
-    static NoiseRec classifyOnsetNoise(const std::vector<std::vector<int>> &
-                                       activeBinsAfterOnset,
+    static NoiseRec classifyOnsetNoise(const std::vector<int> &
+                                       activeBinCountsAfterOnset,
                                        int binCount,
                                        double plosiveRatio,
                                        double fricativeRatio,
@@ -182,6 +203,8 @@ protected:
     float m_glideThresholdHopMaximum_cents;
     float m_glideThresholdDuration_ms;
     float m_glideThresholdProximity_ms;
+
+    int m_noteThreadCount;
     
     mutable int m_summaryOutput;
     mutable int m_noiseTypeOutput;
@@ -0,0 +1,366 @@
+
+/*
+    Expressive Means
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "BatchAnalyser.h"
+
+#include "Onsets.h"
+#include "Articulation.h"
+#include "PitchVibrato.h"
+#include "Portamento.h"
+#include "Combined.h"
+
+#include "SemanticOnsets.h"
+#include "SemanticArticulation.h"
+#include "SemanticPitchVibrato.h"
+#include "SemanticPortamento.h"
+
+#include "bqaudiostream/AudioReadStream.h"
+#include "bqaudiostream/AudioReadStreamFactory.h"
+
+#include <filesystem>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+
+using std::string;
+using std::vector;
+using std::unique_ptr;
+
+template <typename P>
+static std::pair<string, std::function<unique_ptr<Vamp::Plugin>(float)>>
+makeFactory()
+{
+    auto factory = [](float rate) -> unique_ptr<Vamp::Plugin> {
+        return unique_ptr<Vamp::Plugin>(new P(rate));
+    };
+    return { factory(44100.f)->getIdentifier(), factory };
+}
+
+vector<std::pair<string, BatchAnalyser::Factory>>
+BatchAnalyser::getFactories()
+{
+    return {
+        makeFactory<SemanticOnsets>(),
+        makeFactory<SemanticArticulation>(),
+        makeFactory<SemanticPitchVibrato>(),
+        makeFactory<SemanticPortamento>(),
+        makeFactory<Onsets>(),
+        makeFactory<Articulation>(),
+        makeFactory<PitchVibrato>(),
+        makeFactory<Portamento>(),
+        makeFactory<Combined>()
+    };
+}
+
+vector<string>
+BatchAnalyser::getPluginIdentifiers()
+{
+    vector<string> ids;
+    for (auto f: getFactories()) {
+        ids.push_back(f.first);
+    }
+    return ids;
+}
+
+BatchAnalyser::Transform
+BatchAnalyser::parseTransform(string str)
+{
+    vector<string> parts;
+    std::istringstream in(str);
+    string part;
+    while (std::getline(in, part, ':')) {
+        parts.push_back(part);
+    }
+    if (parts.size() == 4 &&
+        parts[0] == "vamp" && parts[1] == "expressive-means") {
+        parts.erase(parts.begin(), parts.begin() + 2);
+    }
+    if (parts.size() != 2 || parts[0] == "" || parts[1] == "") {
+        throw std::invalid_argument
+            ("BatchAnalyser::parseTransform: Transform \"" + str +
+             "\" is not of the form plugin:output");
+    }
+    return { parts[0], parts[1] };
+}
+
+BatchAnalyser::BatchAnalyser(vector<Transform> transforms) :
+    BatchAnalyser(transforms, getFactories())
+{
+}
+
+BatchAnalyser::BatchAnalyser(vector<Transform> transforms,
+                             vector<std::pair<string, Factory>> factories) :
+    m_transforms(transforms)
+{
+    for (int i = 0; i < int(transforms.size()); ++i) {
+
+        const Transform &t = transforms[i];
+
+        auto fi = factories.begin();
+        while (fi != factories.end() && fi->first != t.plugin) {
+            ++fi;
+        }
+        if (fi == factories.end()) {
+            throw std::invalid_argument
+                ("BatchAnalyser: Unknown plugin \"" + t.plugin + "\"");
+        }
+
+        auto outputs = fi->second(44100.f)->getOutputDescriptors();
+        int outputIndex = -1;
+        for (int j = 0; j < int(outputs.size()); ++j) {
+            if (outputs[j].identifier == t.output) {
+                outputIndex = j;
+                break;
+            }
+        }
+        if (outputIndex < 0) {
+            throw std::invalid_argument
+                ("BatchAnalyser: Plugin \"" + t.plugin +
+                 "\" has no output \"" + t.output + "\"");
+        }
+
+        // Outputs of the same plugin are all taken from one instance
+        auto si = m_selections.begin();
+        while (si != m_selections.end() && si->pluginId != t.plugin) {
+            ++si;
+        }
+        if (si == m_selections.end()) {
+            m_selections.push_back({ t.plugin, fi->second, {}, {} });
+            si = m_selections.end() - 1;
+        }
+        si->outputIndices.push_back(outputIndex);
+        si->transformIndices.push_back(i);
+    }
+}
+
+string
+BatchAnalyser::getOutputFileName(string audioFile, int transform,
+                                 string directory) const
+{
+    if (transform < 0 || transform >= int(m_transforms.size())) {
+        throw std::logic_error("BatchAnalyser::getOutputFileName: Transform index out of range");
+    }
+
+    std::filesystem::path audioPath(audioFile);
+    std::filesystem::path dir(directory);
+    if (directory == "") {
+        dir = audioPath.parent_path();
+    }
+
+    const Transform &t = m_transforms[transform];
+    string name = audioPath.stem().string() + "_vamp_expressive-means_" +
+        t.plugin + "_" + t.output + ".csv";
+
+    return (dir / name).string();
+}
+
+static string
+formatTime(Vamp::RealTime t)
+{
+    bool negative = (t < Vamp::RealTime::zeroTime);
+    if (negative) {
+        t = Vamp::RealTime::zeroTime - t;
+    }
+    char buffer[40];
+    snprintf(buffer, sizeof(buffer), "%s%d.%09d",
+             negative ? "-" : "", t.sec, t.nsec);
+    return buffer;
+}
+
+void
+BatchAnalyser::writeFeature(std::ostream &out, const Vamp::Plugin::Feature &f,
+                            Vamp::RealTime timestamp)
+{
+    out << formatTime(timestamp);
+    if (f.hasDuration) {
+        out << "," << formatTime(f.duration);
+    }
+    for (auto v: f.values) {
+        char buffer[40];
+        snprintf(buffer, sizeof(buffer), "%g", v);
+        out << "," << buffer;
+    }
+    if (f.label != "") {
+        out << ",\"";
+        for (auto c: f.label) {
+            if (c == '"') out << '"';
+            out << c;
+        }
+        out << "\"";
+    }
+    out << "\n";
+}
+
+vector<string>
+BatchAnalyser::analyseFile(string audioFile, bool filenameColumn) const
+{
+    unique_ptr<breakfastquay::AudioReadStream> stream
+        (breakfastquay::AudioReadStreamFactory::createReadStream(audioFile));
+    if (!stream) {
+        throw std::runtime_error("Failed to open audio file " + audioFile);
+    }
+
+    int channels = int(stream->getChannelCount());
+    float rate = float(stream->getSampleRate());
+    if (channels < 1 || rate <= 0.f) {
+        throw std::runtime_error("Audio file " + audioFile +
+                                 " has no channels or no sample rate");
+    }
+
+    vector<std::ostringstream> csv(m_transforms.size());
+    vector<bool> written(m_transforms.size(), false);
+
+    // One plugin for each selection, all fed together as the file is
+    // read. They are kept until we are done with all of them, so that
+    // those using the same feature extractor parameters can share its
+    // results
+    struct Run {
+        const Selection *selection;
+        unique_ptr<Vamp::Plugin> plugin;
+        size_t step;
+        size_t block;
+        size_t start; // of the next block to be processed
+        Vamp::Plugin::OutputList outputs;
+        vector<Vamp::RealTime> lastTimes;
+        vector<bool> haveLast;
+    };
+    vector<Run> runs;
+
+    for (const auto &s: m_selections) {
+        Run r;
+        r.selection = &s;
+        r.plugin = s.factory(rate);
+        r.step = r.plugin->getPreferredStepSize();
+        r.block = r.plugin->getPreferredBlockSize();
+        r.start = 0;
+        if (!r.plugin->initialise(1, r.step, r.block)) {
+            throw std::runtime_error("Plugin " + s.pluginId +
+                                     " failed to initialise for " + audioFile);
+        }
+        r.outputs = r.plugin->getOutputDescriptors();
+        r.lastTimes = vector<Vamp::RealTime>(s.outputIndices.size());
+        r.haveLast = vector<bool>(s.outputIndices.size(), false);
+        runs.push_back(std::move(r));
+    }
+
+    auto write = [&](Run &r, const Vamp::Plugin::FeatureSet &features,
+                     Vamp::RealTime blockTime) {
+        const Selection &s = *r.selection;
+        for (int i = 0; i < int(s.outputIndices.size()); ++i) {
+            int output = s.outputIndices[i];
+            if (features.find(output) == features.end()) {
+                continue;
+            }
+            const auto &od = r.outputs[output];
+            int transform = s.transformIndices[i];
+            for (const auto &f: features.at(output)) {
+                Vamp::RealTime t = blockTime;
+                if (f.hasTimestamp) {
+                    t = f.timestamp;
+                } else if (od.sampleType ==
+                           Vamp::Plugin::OutputDescriptor::FixedSampleRate) {
+                    t = r.haveLast[i] ?
+                        r.lastTimes[i] +
+                        Vamp::RealTime::fromSeconds(1.0 / od.sampleRate) :
+                        Vamp::RealTime::zeroTime;
+                }
+                r.lastTimes[i] = t;
+                r.haveLast[i] = true;
+                if (filenameColumn) {
+                    if (!written[transform]) {
+                        csv[transform] << "\"" << audioFile << "\"";
+                    }
+                    csv[transform] << ",";
+                }
+                writeFeature(csv[transform], f, t);
+                written[transform] = true;
+            }
+        }
+    };
+
+    // The mixed-down input read so far and not yet finished with by
+    // every plugin, starting at sample monoStart, out of n samples
+    // read in all
+    vector<float> mono;
+    size_t monoStart = 0;
+    size_t n = 0;
+    vector<float> buffer;
+
+    auto processAt = [&](Run &r) {
+        buffer.resize(r.block);
+        for (size_t i = 0; i < r.block; ++i) {
+            size_t ix = r.start + i;
+            buffer[i] = (ix < n ? mono[ix - monoStart] : 0.f);
+        }
+        const float *buffers[] = { buffer.data() };
+        Vamp::RealTime t =
+            Vamp::RealTime::frame2RealTime(long(r.start), (unsigned int)rate);
+        write(r, r.plugin->process(buffers, t), t);
+        r.start += r.step;
+    };
+
+    // Input is zero-padded to a whole number of blocks, as
+    // sonic-annotator does, and then divided into overlapping blocks
+    // the way the Vamp SDK's PluginBufferingAdapter does: every block
+    // that fits within the padded input, followed by a single further
+    // zero-padded block if any input is left. Until we reach the end
+    // of the file we don't know the padded length, but every block
+    // that fits within the input read so far is certainly one of
+    // those, and contains no padding
+    
+    int chunk = 65536;
+    vector<float> interleaved(size_t(chunk) * channels);
+    while (true) {
+        size_t got = stream->getInterleavedFrames(chunk, interleaved.data());
+        if (got == 0) {
+            break;
+        }
+        for (size_t i = 0; i < got; ++i) {
+            float sum = 0.f;
+            for (int c = 0; c < channels; ++c) {
+                sum += interleaved[i * channels + c];
+            }
+            mono.push_back(sum / float(channels));
+        }
+        n += got;
+        
+        size_t finishedWith = n;
+        for (auto &r: runs) {
+            while (r.start + r.block <= n) {
+                processAt(r);
+            }
+            finishedWith = std::min(finishedWith, r.start);
+        }
+        mono.erase(mono.begin(), mono.begin() + (finishedWith - monoStart));
+        monoStart = finishedWith;
+    }
+    stream.reset();
+
+    for (auto &r: runs) {
+        size_t padded = ((n + r.block - 1) / r.block) * r.block;
+        while (r.start + r.block <= padded) {
+            processAt(r);
+        }
+        size_t end = r.start;
+        if (r.start < padded) {
+            processAt(r);
+        }
+        write(r, r.plugin->getRemainingFeatures(),
+              Vamp::RealTime::frame2RealTime(long(end), (unsigned int)rate));
+    }
+
+    vector<string> results;
+    for (const auto &c: csv) {
+        results.push_back(c.str());
+    }
+    return results;
+}
@@ -0,0 +1,122 @@
+
+/*
+    Expressive Means
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef EXPRESSIVE_MEANS_BATCH_ANALYSER_H
+#define EXPRESSIVE_MEANS_BATCH_ANALYSER_H
+
+#include <vamp-sdk/Plugin.h>
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <memory>
+#include <ostream>
+
+/** Run a set of the Expressive Means plugins over audio files without
+ *  a plugin host, producing the same CSV as sonic-annotator would with
+ *  default parameters.
+ *
+ *  Input is fed to each plugin in the way sonic-annotator feeds it
+ *  through the Vamp SDK buffering adapter, so that the results are
+ *  identical to sonic-annotator's: multi-channel audio is mixed down
+ *  to mono, the input is zero-padded to a whole number of preferred
+ *  block sizes, and one further zero-padded block is processed if any
+ *  input remains beyond the last full one. The file is read a chunk
+ *  at a time, with all of the plugins fed from each chunk in turn, so
+ *  the decoded audio is never held in memory all at once.
+ *
+ *  A BatchAnalyser holds no per-file state, and analyseFile() may be
+ *  called on the same object from several threads at once.
+ */
+class BatchAnalyser
+{
+public:
+    /** A plugin and output to run, identified as they are in a
+     *  sonic-annotator transform ID, e.g. "onsets" and "onsets" for
+     *  vamp:expressive-means:onsets:onsets.
+     */
+    struct Transform {
+        std::string plugin;
+        std::string output;
+    };
+
+    /** Parse a transform given either as plugin:output or as the full
+     *  vamp:expressive-means:plugin:output form. Throws
+     *  std::invalid_argument if it is in neither form.
+     */
+    static Transform parseTransform(std::string);
+
+    /** Return the identifiers of all plugins that can be run.
+     */
+    static std::vector<std::string> getPluginIdentifiers();
+
+    /** Construct an analyser for the given transforms. Throws
+     *  std::invalid_argument if any transform names an unknown
+     *  plugin or output.
+     */
+    BatchAnalyser(std::vector<Transform> transforms);
+
+    /** A function constructing a plugin at a given sample rate.
+     */
+    typedef std::function<std::unique_ptr<Vamp::Plugin>(float)> Factory;
+
+    /** Construct an analyser for the given transforms, taking their
+     *  plugins from the given factories, each paired with the plugin
+     *  identifier it answers to, instead of from the Expressive Means
+     *  plugins. Throws as the constructor above does.
+     */
+    BatchAnalyser(std::vector<Transform> transforms,
+                  std::vector<std::pair<std::string, Factory>> factories);
+
+    /** Return the name sonic-annotator would give the CSV file for
+     *  the given audio file and transform index, in the given
+     *  directory, or alongside the audio file if the directory is
+     *  empty.
+     */
+    std::string getOutputFileName(std::string audioFile, int transform,
+                                  std::string directory) const;
+
+    /** Read and analyse the given audio file, returning the CSV text
+     *  for each transform in the order they were passed to the
+     *  constructor. If filenameColumn is true, the first feature is
+     *  prefixed with the quoted file name and every other with an
+     *  empty column, as in sonic-annotator's --csv-stdout output.
+     *
+     *  Throws an exception if the file can't be read or a plugin
+     *  fails to initialise.
+     */
+    std::vector<std::string> analyseFile(std::string audioFile,
+                                         bool filenameColumn) const;
+
+    /** Write a single feature to the given stream as a line of CSV,
+     *  in sonic-annotator's format: the timestamp and any duration in
+     *  seconds to nine decimal places, then each value in %g format,
+     *  then any label in double quotes with embedded quotes doubled.
+     */
+    static void writeFeature(std::ostream &out,
+                             const Vamp::Plugin::Feature &feature,
+                             Vamp::RealTime timestamp);
+
+private:
+    struct Selection {
+        std::string pluginId;
+        Factory factory;
+        std::vector<int> outputIndices; // per transform run on this plugin
+        std::vector<int> transformIndices;
+    };
+
+    std::vector<Transform> m_transforms;
+    std::vector<Selection> m_selections;
+
+    static std::vector<std::pair<std::string, Factory>> getFactories();
+};
+
+#endif
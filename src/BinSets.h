@@ -0,0 +1,175 @@
+
+/*
+    Expressive Means
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef EXPRESSIVE_MEANS_BIN_SETS_H
+#define EXPRESSIVE_MEANS_BIN_SETS_H
+
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/** A sequence of sets of spectral bin numbers, one set per step,
+ *  each drawn from the same fixed range of bins. The sets are stored
+ *  as fixed-width bitsets packed one after another into a single
+ *  array, so that counting the members of a set, or of the
+ *  intersection of two sets, is a matter of a few popcounts.
+ */
+class BinSets
+{
+public:
+    BinSets() : m_firstBin(0), m_binCount(0), m_wordsPerStep(0),
+                m_stepCount(0) { }
+
+    /** Construct an empty sequence of sets of bins in the range
+     *  firstBin to firstBin + binCount - 1 inclusive.
+     */
+    BinSets(int firstBin, int binCount) :
+        m_firstBin(firstBin), m_binCount(binCount),
+        m_wordsPerStep((binCount + 63) / 64),
+        m_stepCount(0) { }
+
+    /** Construct from words previously obtained from getWords() on an
+     *  object with the same bin range.
+     */
+    BinSets(int firstBin, int binCount, std::vector<uint64_t> words) :
+        BinSets(firstBin, binCount) {
+        if (m_wordsPerStep == 0 || words.size() % m_wordsPerStep != 0) {
+            throw std::logic_error("BinSets: Word count is not a multiple of words per step");
+        }
+        m_words = words;
+        m_stepCount = int(m_words.size() / m_wordsPerStep);
+    }
+
+    int getFirstBin() const { return m_firstBin; }
+    int getBinCount() const { return m_binCount; }
+    int getStepCount() const { return m_stepCount; }
+    int getWordsPerStep() const { return m_wordsPerStep; }
+    const std::vector<uint64_t> &getWords() const { return m_words; }
+
+    void clear() {
+        m_words.clear();
+        m_stepCount = 0;
+    }
+
+    /** Append an empty set, returning its step number.
+     */
+    int appendStep() {
+        m_words.resize(m_words.size() + m_wordsPerStep, 0);
+        return m_stepCount++;
+    }
+
+    /** Append copies of count sets from another BinSets with the same
+     *  bin range, starting from its set at the given step.
+     */
+    void appendSteps(const BinSets &other, int firstStep, int count) {
+        if (other.m_firstBin != m_firstBin || other.m_binCount != m_binCount) {
+            throw std::logic_error("BinSets::appendSteps: Bin ranges differ");
+        }
+        if (firstStep < 0 || count < 0 ||
+            firstStep + count > other.m_stepCount) {
+            throw std::logic_error("BinSets::appendSteps: Steps out of range");
+        }
+        auto from = other.m_words.begin() + size_t(firstStep) * m_wordsPerStep;
+        m_words.insert(m_words.end(), from,
+                       from + size_t(count) * m_wordsPerStep);
+        m_stepCount += count;
+    }
+
+    /** Add the given bin to the set at the given step, which must
+     *  exist.
+     */
+    void add(int step, int bin) {
+        int b = bin - m_firstBin;
+        m_words[size_t(step) * m_wordsPerStep + b / 64] |=
+            uint64_t(1) << (b % 64);
+    }
+
+    /** Return the bins in the set at the given step, in ascending
+     *  order, or an empty vector if the step is out of range.
+     */
+    std::vector<int> getBinsAt(int step) const {
+        std::vector<int> bins;
+        if (!inRange(step)) return bins;
+        const uint64_t *w = wordsAt(step);
+        for (int i = 0; i < m_wordsPerStep; ++i) {
+            uint64_t word = w[i];
+            for (int j = 0; word != 0; ++j, word >>= 1) {
+                if (word & 1) {
+                    bins.push_back(m_firstBin + i * 64 + j);
+                }
+            }
+        }
+        return bins;
+    }
+
+    /** Return the number of bins in the set at the given step, or 0
+     *  if the step is out of range.
+     */
+    int countAt(int step) const {
+        if (!inRange(step)) return 0;
+        const uint64_t *w = wordsAt(step);
+        int n = 0;
+        for (int i = 0; i < m_wordsPerStep; ++i) {
+            n += popcount(w[i]);
+        }
+        return n;
+    }
+
+    /** Return the number of bins found in both of the sets at the
+     *  given two steps, or 0 if either is out of range.
+     */
+    int countIntersectionAt(int step1, int step2) const {
+        if (!inRange(step1) || !inRange(step2)) return 0;
+        const uint64_t *w1 = wordsAt(step1);
+        const uint64_t *w2 = wordsAt(step2);
+        int n = 0;
+        for (int i = 0; i < m_wordsPerStep; ++i) {
+            n += popcount(w1[i] & w2[i]);
+        }
+        return n;
+    }
+
+private:
+    int m_firstBin;
+    int m_binCount;
+    int m_wordsPerStep;
+    int m_stepCount;
+    std::vector<uint64_t> m_words;
+
+    bool inRange(int step) const {
+        return step >= 0 && step < m_stepCount;
+    }
+
+    const uint64_t *wordsAt(int step) const {
+        return m_words.data() + size_t(step) * m_wordsPerStep;
+    }
+
+    static int popcount(uint64_t x) {
+#if defined(__GNUC__)
+        return __builtin_popcountll(x);
+#elif defined(_MSC_VER) && defined(_M_X64)
+        return int(__popcnt64(x));
+#else
+        int n = 0;
+        while (x) {
+            x &= x - 1;
+            ++n;
+        }
+        return n;
+#endif
+    }
+};
+
+#endif
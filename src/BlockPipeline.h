@@ -0,0 +1,187 @@
+
+/*
+    Expressive Means
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef EXPRESSIVE_MEANS_BLOCK_PIPELINE_H
+#define EXPRESSIVE_MEANS_BLOCK_PIPELINE_H
+
+#include <vamp-sdk/RealTime.h>
+
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <stdexcept>
+#include <cstdint>
+
+/** Hand each of a series of fixed-size input blocks to a set of
+ *  independent consumers, each running on its own thread. Blocks are
+ *  copied into a ring buffer of the given capacity, and each consumer
+ *  reads through it at its own pace, receiving every block in order;
+ *  push() blocks the caller only when the slowest consumer has fallen
+ *  a whole ring behind.
+ *
+ *  A consumer is called only from its own thread, so it needs no
+ *  locking as long as it touches nothing that the others do. Its
+ *  results are safe to read from the calling thread once finish() has
+ *  returned.
+ */
+class BlockPipeline
+{
+public:
+    typedef std::function<void(const float *, Vamp::RealTime)> Consumer;
+
+    BlockPipeline(int blockSize, int capacity,
+                  std::vector<Consumer> consumers) :
+        m_blockSize(blockSize),
+        m_capacity(capacity),
+        m_consumers(consumers),
+        m_blocks(size_t(blockSize) * capacity, 0.f),
+        m_timestamps(capacity),
+        m_written(0),
+        m_read(consumers.size(), 0),
+        m_finishing(false),
+        m_finished(false) {
+        if (blockSize < 1 || capacity < 1) {
+            throw std::logic_error("BlockPipeline: blockSize and capacity must be > 0");
+        }
+        for (int i = 0; i < int(m_consumers.size()); ++i) {
+            m_threads.push_back(std::thread([this, i]() { run(i); }));
+        }
+    }
+
+    ~BlockPipeline() {
+        try {
+            finish();
+        } catch (...) {
+            // Nobody left to report it to
+        }
+    }
+
+    BlockPipeline(const BlockPipeline &) = delete;
+    BlockPipeline &operator=(const BlockPipeline &) = delete;
+
+    /** Copy a block of blockSize samples into the ring and make it
+     *  available to the consumers. Blocks must all be pushed from the
+     *  same thread.
+     */
+    void push(const float *block, Vamp::RealTime timestamp) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_finishing) {
+            throw std::logic_error("BlockPipeline::push: Already finished");
+        }
+        m_spaceAvailable.wait(lock, [this]() {
+            return m_written - slowestRead() < uint64_t(m_capacity);
+        });
+        int slot = int(m_written % m_capacity);
+        lock.unlock();
+
+        // No consumer can be reading this slot, as they have all
+        // moved past the block that was last in it
+        std::copy(block, block + m_blockSize,
+                  m_blocks.data() + size_t(slot) * m_blockSize);
+        m_timestamps[slot] = timestamp;
+
+        lock.lock();
+        ++m_written;
+        lock.unlock();
+        m_dataAvailable.notify_all();
+    }
+
+    /** Wait for all consumers to finish with all blocks pushed so far,
+     *  and stop their threads. If any consumer threw an exception,
+     *  rethrow the first one here. No further blocks may be pushed.
+     */
+    void finish() {
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            if (m_finished) {
+                return;
+            }
+            m_finishing = true;
+        }
+        m_dataAvailable.notify_all();
+        for (auto &t: m_threads) {
+            t.join();
+        }
+        m_threads.clear();
+        m_finished = true;
+        if (m_error) {
+            std::exception_ptr error = m_error;
+            m_error = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    int m_blockSize;
+    int m_capacity;
+    std::vector<Consumer> m_consumers;
+    std::vector<float> m_blocks;
+    std::vector<Vamp::RealTime> m_timestamps;
+    uint64_t m_written;
+    std::vector<uint64_t> m_read;
+    bool m_finishing;
+    bool m_finished;
+    std::exception_ptr m_error;
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_dataAvailable;
+    std::condition_variable m_spaceAvailable;
+
+    uint64_t slowestRead() const {
+        uint64_t slowest = m_written;
+        for (auto r: m_read) {
+            if (r < slowest) slowest = r;
+        }
+        return slowest;
+    }
+
+    void run(int consumer) {
+        bool failed = false;
+        while (true) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_dataAvailable.wait(lock, [this, consumer]() {
+                return m_read[consumer] < m_written || m_finishing;
+            });
+            if (m_read[consumer] == m_written) {
+                return;
+            }
+            int slot = int(m_read[consumer] % m_capacity);
+            lock.unlock();
+
+            // After a failure we carry on consuming, without doing
+            // anything, so as not to hold up the producer
+            if (!failed) {
+                try {
+                    m_consumers[consumer]
+                        (m_blocks.data() + size_t(slot) * m_blockSize,
+                         m_timestamps[slot]);
+                } catch (...) {
+                    failed = true;
+                    std::lock_guard<std::mutex> guard(m_mutex);
+                    if (!m_error) {
+                        m_error = std::current_exception();
+                    }
+                }
+            }
+
+            lock.lock();
+            ++m_read[consumer];
+            lock.unlock();
+            m_spaceAvailable.notify_one();
+        }
+    }
+};
+
+#endif
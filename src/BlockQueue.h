@@ -0,0 +1,217 @@
+
+/*
+    Expressive Means
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef EXPRESSIVE_MEANS_BLOCK_QUEUE_H
+#define EXPRESSIVE_MEANS_BLOCK_QUEUE_H
+
+#include <vamp-sdk/RealTime.h>
+
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <cstdint>
+
+/** Pass a series of fixed-size input blocks from one thread to a
+ *  single consumer running on a background thread, through a
+ *  preallocated ring buffer. push() only copies the block and
+ *  publishes it, so it takes the same short time however slow the
+ *  consumer is, unless the consumer has fallen a whole ring behind,
+ *  in which case push() waits until there is room.
+ *
+ *  Neither side takes a lock while the ring is neither empty nor
+ *  full. When the consumer finds it empty, or the producer finds it
+ *  full, that side flags that it is waiting and sleeps on a condition
+ *  variable, and the other side takes the lock to wake it only if it
+ *  sees that flag after its next block is published or consumed.
+ *
+ *  The consumer is called only from its own thread, and anything it
+ *  produces is safe to read from the producer's thread once finish()
+ *  has returned.
+ */
+class BlockQueue
+{
+public:
+    typedef std::function<void(const float *, Vamp::RealTime)> Consumer;
+
+    BlockQueue(int blockSize, int capacity, Consumer consumer) :
+        m_blockSize(blockSize),
+        m_capacity(capacity),
+        m_consumer(consumer),
+        m_blocks(size_t(blockSize) * capacity, 0.f),
+        m_timestamps(capacity),
+        m_written(0),
+        m_read(0),
+        m_finishing(false),
+        m_discarding(false),
+        m_consumerWaiting(false),
+        m_producerWaiting(false),
+        m_finished(false) {
+        if (blockSize < 1 || capacity < 1) {
+            throw std::logic_error("BlockQueue: blockSize and capacity must be > 0");
+        }
+        m_thread = std::thread([this]() { run(); });
+    }
+
+    ~BlockQueue() {
+        discard();
+    }
+
+    BlockQueue(const BlockQueue &) = delete;
+    BlockQueue &operator=(const BlockQueue &) = delete;
+
+    /** Copy a block of blockSize samples into the ring and make it
+     *  available to the consumer. Blocks must all be pushed from the
+     *  same thread.
+     */
+    void push(const float *block, Vamp::RealTime timestamp) {
+        if (m_finishing.load(std::memory_order_relaxed)) {
+            throw std::logic_error("BlockQueue::push: Already finished");
+        }
+        uint64_t written = m_written.load(std::memory_order_relaxed);
+        if (written - m_read.load(std::memory_order_acquire) >=
+            uint64_t(m_capacity)) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_producerWaiting.store(true);
+            m_spaceAvailable.wait(lock, [this, written]() {
+                return written - m_read.load() < uint64_t(m_capacity);
+            });
+            m_producerWaiting.store(false);
+        }
+        int slot = int(written % m_capacity);
+        std::copy(block, block + m_blockSize,
+                  m_blocks.data() + size_t(slot) * m_blockSize);
+        m_timestamps[slot] = timestamp;
+
+        // Sequentially consistent, like the consumer's setting of
+        // m_consumerWaiting before it looks at m_written, so that
+        // at least one of us sees the other's store
+        m_written.store(written + 1);
+        if (m_consumerWaiting.load()) {
+            wake(m_dataAvailable);
+        }
+    }
+
+    /** Wait for the consumer to finish with all blocks pushed so far,
+     *  and stop its thread. If the consumer threw an exception,
+     *  rethrow it here. No further blocks may be pushed. Must be
+     *  called from the thread that pushes.
+     */
+    void finish() {
+        if (m_finished) {
+            return;
+        }
+        m_finishing.store(true);
+        stop();
+        if (m_error) {
+            std::exception_ptr error = m_error;
+            m_error = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+    /** Stop the consumer's thread as soon as it has finished with the
+     *  block it is working on, if any, dropping any blocks not yet
+     *  consumed and any exception the consumer threw. No further
+     *  blocks may be pushed. Must be called from the thread that
+     *  pushes.
+     */
+    void discard() {
+        if (m_finished) {
+            return;
+        }
+        m_discarding.store(true);
+        stop();
+        m_error = nullptr;
+    }
+
+private:
+    int m_blockSize;
+    int m_capacity;
+    Consumer m_consumer;
+    std::vector<float> m_blocks;
+    std::vector<Vamp::RealTime> m_timestamps;
+    std::atomic<uint64_t> m_written;
+    std::atomic<uint64_t> m_read;
+    std::atomic<bool> m_finishing;
+    std::atomic<bool> m_discarding;
+    std::atomic<bool> m_consumerWaiting;
+    std::atomic<bool> m_producerWaiting;
+    bool m_finished;
+    std::exception_ptr m_error;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_dataAvailable;
+    std::condition_variable m_spaceAvailable;
+
+    void wake(std::condition_variable &cv) {
+        // Taking the lock ensures that the waiting side is either
+        // already waiting, or has yet to check its condition
+        { std::lock_guard<std::mutex> guard(m_mutex); }
+        cv.notify_one();
+    }
+
+    void stop() {
+        wake(m_dataAvailable);
+        m_thread.join();
+        m_finished = true;
+    }
+
+    void run() {
+        bool failed = false;
+        while (true) {
+            if (m_discarding.load()) {
+                return;
+            }
+            uint64_t read = m_read.load(std::memory_order_relaxed);
+            if (read == m_written.load()) {
+                // Check for finishing before looking again, so that
+                // a block pushed just before finish() is not missed
+                if (m_finishing.load() && read == m_written.load()) {
+                    return;
+                }
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_consumerWaiting.store(true);
+                m_dataAvailable.wait(lock, [this, read]() {
+                    return read != m_written.load() ||
+                        m_finishing.load() || m_discarding.load();
+                });
+                m_consumerWaiting.store(false);
+                continue;
+            }
+
+            // After a failure we carry on consuming, without doing
+            // anything, so as not to hold up the producer
+            int slot = int(read % m_capacity);
+            if (!failed) {
+                try {
+                    m_consumer(m_blocks.data() + size_t(slot) * m_blockSize,
+                               m_timestamps[slot]);
+                } catch (...) {
+                    failed = true;
+                    m_error = std::current_exception();
+                }
+            }
+
+            m_read.store(read + 1);
+            if (m_producerWaiting.load()) {
+                wake(m_spaceAvailable);
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,283 @@
+
+/*
+    Expressive Means Combined
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "Combined.h"
+
+#include "version.h"
+
+#include <vector>
+
+using std::cerr;
+using std::endl;
+using std::vector;
+
+Combined::Combined(float inputSampleRate) :
+    Plugin(inputSampleRate),
+    m_coreFeatures(inputSampleRate),
+    m_onsets(inputSampleRate),
+    m_articulation(inputSampleRate),
+    m_pitchVibrato(inputSampleRate),
+    m_portamento(inputSampleRate)
+{
+    m_backends.push_back(makeBackend("onsets", "Onsets", m_onsets));
+    m_backends.push_back(makeBackend("articulation", "Articulation",
+                                     m_articulation));
+    m_backends.push_back(makeBackend("pitch-vibrato", "Pitch Vibrato",
+                                     m_pitchVibrato));
+    m_backends.push_back(makeBackend("portamento", "Portamento",
+                                     m_portamento));
+}
+
+Combined::~Combined()
+{
+}
+
+string
+Combined::getIdentifier() const
+{
+    return TAGGED_ID("all");
+}
+
+string
+Combined::getName() const
+{
+    return TAGGED_NAME("Expressive Means (advanced): All Analyses");
+}
+
+string
+Combined::getDescription() const
+{
+    return "finds note onsets and identifies types and intensities of articulation, pitch vibrato, and portamento in monophonic recordings, all from a single analysis pass (specified parameter settings)";
+}
+
+string
+Combined::getMaker() const
+{
+    return "Frithjof Vollmer and Chris Cannam";
+}
+
+int
+Combined::getPluginVersion() const
+{
+    return EXPRESSIVE_MEANS_PLUGIN_VERSION;
+}
+
+string
+Combined::getCopyright() const
+{
+    return "GPLv2";
+}
+
+Combined::InputDomain
+Combined::getInputDomain() const
+{
+    return TimeDomain;
+}
+
+size_t
+Combined::getPreferredBlockSize() const
+{
+    return m_coreFeatures.getPreferredBlockSize();
+}
+
+size_t
+Combined::getPreferredStepSize() const
+{
+    return m_coreFeatures.getPreferredStepSize();
+}
+
+size_t
+Combined::getMinChannelCount() const
+{
+    return 1;
+}
+
+size_t
+Combined::getMaxChannelCount() const
+{
+    return 1;
+}
+
+bool
+Combined::isCoreParameter(string identifier) const
+{
+    float value = 0.f;
+    return m_coreParams.obtainVampParameter(identifier, value);
+}
+
+Combined::ParameterList
+Combined::getParameterDescriptors() const
+{
+    // The core parameters are shared by all back-ends and appear
+    // once, unprefixed. The back-ends' own parameters follow, with
+    // their identifiers and names prefixed by those of the back-end
+
+    ParameterList list;
+    m_coreParams.appendVampParameterDescriptors(list, true);
+
+    for (const auto &b : m_backends) {
+        for (auto d : b.plugin->getParameterDescriptors()) {
+            if (isCoreParameter(d.identifier)) {
+                continue;
+            }
+            d.identifier = b.identifierPrefix + "-" + d.identifier;
+            d.name = b.namePrefix + ": " + d.name;
+            list.push_back(d);
+        }
+    }
+
+    return list;
+}
+
+float
+Combined::getParameter(string identifier) const
+{
+    float value = 0.f;
+    if (m_coreParams.obtainVampParameter(identifier, value)) {
+        return value;
+    }
+    for (const auto &b : m_backends) {
+        string prefix = b.identifierPrefix + "-";
+        if (identifier.compare(0, prefix.size(), prefix) == 0) {
+            return b.plugin->getParameter(identifier.substr(prefix.size()));
+        }
+    }
+    return 0.f;
+}
+
+void
+Combined::setParameter(string identifier, float value)
+{
+    if (m_coreParams.acceptVampParameter(identifier, value)) {
+        // The back-ends refer to some of the core parameters in their
+        // own classification, so they need to see them too
+        for (const auto &b : m_backends) {
+            b.plugin->setParameter(identifier, value);
+        }
+        return;
+    }
+    for (const auto &b : m_backends) {
+        string prefix = b.identifierPrefix + "-";
+        if (identifier.compare(0, prefix.size(), prefix) == 0) {
+            string upstream = identifier.substr(prefix.size());
+            if (!isCoreParameter(upstream)) {
+                b.plugin->setParameter(upstream, value);
+            }
+            return;
+        }
+    }
+}
+
+Combined::ProgramList
+Combined::getPrograms() const
+{
+    ProgramList list;
+    return list;
+}
+
+string
+Combined::getCurrentProgram() const
+{
+    return "";
+}
+
+void
+Combined::selectProgram(string)
+{
+}
+
+Combined::OutputList
+Combined::getOutputDescriptors() const
+{
+    OutputList list;
+
+    for (const auto &b : m_backends) {
+        b.firstOutput = int(list.size());
+        for (auto d : b.plugin->getOutputDescriptors()) {
+            d.identifier = b.identifierPrefix + "-" + d.identifier;
+            d.name = b.namePrefix + ": " + d.name;
+            list.push_back(d);
+        }
+    }
+
+    return list;
+}
+
+bool
+Combined::initialise(size_t channels, size_t stepSize, size_t blockSize)
+{
+    if (channels < getMinChannelCount() || channels > getMaxChannelCount()) {
+        cerr << "ERROR: Combined::initialise: unsupported channel count "
+             << channels << endl;
+        return false;
+    }
+
+    // The back-ends check the sample rate and step and block sizes
+    // for us. Their own CoreFeatures objects are never used, so they
+    // are left uninitialised
+
+    for (const auto &b : m_backends) {
+        if (!b.initialiseForFeaturesFrom(channels, stepSize, blockSize)) {
+            cerr << "ERROR: Combined::initialise: Initialisation failed for "
+                 << b.namePrefix << " back-end" << endl;
+            return false;
+        }
+    }
+
+    (void)getOutputDescriptors(); // initialise output indices
+
+    try {
+        m_coreParams.stepSize = stepSize;
+        m_coreParams.blockSize = blockSize;
+        m_coreFeatures.initialise(m_coreParams);
+    } catch (const std::logic_error &e) {
+        cerr << "ERROR: Combined::initialise: Feature extractor initialisation failed: " << e.what() << endl;
+        return false;
+    }
+
+    return true;
+}
+
+void
+Combined::reset()
+{
+    m_coreFeatures.reset();
+}
+
+Combined::FeatureSet
+Combined::process(const float *const *inputBuffers, Vamp::RealTime timestamp)
+{
+    m_coreFeatures.process(inputBuffers[0], timestamp);
+    return {};
+}
+
+void
+Combined::appendFeatures(FeatureSet &fs, const Backend &backend,
+                         const FeatureSet &backendFeatures) const
+{
+    for (const auto &ff : backendFeatures) {
+        fs[backend.firstOutput + ff.first] = ff.second;
+    }
+}
+
+Combined::FeatureSet
+Combined::getRemainingFeatures()
+{
+    FeatureSet fs;
+
+    m_coreFeatures.finish();
+
+    for (const auto &b : m_backends) {
+        appendFeatures(fs, b, b.getFeaturesFrom(m_coreFeatures));
+    }
+
+    return fs;
+}
@@ -0,0 +1,128 @@
+
+/*
+    Expressive Means Combined
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef EXPRESSIVE_MEANS_COMBINED_H
+#define EXPRESSIVE_MEANS_COMBINED_H
+
+#include <vamp-sdk/Plugin.h>
+
+#include "CoreFeatures.h"
+#include "Onsets.h"
+#include "Articulation.h"
+#include "PitchVibrato.h"
+#include "Portamento.h"
+
+#include <functional>
+
+using std::string;
+
+/** Plugin that returns the outputs of Onsets, Articulation,
+ *  PitchVibrato and Portamento together, all calculated from a
+ *  single CoreFeatures. The four plugins are used as back-ends for
+ *  their parameters, outputs and classification logic, but their own
+ *  CoreFeatures objects are never initialised or given any input.
+ *
+ *  Each back-end plugin provides three functions for this.
+ *
+ *  initialiseForFeaturesFrom() checks the channel count and step and
+ *  block sizes and sets up everything that getFeaturesFrom() needs,
+ *  as initialise() does, but without initialising the plugin's own
+ *  CoreFeatures.
+ *
+ *  getFeaturesFrom() returns the features that getRemainingFeatures()
+ *  would return, but calculated from the given CoreFeatures rather
+ *  than the plugin's own. The CoreFeatures must have been initialised
+ *  with the parameters returned by getCoreParameters(), and must
+ *  already have been finished.
+ *
+ *  getCoreParameters() returns the parameters the plugin's own
+ *  CoreFeatures would be initialised with. These are only complete
+ *  once initialise() or initialiseForFeaturesFrom() has been called.
+ */
+class Combined : public Vamp::Plugin
+{
+public:
+    Combined(float inputSampleRate);
+    virtual ~Combined();
+
+    string getIdentifier() const;
+    string getName() const;
+    string getDescription() const;
+    string getMaker() const;
+    int getPluginVersion() const;
+    string getCopyright() const;
+
+    InputDomain getInputDomain() const;
+    size_t getPreferredBlockSize() const;
+    size_t getPreferredStepSize() const;
+    size_t getMinChannelCount() const;
+    size_t getMaxChannelCount() const;
+
+    ParameterList getParameterDescriptors() const;
+    float getParameter(string identifier) const;
+    void setParameter(string identifier, float value);
+
+    ProgramList getPrograms() const;
+    string getCurrentProgram() const;
+    void selectProgram(string name);
+
+    OutputList getOutputDescriptors() const;
+
+    bool initialise(size_t channels, size_t stepSize, size_t blockSize);
+    void reset();
+
+    FeatureSet process(const float *const *inputBuffers,
+                       Vamp::RealTime timestamp);
+
+    FeatureSet getRemainingFeatures();
+
+protected:
+    CoreFeatures m_coreFeatures;
+    CoreFeatures::Parameters m_coreParams;
+
+    Onsets m_onsets;
+    Articulation m_articulation;
+    PitchVibrato m_pitchVibrato;
+    Portamento m_portamento;
+
+    struct Backend {
+        string identifierPrefix;
+        string namePrefix;
+        Vamp::Plugin *plugin;
+        std::function<bool(size_t, size_t, size_t)> initialiseForFeaturesFrom;
+        std::function<FeatureSet(const CoreFeatures &)> getFeaturesFrom;
+        mutable int firstOutput;
+    };
+    std::vector<Backend> m_backends;
+
+    template <typename P>
+    static Backend makeBackend(string identifierPrefix, string namePrefix,
+                               P &plugin) {
+        return {
+            identifierPrefix, namePrefix, &plugin,
+            [&plugin](size_t channels, size_t stepSize, size_t blockSize) {
+                return plugin.initialiseForFeaturesFrom
+                    (channels, stepSize, blockSize);
+            },
+            [&plugin](const CoreFeatures &coreFeatures) {
+                return plugin.getFeaturesFrom(coreFeatures);
+            },
+            -1
+        };
+    }
+
+    bool isCoreParameter(string identifier) const;
+
+    void appendFeatures(FeatureSet &fs, const Backend &backend,
+                        const FeatureSet &backendFeatures) const;
+};
+
+#endif
@@ -10,14 +10,25 @@
 */
 
 #include "CoreFeatures.h"
+#include "FrameDataFile.h"
+#include "ParallelFor.h"
+
+#include "../ext/pyin/Yin.h"
+#include "../ext/pyin/MonoPitchHMM.h"
+
+#include <mutex>
+#include <future>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <algorithm>
+#include <cmath>
 
 static const CoreFeatures::Parameters defaultCoreParams;
 
 using std::string;
 using std::logic_error;
 using std::vector;
-using std::map;
-using std::set;
 using std::cerr;
 using std::endl;
 
@@ -32,7 +43,7 @@ CoreFeatures::Parameters::appendVampParameterDescriptors(Vamp::Plugin::Parameter
     d.identifier = "normaliseAudio";
     d.name = "Normalise audio";
     d.unit = "";
-    d.description = "Normalise the audio signal to peak 1.0 before further processing. Requires that signal be short enough to fit in memory.";
+    d.description = "Normalise the audio signal to peak 1.0 before further processing. Requires that signal be short enough to fit in memory, unless the peak level is supplied in advance.";
     d.minValue = 0.f;
     d.maxValue = 1.f;
     d.isQuantized = true;
@@ -40,6 +51,50 @@ CoreFeatures::Parameters::appendVampParameterDescriptors(Vamp::Plugin::Parameter
     d.defaultValue = defaultCoreParams.normalise;
     list.push_back(d);
 
+    d.identifier = "knownPeak";
+    d.name = "Known peak level";
+    d.unit = "";
+    d.description = "Peak absolute sample value of the whole signal, if already known. When normalising, a non-zero value here is used as the normalisation peak, so that the signal can be processed as it arrives instead of being retained in memory. Leave at zero to have the peak found from the signal itself.";
+    d.minValue = 0.f;
+    d.maxValue = 1.f;
+    d.isQuantized = false;
+    d.quantizeStep = 0.f;
+    d.defaultValue = defaultCoreParams.knownPeak;
+    list.push_back(d);
+
+    d.identifier = "threadedExtraction";
+    d.name = "Extract features in parallel";
+    d.unit = "";
+    d.description = "Run the pitch, power, and spectral feature extractors on separate threads. The results are the same either way, but with this switched on the analysis may finish sooner on a multi-core machine.";
+    d.minValue = 0.f;
+    d.maxValue = 1.f;
+    d.isQuantized = true;
+    d.quantizeStep = 1.f;
+    d.defaultValue = defaultCoreParams.threadedExtraction;
+    list.push_back(d);
+
+    d.identifier = "queueInput";
+    d.name = "Analyse input in the background";
+    d.unit = "";
+    d.description = "Only queue each block of input as it arrives, and carry out the analysis on a separate thread, so that the host is never kept waiting during processing. The results are the same either way. This is useful in live hosts that call the plugin from a time-critical thread.";
+    d.minValue = 0.f;
+    d.maxValue = 1.f;
+    d.isQuantized = true;
+    d.quantizeStep = 1.f;
+    d.defaultValue = defaultCoreParams.queueInput;
+    list.push_back(d);
+
+    d.identifier = "splitAtSilence";
+    d.name = "Analyse in segments split at silences";
+    d.unit = "";
+    d.description = "Split the recording wherever there is at least a second of silence (raw power below -120 dB), and extract features from the resulting segments in parallel. For long recordings with pauses this can be much faster on a multi-core machine. Pitch tracking may differ very slightly around the split points. The whole recording is held in memory during analysis.";
+    d.minValue = 0.f;
+    d.maxValue = 1.f;
+    d.isQuantized = true;
+    d.quantizeStep = 1.f;
+    d.defaultValue = defaultCoreParams.splitAtSilence;
+    list.push_back(d);
+
     PYinVamp tempPYin(48000.f);
     auto pyinParams = tempPYin.getParameterDescriptors();
     for (auto pd: pyinParams) {
@@ -223,6 +278,14 @@ CoreFeatures::Parameters::obtainVampParameter(string identifier, float &value) c
         value = spectralFrequencyMax_Hz;
     } else if (identifier == "normaliseAudio") {
         value = (normalise ? 1.f : 0.f);
+    } else if (identifier == "knownPeak") {
+        value = knownPeak;
+    } else if (identifier == "threadedExtraction") {
+        value = (threadedExtraction ? 1.f : 0.f);
+    } else if (identifier == "queueInput") {
+        value = (queueInput ? 1.f : 0.f);
+    } else if (identifier == "splitAtSilence") {
+        value = (splitAtSilence ? 1.f : 0.f);
     } else {
         return false;
     }
@@ -270,19 +333,171 @@ CoreFeatures::Parameters::acceptVampParameter(string identifier, float value)
         spectralFrequencyMax_Hz = value;
     } else if (identifier == "normaliseAudio") {
         normalise = (value > 0.5f);
+    } else if (identifier == "knownPeak") {
+        knownPeak = value;
+    } else if (identifier == "threadedExtraction") {
+        threadedExtraction = (value > 0.5f);
+    } else if (identifier == "queueInput") {
+        queueInput = (value > 0.5f);
+    } else if (identifier == "splitAtSilence") {
+        splitAtSilence = (value > 0.5f);
     } else {
         return false;
     }
     return true;
 }
 
+bool
+CoreFeatures::Parameters::operator==(const Parameters &other) const
+{
+    return
+        stepSize == other.stepSize &&
+        blockSize == other.blockSize &&
+        normalise == other.normalise &&
+        knownPeak == other.knownPeak &&
+        pyinThresholdDistribution == other.pyinThresholdDistribution &&
+        pyinLowAmpSuppressionThreshold == other.pyinLowAmpSuppressionThreshold &&
+        pyinFixedLag == other.pyinFixedLag &&
+        pyinPreciseTiming == other.pyinPreciseTiming &&
+        pitchAverageWindow_ms == other.pitchAverageWindow_ms &&
+        usePitchOnsetDetector == other.usePitchOnsetDetector &&
+        onsetSensitivityPitch_cents == other.onsetSensitivityPitch_cents &&
+        onsetSensitivityNoise_percent == other.onsetSensitivityNoise_percent &&
+        onsetSensitivityLevel_dB == other.onsetSensitivityLevel_dB &&
+        onsetSensitivityNoiseTimeWindow_ms == other.onsetSensitivityNoiseTimeWindow_ms &&
+        onsetSensitivityRawPowerThreshold_dB == other.onsetSensitivityRawPowerThreshold_dB &&
+        minimumOnsetInterval_ms == other.minimumOnsetInterval_ms &&
+        sustainBeginThreshold_ms == other.sustainBeginThreshold_ms &&
+        noteDurationThreshold_dB == other.noteDurationThreshold_dB &&
+        spectralNoiseFloor_dB == other.spectralNoiseFloor_dB &&
+        spectralDropOffset_dB == other.spectralDropOffset_dB &&
+        spectralDropOffsetRatio_percent == other.spectralDropOffsetRatio_percent &&
+        spectralFrequencyMin_Hz == other.spectralFrequencyMin_Hz &&
+        spectralFrequencyMax_Hz == other.spectralFrequencyMax_Hz &&
+        threadedExtraction == other.threadedExtraction &&
+        queueInput == other.queueInput &&
+        splitAtSilence == other.splitAtSilence;
+}
+
+bool
+CoreFeatures::Parameters::hasSameFrameParameters(const Parameters &other) const
+{
+    // Keep FrameDataFile up to date if changing this
+    return
+        stepSize == other.stepSize &&
+        blockSize == other.blockSize &&
+        normalise == other.normalise &&
+        knownPeak == other.knownPeak &&
+        pyinThresholdDistribution == other.pyinThresholdDistribution &&
+        pyinLowAmpSuppressionThreshold == other.pyinLowAmpSuppressionThreshold &&
+        pyinFixedLag == other.pyinFixedLag &&
+        pyinPreciseTiming == other.pyinPreciseTiming &&
+        onsetSensitivityLevel_dB == other.onsetSensitivityLevel_dB &&
+        onsetSensitivityNoiseTimeWindow_ms == other.onsetSensitivityNoiseTimeWindow_ms &&
+        spectralNoiseFloor_dB == other.spectralNoiseFloor_dB &&
+        spectralDropOffset_dB == other.spectralDropOffset_dB &&
+        spectralFrequencyMin_Hz == other.spectralFrequencyMin_Hz &&
+        spectralFrequencyMax_Hz == other.spectralFrequencyMax_Hz &&
+        splitAtSilence == other.splitAtSilence;
+}
+
+// Process-wide cache of frame data. When several plugins are run over
+// the same audio in one host (as our scripts do with the four main
+// plugins) they would otherwise each run pYIN and the other
+// extractors over it separately. Only the frame-level parameters need
+// to match for the frame data to be shared. The cache holds its
+// entries only weakly, so an entry lasts for as long as some
+// CoreFeatures instance still has it, and no longer
+
+namespace {
+
+struct FrameDataCacheEntry {
+    uint64_t inputHash;
+    uint64_t inputLength;
+    double sampleRate;
+    CoreFeatures::Parameters parameters;
+    std::weak_ptr<const CoreFeatures::FrameData> data;
+};
+
+std::mutex frameDataCacheMutex;
+vector<FrameDataCacheEntry> frameDataCache;
+
+}
+
+void
+CoreFeatures::resetInputHash()
+{
+    m_inputHash = 14695981039346656037ull; // FNV-1a offset basis
+    m_inputLength = 0;
+}
+
+void
+CoreFeatures::hashInput(const float *input, int count)
+{
+    // 64-bit FNV-1a, taking a whole sample value at a time
+    for (int i = 0; i < count; ++i) {
+        uint32_t bits;
+        memcpy(&bits, input + i, sizeof(bits));
+        m_inputHash ^= bits;
+        m_inputHash *= 1099511628211ull;
+    }
+    m_inputLength += count;
+}
+
+std::shared_ptr<const CoreFeatures::FrameData>
+CoreFeatures::findCachedFrameData() const
+{
+    std::lock_guard<std::mutex> guard(frameDataCacheMutex);
+
+    for (const auto &entry : frameDataCache) {
+        if (entry.inputHash == m_inputHash &&
+            entry.inputLength == m_inputLength &&
+            entry.sampleRate == m_sampleRate &&
+            entry.parameters.hasSameFrameParameters(m_parameters)) {
+            auto data = entry.data.lock();
+            if (data) {
+                return data;
+            }
+        }
+    }
+    
+    return {};
+}
+
+void
+CoreFeatures::cacheFrameData() const
+{
+    std::lock_guard<std::mutex> guard(frameDataCacheMutex);
+
+    auto i = frameDataCache.begin();
+    while (i != frameDataCache.end()) {
+        if (i->data.expired()) {
+            i = frameDataCache.erase(i);
+        } else {
+            ++i;
+        }
+    }
+
+    FrameDataCacheEntry entry;
+    entry.inputHash = m_inputHash;
+    entry.inputLength = m_inputLength;
+    entry.sampleRate = m_sampleRate;
+    entry.parameters = m_parameters;
+    entry.data = m_frameData;
+    frameDataCache.push_back(entry);
+}
+
 CoreFeatures::CoreFeatures(double sampleRate) :
     m_sampleRate(sampleRate),
     m_initialised(false),
     m_finished(false),
     m_haveStartTime(false),
     m_pyin(sampleRate),
-    m_normalisationGain(1.f)
+    m_pyinDecoded(false),
+    m_normalisationGain(1.f),
+    m_segmentCount(0),
+    m_inputHash(0),
+    m_inputLength(0)
 { }
 
 void
@@ -291,6 +506,11 @@ CoreFeatures::initialise(Parameters parameters) {
         throw logic_error("CoreFeatures::initialise: Already initialised");
     }
 
+    if (parameters.stepSize < 1 ||
+        parameters.stepSize > parameters.blockSize) {
+        throw logic_error("CoreFeatures::initialise: stepSize must be > 0 and may not exceed blockSize");
+    }
+    
     m_parameters = parameters;
 
     auto pyinOutputs = m_pyin.getOutputDescriptors();
@@ -313,7 +533,7 @@ CoreFeatures::initialise(Parameters parameters) {
     m_pyin.setParameter("fixedlag",
                         m_parameters.pyinFixedLag ? 1.f : 0.f);
 
-    // See notes in finish() below about timing alignment - it is
+    // See notes in extractFrameData() below about timing alignment - it is
     // easier with precisetime, but pyin runs so much more slowly
     m_pyin.setParameter("precisetime",
                         m_parameters.pyinPreciseTiming ? 1.f : 0.f);
@@ -342,6 +562,10 @@ CoreFeatures::initialise(Parameters parameters) {
     }
     m_onsetLevelRise.initialise(levelRiseParameters);
 
+    m_scaled = vector<float>(m_parameters.blockSize, 0.f);
+    resetNormalisationGain();
+    resetInputHash();
+    
     m_haveStartTime = false;
 
     m_initialised = true;
@@ -355,23 +579,24 @@ CoreFeatures::reset()
     }
     m_finished = false;
 
+    // Stop any threads still using the extractors before resetting.
+    // Anything still queued is thrown away rather than analysed
+    m_queue.reset();
+    m_pipeline.reset();
+
     m_pyin.reset();
     m_power.reset();
     m_onsetLevelRise.reset();
 
     m_pyinPitchHz.clear();
-    m_pitch.clear();
-    m_filteredPitch.clear();
-    m_pitchOnsetDf.clear();
-    m_pitchOnsetDfValidity.clear();
-    m_rawPower.clear();
-    m_smoothedPower.clear();
-    m_pitchOnsets.clear();
-    m_levelRiseOnsets.clear();
-    m_powerRiseOnsets.clear();
-    m_mergedOnsets.clear();
-    m_onsetOffsets.clear();
-    m_normalisationGain = 1.f;
+    m_pyinDecodedPitchHz.clear();
+    m_pyinDecoded = false;
+    m_frameData.reset();
+    clearDecisions();
+    m_pending.clear();
+    m_pendingTimestamps.clear();
+    resetNormalisationGain();
+    resetInputHash();
 
     m_haveStartTime = false;
 }
@@ -386,30 +611,193 @@ CoreFeatures::process(const float *input, Vamp::RealTime timestamp)
         throw logic_error("CoreFeatures::process: Already finished");
     }
 
+    // The queue and pipeline threads are started only once there is
+    // input, so that an object that is initialised but never given
+    // any (as in SemanticAdapter or Combined) costs nothing
+    if (m_parameters.queueInput && !m_queue) {
+        startQueue();
+    }
+    
+    if (m_queue) {
+        m_queue->push(input, timestamp);
+    } else {
+        receiveInput(input, timestamp);
+    }
+}
+
+void
+CoreFeatures::receiveInput(const float *input, Vamp::RealTime timestamp)
+{
+    // Each block after the first begins stepSize samples after the
+    // start of the previous one, so only its final stepSize samples
+    // are new
+    int from = 0;
+    if (m_haveStartTime) {
+        from = m_parameters.blockSize - m_parameters.stepSize;
+    }
+
     if (!m_haveStartTime) {
         m_startTime = timestamp;
         m_haveStartTime = true;
     }
 
-    if (!m_parameters.normalise) {
+    hashInput(input + from, m_parameters.blockSize - from);
+    
+    if (isRetainingInput()) {
+        m_pending.insert(m_pending.end(),
+                         input + from, input + m_parameters.blockSize);
+        m_pendingTimestamps.push_back(timestamp);
+    } else if (!m_parameters.normalise) {
         actualProcess(input, timestamp);
     } else {
-        vector<float> buf(input, input + m_parameters.blockSize);
-        m_pending.push_back({ buf, timestamp });
+        // We were told the peak in advance, so can normalise and
+        // process each block as it arrives
+        for (int i = 0; i < m_parameters.blockSize; ++i) {
+            m_scaled[i] = input[i] * m_normalisationGain;
+        }
+        actualProcess(m_scaled.data(), timestamp);
     }
 }
 
+void
+CoreFeatures::refinish(Parameters parameters)
+{
+    assertFinished();
+
+    if (!parameters.hasSameFrameParameters(m_parameters)) {
+        throw logic_error("CoreFeatures::refinish: Frame-level parameters differ from those used to extract the frame data");
+    }
+
+    m_parameters = parameters;
+    m_finished = false;
+    clearDecisions();
+    actualFinish();
+}
+
+void
+CoreFeatures::saveFrameData(string filename) const
+{
+    assertFinished();
+    
+    FrameDataFile::Header header;
+    header.sampleRate = m_sampleRate;
+    header.startTime = m_startTime;
+    header.parameters = m_parameters;
+    FrameDataFile::write(filename, header, *m_frameData);
+}
+
+void
+CoreFeatures::finishFromFrameData(string filename)
+{
+    if (!m_initialised) {
+        throw logic_error("CoreFeatures::finishFromFrameData: Not initialised");
+    }
+    if (m_finished) {
+        throw logic_error("CoreFeatures::finishFromFrameData: Already finished");
+    }
+    if (m_haveStartTime) {
+        throw logic_error("CoreFeatures::finishFromFrameData: Input has already been provided through process()");
+    }
+
+    FrameDataFile::Header header;
+    auto data = FrameDataFile::read(filename, header);
+
+    if (header.sampleRate != m_sampleRate) {
+        throw std::runtime_error("CoreFeatures::finishFromFrameData: Sample rate in file \"" + filename + "\" does not match ours");
+    }
+    if (!header.parameters.hasSameFrameParameters(m_parameters)) {
+        throw std::runtime_error("CoreFeatures::finishFromFrameData: Frame-level parameters in file \"" + filename + "\" do not match ours");
+    }
+
+    m_startTime = header.startTime;
+    m_haveStartTime = true;
+    m_frameData = data;
+    m_segmentCount = 0;
+
+    actualFinish();
+}
+
 void
 CoreFeatures::actualProcess(const float *input, Vamp::RealTime timestamp)
+{
+    if (m_parameters.threadedExtraction && !m_pipeline) {
+        startPipeline();
+    }
+    
+    if (m_pipeline) {
+        m_pipeline->push(input, timestamp);
+    } else {
+        processPitch(input, timestamp);
+        m_power.process(input);
+        m_onsetLevelRise.process(input);
+    }
+}
+
+void
+CoreFeatures::processPitch(const float *input, Vamp::RealTime timestamp)
 {
     const float *const *iptr = &input;
     auto pyinFeatures = m_pyin.process(iptr, timestamp);
     for (const auto &f: pyinFeatures[m_pyinSmoothedPitchTrackOutput]) {
         m_pyinPitchHz.push_back(f.values[0]);
     }
+}
 
-    m_power.process(input);
-    m_onsetLevelRise.process(input);
+void
+CoreFeatures::startPipeline()
+{
+    // The three extractors share nothing until extractFrameData(),
+    // so each can have a thread to itself. pYIN is much the slowest,
+    // so the others will mostly be waiting for the caller, and the
+    // ring only needs to be big enough to smooth out pYIN's
+    // occasional slower steps
+    
+    std::vector<BlockPipeline::Consumer> consumers;
+    consumers.push_back([this](const float *input, Vamp::RealTime timestamp) {
+        processPitch(input, timestamp);
+    });
+    consumers.push_back([this](const float *input, Vamp::RealTime) {
+        m_power.process(input);
+    });
+    consumers.push_back([this](const float *input, Vamp::RealTime) {
+        m_onsetLevelRise.process(input);
+    });
+
+    m_pipeline = std::make_unique<BlockPipeline>
+        (m_parameters.blockSize, 64, consumers);
+}
+
+void
+CoreFeatures::finishPipeline()
+{
+    if (m_pipeline) {
+        m_pipeline->finish();
+    }
+}
+
+void
+CoreFeatures::startQueue()
+{
+    // The queue is sized to hold a few seconds of input, so that
+    // process() need never wait unless the analysis falls that far
+    // behind. A block is retained or handed on to the extractors in
+    // receiveInput() exactly as it would have been by process()
+    
+    int capacity = std::max(64, msToSteps(5000.0, m_parameters.stepSize, false));
+
+    m_queue = std::make_unique<BlockQueue>
+        (m_parameters.blockSize, capacity,
+         [this](const float *input, Vamp::RealTime timestamp) {
+             receiveInput(input, timestamp);
+         });
+}
+
+void
+CoreFeatures::finishQueue()
+{
+    if (m_queue) {
+        m_queue->finish();
+    }
 }
 
 void
@@ -419,36 +807,237 @@ CoreFeatures::finish()
         throw logic_error("CoreFeatures::finish: Already finished");
     }
 
-    if (m_parameters.normalise) {
+    // Everything queued must be received before we can look up the
+    // input hash or use the retained input
+    finishQueue();
+
+    m_segmentCount = 0;
+    m_frameData = findCachedFrameData();
+
+    if (m_frameData) {
+#ifdef DEBUG_CORE_FEATURES
+        cerr << "CoreFeatures::finish: found frame data in cache for "
+             << m_inputLength << " samples with hash " << m_inputHash
+             << ", skipping feature extraction" << endl;
+#endif
+        finishPipeline();
+    } else {
+        // Retained input doesn't go through the pipeline, as we can
+        // do better with it all available at once
+        finishPipeline();
+        if (isRetainingInput()) {
+            normalisePending();
+            if (m_parameters.splitAtSilence) {
+                m_frameData = extractFrameDataInSegments();
+            }
+            if (!m_frameData) {
+                processPending();
+            }
+        }
+        if (!m_frameData) {
+            m_frameData = extractFrameData();
+            m_segmentCount = 1;
+        }
+        cacheFrameData();
+    }
+
+    m_pending.clear();
+    m_pending.shrink_to_fit();
+    m_pendingTimestamps.clear();
+    
+    actualFinish();
+}
+
+int
+CoreFeatures::getExtractionThreadCount() const
+{
+    if (m_parameters.threadedExtraction || m_parameters.splitAtSilence) {
+        return getParallelThreadCount();
+    } else {
+        return 1;
+    }
+}
+
+void
+CoreFeatures::normalisePending()
+{
+    if (!m_parameters.normalise) {
+        return;
+    }
+    
+    int threads = getExtractionThreadCount();
+    int n = int(m_pending.size());
+
+    if (!haveKnownPeak()) {
         float max = 0.f;
-        for (const auto &p: m_pending) {
-            for (float f: p.first) {
-                float m = fabsf(f);
-                if (m > max) {
-                    max = m;
+        std::mutex maxMutex;
+        parallelFor(n, threads, [&](int from, int to) {
+            float rangeMax = 0.f;
+            for (int i = from; i < to; ++i) {
+                float m = fabsf(m_pending[i]);
+                if (m > rangeMax) {
+                    rangeMax = m;
                 }
             }
-        }
+            std::lock_guard<std::mutex> guard(maxMutex);
+            if (rangeMax > max) {
+                max = rangeMax;
+            }
+        });
         m_normalisationGain = 1.f / max;
 #ifdef DEBUG_CORE_FEATURES
-        cerr << "CoreFeatures::finish: signal max = " << max
+        cerr << "CoreFeatures::normalisePending: signal max = " << max
              << ", normalisation gain = " << m_normalisationGain << endl;
 #endif
-        for (auto &p: m_pending) {
-            auto v = p.first;
-            for (int i = 0; i < int(v.size()); ++i) {
-                v[i] *= m_normalisationGain;
+    }
+
+    // The pending buffer is discarded once we're done, so we can
+    // scale it in place and then process the blocks directly from it
+    parallelFor(n, threads, [&](int from, int to) {
+        for (int i = from; i < to; ++i) {
+            m_pending[i] *= m_normalisationGain;
+        }
+    });
+}
+
+void
+CoreFeatures::processPending()
+{
+    int threads = getExtractionThreadCount();
+    
+    int blocks = int(m_pendingTimestamps.size());
+    int stepSize = m_parameters.stepSize;
+    const float *pending = m_pending.data();
+
+    // Power and the spectra for SpectralLevelRise can be calculated
+    // for all blocks independently. pYIN, run through PYinVamp,
+    // cannot, as it carries state from one block to the next, so in
+    // threaded mode it gets the calling thread to itself while the
+    // others share the rest.
+    //
+    // Only pYIN's HMM decoding actually needs to be sequential,
+    // though, and without fixed-lag decoding that happens once over
+    // the whole input at the end. In that case we can do pYIN's work
+    // ourselves instead, spreading the per-block part across all of
+    // the threads, see decodePitchInParallel()
+    auto spectral = [=]() {
+        m_onsetLevelRise.processBatch(pending, stepSize, blocks, threads);
+        m_power.processBatch(pending, stepSize, blocks, threads);
+    };
+
+    if (m_parameters.threadedExtraction && !m_parameters.pyinFixedLag) {
+        spectral();
+        m_pyinDecodedPitchHz = decodePitchInParallel(pending, blocks, threads);
+        m_pyinDecoded = true;
+        return;
+    }
+
+    std::future<void> spectralDone;
+    if (threads > 1) {
+        spectralDone = std::async(std::launch::async, spectral);
+    }
+    
+    for (int i = 0; i < blocks; ++i) {
+        processPitch(pending + size_t(i) * stepSize, m_pendingTimestamps[i]);
+    }
+
+    if (threads > 1) {
+        spectralDone.get();
+    } else {
+        spectral();
+    }
+}
+
+vector<double>
+CoreFeatures::decodePitchInParallel(const float *pending, int blocks,
+                                    int threads) const
+{
+    // This does what PYinVamp does, with outputunvoiced = 2 and
+    // fixedlag off, and must return exactly the same smoothed pitch
+    // track as it would. The YIN analysis and candidate weighting for
+    // each block depend only on that block, so they are shared out
+    // across threads, each with its own Yin object. Then the whole
+    // table of candidates is decoded in one pass, as PYinVamp does in
+    // getRemainingFeatures()
+    
+    int blockSize = m_parameters.blockSize;
+    int stepSize = m_parameters.stepSize;
+    float lowAmp = m_parameters.pyinLowAmpSuppressionThreshold;
+
+    vector<vector<std::pair<double, double>>> pitchProb(blocks);
+    
+    parallelFor(blocks, threads, [&](int from, int to) {
+        Yin yin(blockSize, size_t(m_sampleRate), 0.0);
+        yin.setThresholdDistr(m_parameters.pyinThresholdDistribution);
+        yin.setFrameSize(blockSize);
+        yin.setFast(!m_parameters.pyinPreciseTiming);
+        vector<double> input(blockSize, 0.0);
+        for (int i = from; i < to; ++i) {
+            const float *block = pending + size_t(i) * stepSize;
+            float rms = 0.f;
+            for (int j = 0; j < blockSize; ++j) {
+                input[j] = block[j];
+                rms += block[j] * block[j];
+            }
+            rms /= blockSize;
+            rms = sqrtf(rms);
+            bool isLowAmplitude = (rms < lowAmp);
+            Yin::YinOutput yo = yin.processProbabilisticYin(input.data());
+            for (const auto &fp: yo.freqProb) {
+                double pitch = 12 * std::log(fp.first / 440) / std::log(2.) + 69;
+                if (!isLowAmplitude) {
+                    pitchProb[i].push_back({ pitch, fp.second });
+                } else {
+                    float factor = ((rms + 0.01 * lowAmp) / (1.01 * lowAmp));
+                    pitchProb[i].push_back({ pitch, fp.second * factor });
+                }
             }
-            actualProcess(v.data(), p.second);
         }
-        m_pending.clear();
+    });
+
+    vector<double> pitchHz;
+    if (blocks == 0) {
+        return pitchHz;
     }
     
-    actualFinish();
+    MonoPitchHMM hmm(0);
+    for (int i = 0; i < blocks; ++i) {
+        vector<double> obsProb = hmm.calculateObsProb(pitchProb[i]);
+        if (i == 0) {
+            hmm.initialise(obsProb);
+        } else {
+            hmm.process(obsProb);
+        }
+    }
+    vector<int> path = hmm.track();
+
+    // The HMM state gives only a quantised frequency. If it's a
+    // voiced state, pYIN reports the nearest of the candidates for
+    // that block instead, and we must do the same, in single
+    // precision as it does
+    for (int i = 0; i < int(path.size()); ++i) {
+        float hmmFreq = float(hmm.m_freqs[path[i]]);
+        float bestFreq = hmmFreq;
+        if (hmmFreq > 0) {
+            bestFreq = 0;
+            float leastDist = 10000;
+            for (const auto &pp: pitchProb[i]) {
+                float freq = float(440. * std::pow(2, (pp.first - 69) / 12));
+                float dist = std::abs(hmmFreq - freq);
+                if (dist < leastDist) {
+                    leastDist = dist;
+                    bestFreq = freq;
+                }
+            }
+        }
+        pitchHz.push_back(bestFreq);
+    }
+
+    return pitchHz;
 }
 
-void
-CoreFeatures::actualFinish()
+std::shared_ptr<const CoreFeatures::FrameData>
+CoreFeatures::extractFrameData()
 {
     // It's important to make sure the timings align for the values
     // returned by the various feature extractors.  They have the
@@ -482,25 +1071,395 @@ CoreFeatures::actualFinish()
     // method and expect it to be used whenever anything wants to map
     // from a hop number to a returned timestamp.
 
-    int toDropFromPYin = 0;
-    if (!m_parameters.pyinPreciseTiming) {
-        toDropFromPYin = (m_parameters.blockSize / 4) / m_parameters.stepSize;
+    auto data = std::make_shared<FrameData>();
+    data->normalisationGain = m_normalisationGain;
+    
+    int toDropFromPYin = getPYinStepsToDrop();
+    if (toDropFromPYin > 0) {
 #ifdef DEBUG_CORE_FEATURES
         cerr << "dropping " << toDropFromPYin << " opening values from pYin pitch track to compensate for imprecise timing mode" << endl;
 #endif
     }
     
-    auto pyinFeatures = m_pyin.getRemainingFeatures();
-    for (const auto &f: pyinFeatures[m_pyinSmoothedPitchTrackOutput]) {
+    vector<double> pyinTrack;
+    if (m_pyinDecoded) {
+        pyinTrack.swap(m_pyinDecodedPitchHz);
+        m_pyinDecoded = false;
+    } else {
+        auto pyinFeatures = m_pyin.getRemainingFeatures();
+        for (const auto &f: pyinFeatures[m_pyinSmoothedPitchTrackOutput]) {
+            pyinTrack.push_back(f.values[0]);
+        }
+    }
+    for (auto hz: pyinTrack) {
         if (toDropFromPYin > 0) {
             --toDropFromPYin;
         } else {
-            m_pyinPitchHz.push_back(f.values[0]);
+            m_pyinPitchHz.push_back(hz);
+        }
+    }
+    data->pyinPitchHz.swap(m_pyinPitchHz);
+
+    // Retrieve the other detection function sources now. Their
+    // lengths can differ because of framing differences - we
+    // truncate the power curves to the length of the pitch track
+    // here, and actualFinish() deals with any remaining shortfall
+
+    data->rawPower = m_power.getRawPower();
+    data->smoothedPower = m_power.getSmoothedPower();
+    data->riseFractions = m_onsetLevelRise.getFractions();
+    data->binCount = m_onsetLevelRise.getBinCount();
+    data->binsAboveNoiseFloor = m_onsetLevelRise.getBinsAboveNoiseFloor();
+    data->binsAboveOffset = m_onsetLevelRise.getBinsAboveOffset();
+
+    // The extractors' own copies are no longer needed
+    m_power.reset();
+    m_onsetLevelRise.reset();
+    
+    int n = data->pyinPitchHz.size();
+    if (int(data->rawPower.size()) > n) {
+#ifdef DEBUG_CORE_FEATURES
+        cerr << "pitch has " << n << " steps but power has "
+             << data->rawPower.size() << ", truncating it" << endl;
+#endif
+        data->rawPower.resize(n);
+        data->smoothedPower.resize(n);
+    }
+
+    return data;
+}
+
+int
+CoreFeatures::getPYinStepsToDrop() const
+{
+    // See extractFrameData() above
+    if (m_parameters.pyinPreciseTiming) {
+        return 0;
+    } else {
+        return (m_parameters.blockSize / 4) / m_parameters.stepSize;
+    }
+}
+
+std::shared_ptr<const CoreFeatures::FrameData>
+CoreFeatures::extractFrameDataInSegments()
+{
+    // A cheap first pass calculates the power for every step, which
+    // we need anyway, and finds the silences. Then the recording is
+    // split in the middle of each sufficiently long silence, and the
+    // segments are analysed in parallel, each with its own
+    // CoreFeatures object. The results are stitched together to give
+    // the same frame data as for the whole recording.
+    //
+    // Power and the spectral bins are per-step, so they come out the
+    // same however we split. Each segment is analysed for lookahead
+    // steps past its end, enough for its last rise fraction to see
+    // the full history, and for pYIN's opening values (which we drop,
+    // see extractFrameData()) to be covered. Since the silence
+    // continues for at least that long after the split, the rise
+    // fractions also come out the same. pYIN's pitch track is decoded
+    // per segment, but by splitting only in long silences we expect
+    // it to have settled into its unvoiced states by the split point
+    // in either case.
+    
+    int threads = getExtractionThreadCount();
+    int blocks = int(m_pendingTimestamps.size());
+    int stepSize = m_parameters.stepSize;
+    const float *pending = m_pending.data();
+
+    Power::Parameters powerParameters;
+    powerParameters.blockSize = m_parameters.blockSize;
+    Power power;
+    power.initialise(powerParameters);
+    power.processBatch(pending, stepSize, blocks, threads);
+    auto rawPower = power.getRawPower();
+
+    // A step is silent if its raw power is below Power's own
+    // threshold. That depends only on the input, so frame-level
+    // parameters such as the spectral noise floor can't move the
+    // split points
+    double silenceThreshold_dB = powerParameters.threshold_dB;
+
+    int lookahead = std::max(getPYinStepsToDrop(),
+                             m_onsetLevelRise.getHistoryLength() - 1);
+    int minimumSilence = std::max(lookahead * 2,
+                                  msToSteps(1000.0, stepSize, false));
+
+    // Segment i runs from step starts[i] to starts[i+1] (or the end)
+    std::vector<int> starts { 0 };
+    int silenceStart = -1;
+    for (int i = 0; i < blocks; ++i) {
+        if (rawPower[i] < silenceThreshold_dB) {
+            if (silenceStart < 0) {
+                silenceStart = i;
+            }
+            continue;
+        }
+        if (silenceStart > 0 && i - silenceStart >= minimumSilence) {
+            starts.push_back(silenceStart + (i - silenceStart) / 2);
+        }
+        silenceStart = -1;
+    }
+
+#ifdef DEBUG_CORE_FEATURES
+    cerr << "CoreFeatures::extractFrameDataInSegments: found "
+         << starts.size() << " segment(s) in " << blocks << " steps" << endl;
+#endif
+    
+    if (starts.size() < 2) {
+        return {};
+    }
+    
+    int segments = int(starts.size());
+    std::vector<std::shared_ptr<const FrameData>> segmentData(segments);
+
+    Parameters segmentParameters(m_parameters);
+    segmentParameters.normalise = false; // we already did
+    segmentParameters.threadedExtraction = false;
+    segmentParameters.queueInput = false;
+    segmentParameters.splitAtSilence = false;
+
+    // The segments may be of very different lengths, so rather than
+    // divide them up in advance, each thread takes the next one
+    // available whenever it becomes free
+    std::atomic<int> nextSegment(0);
+    parallelFor(segments, threads, [&](int, int) {
+        int i;
+        while ((i = nextSegment++) < segments) {
+            int start = starts[i];
+            int end = blocks;
+            if (i + 1 < segments) {
+                end = std::min(blocks, starts[i + 1] + lookahead);
+            }
+            CoreFeatures segment(m_sampleRate);
+            segment.initialise(segmentParameters);
+            for (int j = start; j < end; ++j) {
+                segment.actualProcess(pending + size_t(j) * stepSize,
+                                      m_pendingTimestamps[j]);
+            }
+            segmentData[i] = segment.extractFrameData();
         }
+    });
+
+    auto data = std::make_shared<FrameData>();
+    data->normalisationGain = m_normalisationGain;
+    data->binCount = segmentData[0]->binCount;
+    data->binsAboveNoiseFloor = BinSets
+        (segmentData[0]->binsAboveNoiseFloor.getFirstBin(), data->binCount);
+    data->binsAboveOffset = data->binsAboveNoiseFloor;
+    
+    for (int i = 0; i < segments; ++i) {
+        const FrameData &d = *segmentData[i];
+        bool last = (i + 1 == segments);
+        auto take = [&](int available) {
+            if (last) return available;
+            int n = starts[i + 1] - starts[i];
+            if (available < n) {
+                throw logic_error("CoreFeatures::extractFrameDataInSegments: Segment is missing lookahead steps");
+            }
+            return n;
+        };
+        int n = take(int(d.pyinPitchHz.size()));
+        data->pyinPitchHz.insert(data->pyinPitchHz.end(),
+                                 d.pyinPitchHz.begin(),
+                                 d.pyinPitchHz.begin() + n);
+        n = take(int(d.riseFractions.size()));
+        data->riseFractions.insert(data->riseFractions.end(),
+                                   d.riseFractions.begin(),
+                                   d.riseFractions.begin() + n);
+        n = take(d.binsAboveNoiseFloor.getStepCount());
+        data->binsAboveNoiseFloor.appendSteps(d.binsAboveNoiseFloor, 0, n);
+        n = take(d.binsAboveOffset.getStepCount());
+        data->binsAboveOffset.appendSteps(d.binsAboveOffset, 0, n);
+    }
+
+    // Power is truncated to the pitch track length, as in
+    // extractFrameData(), but only after smoothing the whole thing
+    data->rawPower = rawPower;
+    data->smoothedPower = power.getSmoothedPower();
+    int n = data->pyinPitchHz.size();
+    if (int(data->rawPower.size()) > n) {
+        data->rawPower.resize(n);
+        data->smoothedPower.resize(n);
     }
 
+    m_segmentCount = segments;
+    return data;
+}
+
+void
+CoreFeatures::clearDecisions()
+{
+    m_pitch.clear();
+    m_filteredPitch.clear();
+    m_pitchOnsetDf.clear();
+    m_pitchOnsetDfValidity.clear();
+    m_offsetDropDf.clear();
+    m_pitchOnsets.clear();
+    m_levelRiseOnsets.clear();
+    m_powerRiseOnsets.clear();
+    m_notes.clear();
+}
+
+std::pair<int, CoreFeatures::OffsetType>
+CoreFeatures::findOffset(const FrameData &frames,
+                         int sustainBegin, int limit,
+                         int nBinsAtBegin, double powerDropTarget)
+{
+    // Find the power drop first, as a plain scan through the raw
+    // power. A spectral drop only counts if it comes before that, so
+    // we need not compare the bins at any step from there on
+    
+    const vector<double> &rawPower = frames.rawPower;
+    
+    int drop = sustainBegin;
+    while (drop < limit && !(rawPower[drop] < powerDropTarget)) {
+        ++drop;
+    }
+
+#ifdef DEBUG_CORE_FEATURES
+    if (drop < limit) {
+        cerr << "at step " << drop << " found power " << rawPower[drop]
+             << " which falls below target power "
+             << powerDropTarget << endl;
+    }
+#endif
+
+    if (nBinsAtBegin > 0) {
+
+        float offsetRatio =
+            m_parameters.spectralDropOffsetRatio_percent / 100.f;
+        
+        for (int q = sustainBegin; q < drop; ++q) {
+
+            // The number of bins active here that were also active at
+            // the sustain begin step
+            int remaining =
+                frames.binsAboveOffset.countIntersectionAt(q, sustainBegin);
+
+            double df = double(remaining) / double(nBinsAtBegin);
+            m_offsetDropDf[q] = df;
+
+#ifdef DEBUG_CORE_FEATURES
+            cerr << "at step " << q << " we have "
+                 << frames.binsAboveOffset.countAt(q)
+                 << " bins active of which " << remaining
+                 << " remain from the sustain begin step, giving df value "
+                 << df << endl;
+#endif
+
+            if (df <= offsetRatio) {
+                return { q, OffsetType::SpectralLevelDrop };
+            }
+        }
+    }
+
+    if (drop < limit) {
+        return { drop, OffsetType::PowerDrop };
+    } else {
+        return { limit, OffsetType::FollowingOnsetReached };
+    }
+}
+
+vector<int>
+CoreFeatures::findPowerRiseOnsets(const vector<double> &rawPower,
+                                  int n, int windowSteps,
+                                  double threshold_dB)
+{
+    // A step i starts a rise if, scanning forward from it through
+    // at most windowSteps further steps, the power exceeds its level
+    // at i by more than threshold_dB before it dips below that
+    // level. Scanning for every step costs O(n * windowSteps), so we
+    // work out the same thing from two linear-time passes:
+    //
+    // - Right to left, find the first later step whose power is
+    //   below that at i (dip[i]) with a stack of candidate steps,
+    //   and at the same time the maximum power from i up to that dip
+    //   (maxToDip[i]), as the ranges covered by the steps we pop
+    //   from the stack exactly cover the range from i+1 to the dip
+    //
+    // - Left to right, the maximum power across the whole window
+    //   from i, with a deque of steps in decreasing order of power
+    //
+    // If the dip comes within the window, the scan would have
+    // stopped there and the maximum up to the dip is the one that
+    // counts; otherwise it's the maximum across the whole window.
+
+    int size = int(rawPower.size());
+    int last = size - windowSteps - 1; // last step with a full window
+    vector<bool> rises(size, false);
+
+    if (last >= 0 && windowSteps >= 0) {
+
+        vector<int> dip(size, size);
+        vector<double> maxToDip(size, 0.0);
+        vector<int> stack;
+        for (int i = size - 1; i >= 0; --i) {
+            double m = rawPower[i];
+            while (!stack.empty() && !(rawPower[stack.back()] < rawPower[i])) {
+                m = std::max(m, maxToDip[stack.back()]);
+                stack.pop_back();
+            }
+            if (!stack.empty()) {
+                dip[i] = stack.back();
+            }
+            maxToDip[i] = m;
+            stack.push_back(i);
+        }
+
+        std::deque<int> window;
+        for (int j = 0; j < windowSteps && j < size; ++j) {
+            while (!window.empty() && rawPower[window.back()] <= rawPower[j]) {
+                window.pop_back();
+            }
+            window.push_back(j);
+        }
+        for (int i = 0; i <= last; ++i) {
+            int j = i + windowSteps;
+            while (!window.empty() && rawPower[window.back()] <= rawPower[j]) {
+                window.pop_back();
+            }
+            window.push_back(j);
+            while (window.front() < i) {
+                window.pop_front();
+            }
+            double max = (dip[i] <= j ? maxToDip[i] : rawPower[window.front()]);
+            rises[i] = (max > rawPower[i] + threshold_dB);
+        }
+    }
+
+    // When we see a rise coming, don't actually record the onset
+    // until we see the derivative of raw power begin to fall again,
+    // otherwise the onset appears early. While waiting for that, we
+    // don't look for further rises.
+    
+    vector<int> onsets;
+    bool onsetComing = false;
+    double prevDerivative = 0.0;
+    
+    for (int i = 0; i + 1 < n; ++i) {
+        double derivative = rawPower[i+1] - rawPower[i];
+        if (onsetComing) {
+            if (derivative < prevDerivative) {
+                onsets.push_back(i);
+                onsetComing = false;
+            }
+        } else if (rises[i]) {
+            onsetComing = true;
+        }
+        prevDerivative = derivative;
+    }
+
+    return onsets;
+}
+
+void
+CoreFeatures::actualFinish()
+{
+    const FrameData &frames = *m_frameData;
+    const vector<double> &rawPower = frames.rawPower;
+    
     double prevHz = 0.0;
-    for (auto hz : m_pyinPitchHz) {
+    for (auto hz : frames.pyinPitchHz) {
         if (hz > 0.0) {
             m_pitch.push_back(hzToPitch(hz));
             prevHz = hz;
@@ -511,35 +1470,22 @@ CoreFeatures::actualFinish()
         }
     }
 
-    // Retrieve the other detection function sources now and establish
-    // the proper lengths - they can differ because of framing
-    // differences, but we want to make sure we never index anything
-    // beyond the length of the shortest
-
-    vector<double> riseFractions = m_onsetLevelRise.getFractions();
-    m_rawPower = m_power.getRawPower();
-    m_smoothedPower = m_power.getSmoothedPower();
+    // We want to make sure we never index anything beyond the length
+    // of the shortest detection function source
 
     int n = m_pitch.size();
 #ifdef DEBUG_CORE_FEATURES
     cerr << "pitch has " << n << " steps" << endl;
 #endif
     
-    if (int(m_rawPower.size()) < n) {
-        n = m_rawPower.size();
+    if (int(rawPower.size()) < n) {
+        n = rawPower.size();
 #ifdef DEBUG_CORE_FEATURES
         cerr << "but power only " << n << ", reducing count" << endl;
 #endif
-    } else if (int(m_rawPower.size()) > n) {
-#ifdef DEBUG_CORE_FEATURES
-        cerr << "but power has " << m_rawPower.size() << ", truncating it" << endl;
-#endif
-        m_rawPower = vector<double>(m_rawPower.begin(),
-                                    m_rawPower.begin() + n);
-        m_smoothedPower = vector<double>(m_smoothedPower.begin(),
-                                         m_smoothedPower.begin() + n);
     }
     
+    vector<double> riseFractions = frames.riseFractions;
     if (int(riseFractions.size()) < n) {
 #ifdef DEBUG_CORE_FEATURES
         cerr << "but riseFractions only " << riseFractions.size() << ", zero-padding it at end" << endl;
@@ -573,7 +1519,7 @@ CoreFeatures::actualFinish()
    int lastAbsence = -halfLength;
     for (int i = 0; i + halfLength < n; ++i) {
         bool valid = false;
-        if (m_pyinPitchHz[i + halfLength] <= 0.0) {
+        if (frames.pyinPitchHz[i + halfLength] <= 0.0) {
             lastAbsence = i;
         } else {
             valid = (i - lastAbsence > halfLength);
@@ -607,7 +1553,7 @@ CoreFeatures::actualFinish()
                     continue;
                 }
                 if (aboveThresholdCount > vibratoSuppressionThresholdSteps) {
-                    m_pitchOnsets.insert(i);
+                    m_pitchOnsets.push_back(i);
                 }
             }
             aboveThresholdCount = 0;
@@ -625,62 +1571,54 @@ CoreFeatures::actualFinish()
             aboveThreshold = true;
         } else if (riseFractions[i] < lowerThreshold) {
             if (aboveThreshold) {
-                m_levelRiseOnsets.insert(i);
+                m_levelRiseOnsets.push_back(i);
                 aboveThreshold = false;
             }
         }
     }
 
     int rawPowerSteps = msToSteps(50.0, m_parameters.stepSize, false);
-    bool onsetComing = false;
-    double prevDerivative = 0.0;
-
-    // Iterate through raw power, and when we see a rise above a
-    // certain level within the following rawPowerSteps, make note
-    // that we have an onset coming (onsetComing = true). But
-    // don't actually record the onset (insert into
-    // m_powerRiseOnsets) until we see the derivative of raw power
-    // begin to fall again, otherwise the onset appears early.
+    m_powerRiseOnsets = findPowerRiseOnsets
+        (rawPower, n, rawPowerSteps,
+         m_parameters.onsetSensitivityRawPowerThreshold_dB);
+
+    // Each of the three onset lists is in order already. Where more
+    // than one detector has an onset at the same step, the power rise
+    // takes precedence over the spectral rise, and that over the
+    // pitch change, so we keep only the last of any equal steps after
+    // a stable sort
     
-    for (int i = 0; i + 1 < n; ++i) {
-        double derivative = m_rawPower[i+1] - m_rawPower[i];
-        if (onsetComing) {
-            if (derivative < prevDerivative) {
-                m_powerRiseOnsets.insert(i);
-                onsetComing = false;
-            }
-        } else if (i + rawPowerSteps < int(m_rawPower.size())) {
-            for (int j = i; j <= i + rawPowerSteps; ++j) {
-                if (m_rawPower[j] < m_rawPower[i]) {
-                    break;
-                }
-                if (m_rawPower[j] > m_rawPower[i] +
-                    m_parameters.onsetSensitivityRawPowerThreshold_dB) {
-                    onsetComing = true;
-                    break;
-                }
-            }
-        }
-        prevDerivative = derivative;
-    }
-
-    map<int, OnsetType> mergingOnsets;
+    typedef std::pair<int, OnsetType> TypedOnset;
+    vector<TypedOnset> mergingOnsets;
+    mergingOnsets.reserve(m_pitchOnsets.size() + m_levelRiseOnsets.size() +
+                          m_powerRiseOnsets.size());
     for (auto p : m_pitchOnsets) {
-        mergingOnsets[p] = OnsetType::Pitch;
+        mergingOnsets.push_back({ p, OnsetType::Pitch });
     }
     for (auto p : m_levelRiseOnsets) {
-        mergingOnsets[p] = OnsetType::SpectralLevelRise;
+        mergingOnsets.push_back({ p, OnsetType::SpectralLevelRise });
     }
     for (auto p : m_powerRiseOnsets) {
-        mergingOnsets[p] = OnsetType::PowerRise;
+        mergingOnsets.push_back({ p, OnsetType::PowerRise });
     }
+    std::stable_sort(mergingOnsets.begin(), mergingOnsets.end(),
+                     [](const TypedOnset &a, const TypedOnset &b) {
+                         return a.first < b.first;
+                     });
 
+    vector<TypedOnset> mergedOnsets;
+    
     int prevP = -minimumOnsetSteps;
     OnsetType prevType = OnsetType::Pitch;
         
-    for (auto pq : mergingOnsets) {
-        int p = pq.first;
-        auto type = pq.second;
+    for (int k = 0; k < int(mergingOnsets.size()); ++k) {
+        int p = mergingOnsets[k].first;
+        auto type = mergingOnsets[k].second;
+
+        if (k + 1 < int(mergingOnsets.size()) &&
+            mergingOnsets[k + 1].first == p) {
+            continue;
+        }
             
         if (p < prevP + minimumOnsetSteps) {
 
@@ -703,7 +1641,8 @@ CoreFeatures::actualFinish()
                  type == OnsetType::SpectralLevelRise);
             
             if (isHigherRanked) {
-                m_mergedOnsets.erase(prevP);
+                // prevP is always the last onset we kept
+                mergedOnsets.pop_back();
             } else {
                 // This onset follows another one within the minimum
                 // onset interval, but it is of a lower-ranked type,
@@ -714,7 +1653,7 @@ CoreFeatures::actualFinish()
             }
         }
 
-        m_mergedOnsets[p] = type;
+        mergedOnsets.push_back({ p, type });
 
         prevP = p;
         prevType = type;
@@ -723,40 +1662,40 @@ CoreFeatures::actualFinish()
     int sustainBeginSteps = msToSteps(m_parameters.sustainBeginThreshold_ms,
                                       m_parameters.stepSize, false);
 
-    map<int, double> offsetDropDfEntries;
+    // Each note writes the offset drop df only within its own range
+    // from sustain begin to the following onset, so these never
+    // overlap
+    m_offsetDropDf = vector<double>(n, 1.0);
 
     // Onsets that turn out to have nothing going on at all when the
-    // sustain start time arrives are spurious and may be removed
-    set<int> spuriousOnsets;
+    // sustain start time arrives are spurious and are left out of the
+    // note table, though they still limit the preceding note
+    m_notes.reserve(int(mergedOnsets.size()));
     
-    for (auto i = m_mergedOnsets.begin(); i != m_mergedOnsets.end(); ++i) {
-        int p = i->first;
+    for (int k = 0; k < int(mergedOnsets.size()); ++k) {
+        int p = mergedOnsets[k].first;
         int limit = n;
-        auto j = i;
-        if (++j != m_mergedOnsets.end()) {
-            limit = j->first; // stop at the next onset
+        if (k + 1 < int(mergedOnsets.size())) {
+            limit = mergedOnsets[k + 1].first; // stop at the next onset
         }
 
-        set<int> binsAtBegin;
         int nBinsAtBegin = 0;
         double powerDropTarget = -100.0;
 
         int s = p + sustainBeginSteps;
 
         if (s < n) {
-            auto bins = m_onsetLevelRise.getBinsAboveOffsetAt(s);
-            binsAtBegin.insert(bins.begin(), bins.end());
-            nBinsAtBegin = bins.size();
+            nBinsAtBegin = frames.binsAboveOffset.countAt(s);
             
             powerDropTarget =
-                m_rawPower[s] - m_parameters.noteDurationThreshold_dB;
+                rawPower[s] - m_parameters.noteDurationThreshold_dB;
 
 #ifdef DEBUG_CORE_FEATURES
             cerr << "at sustain begin step " << s << " found power "
-                 << m_rawPower[s] << ", threshold "
+                 << rawPower[s] << ", threshold "
                  << m_parameters.noteDurationThreshold_dB
                  << " giving target power " << powerDropTarget
-                 << "; we have " << binsAtBegin.size()
+                 << "; we have " << nBinsAtBegin
                  << " bins active" << endl;
 #endif
 
@@ -765,7 +1704,6 @@ CoreFeatures::actualFinish()
                 cerr << "no bins active at sustain start index " << s
                      << ", marking onset as spurious" << endl;
 #endif
-                spuriousOnsets.insert(p);
                 continue;
             }
             
@@ -774,79 +1712,15 @@ CoreFeatures::actualFinish()
             cerr << "sustain start index " << s
                  << " out of range at end, marking onset as spurious" << endl;
 #endif
-            spuriousOnsets.insert(p);
             continue;
         }
         
-        int q = s;
-        OffsetType type = OffsetType::FollowingOnsetReached;
-        
-        while (q < limit) {
-
-            if (m_rawPower[q] < powerDropTarget) {
-
-#ifdef DEBUG_CORE_FEATURES
-                cerr << "at step " << q << " found power " << m_rawPower[q]
-                     << " which falls below target power "
-                     << powerDropTarget << endl;
-#endif
-                
-                type = OffsetType::PowerDrop;
-                break;
-
-            } else if (nBinsAtBegin > 0) {
-
-                auto binsHere = m_onsetLevelRise.getBinsAboveOffsetAt(q);
-                int remaining = 0;
-                for (auto bin: binsHere) {
-                    if (binsAtBegin.find(bin) != binsAtBegin.end()) {
-                        ++remaining;
-                    }
-                }
-
-                double df = double(remaining) / double(nBinsAtBegin);
-                offsetDropDfEntries[q] = df;
-                                                                    
-#ifdef DEBUG_CORE_FEATURES
-                cerr << "at step " << q << " we have " << binsHere.size()
-                     << " bins active of which " << remaining
-                     << " remain from the sustain begin step, giving df value "
-                     << df << endl;
-#endif
-
-                float offsetRatio =
-                    m_parameters.spectralDropOffsetRatio_percent / 100.f;
-
-                if (df <= offsetRatio) {
-                    type = OffsetType::SpectralLevelDrop;
-                    break;
-                }
-            }
-                
-            ++q;
-        }
-        if (q >= limit) {
-            m_onsetOffsets[p] = { limit, type };
-        } else {
-            m_onsetOffsets[p] = { q, type };
-        }
+        auto offset = findOffset(frames, s, limit, nBinsAtBegin,
+                                 powerDropTarget);
+        m_notes.add({ p, offset.first, mergedOnsets[k].second,
+                      offset.second });
     }
 
-    if (!spuriousOnsets.empty()) {
-#ifdef DEBUG_CORE_FEATURES
-        cerr << "removing " << spuriousOnsets.size()
-             << " spurious onsets" << endl;
-#endif
-        for (auto p : spuriousOnsets) {
-            m_mergedOnsets.erase(p);
-        }
-    }
-
-    m_offsetDropDf = vector<double>(n, 1.0);
-    for (auto e: offsetDropDfEntries) {
-        m_offsetDropDf[e.first] = e.second;
-    }
-    
     m_finished = true;
 }
 
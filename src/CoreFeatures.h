@@ -22,13 +22,15 @@
 
 #include "Power.h"
 #include "SpectralLevelRise.h"
+#include "BlockPipeline.h"
+#include "BlockQueue.h"
 
 #include "../ext/pyin/PYinVamp.h"
 
 #include <vector>
-#include <set>
-#include <map>
+#include <algorithm>
 #include <memory>
+#include <cstdint>
 
 /** Extractor for features (pitch, onsets etc) that Expressive Means
  *  plugins have in common.
@@ -50,6 +52,7 @@ public:
         int stepSize;
         int blockSize;
         bool normalise;
+        float knownPeak;
         float pyinThresholdDistribution;
         float pyinLowAmpSuppressionThreshold;
         bool pyinFixedLag;
@@ -69,11 +72,15 @@ public:
         float spectralDropOffsetRatio_percent;
         float spectralFrequencyMin_Hz;
         float spectralFrequencyMax_Hz;
+        bool threadedExtraction;
+        bool queueInput;
+        bool splitAtSilence;
 
         Parameters() :
             stepSize(256),
             blockSize(2048),
             normalise(true),
+            knownPeak(0.f),
             pyinThresholdDistribution(2.f),
             pyinLowAmpSuppressionThreshold(0.1f),
             pyinFixedLag(true),
@@ -92,7 +99,10 @@ public:
             spectralDropOffset_dB(-60.f),
             spectralDropOffsetRatio_percent(40.f),
             spectralFrequencyMin_Hz(100.f),
-            spectralFrequencyMax_Hz(4000.f)
+            spectralFrequencyMax_Hz(4000.f),
+            threadedExtraction(false),
+            queueInput(false),
+            splitAtSilence(false)
         {}
 
         static void appendVampParameterDescriptors(Vamp::Plugin::ParameterList &,
@@ -100,6 +110,36 @@ public:
 
         bool acceptVampParameter(std::string identifier, float value);
         bool obtainVampParameter(std::string identifier, float &value) const;
+
+        bool operator==(const Parameters &other) const;
+        bool operator!=(const Parameters &other) const {
+            return !(*this == other);
+        }
+
+        /** Return true if the parameters that affect the frame data
+         *  (see FrameData below) are the same in both. The rest only
+         *  affect the onset and offset decisions made from it.
+         */
+        bool hasSameFrameParameters(const Parameters &other) const;
+    };
+
+    /** The per-step results of the expensive feature extractors
+     *  (pYIN, Power, SpectralLevelRise), from which all of the
+     *  onset and offset decisions are then made. These are shared
+     *  read-only between CoreFeatures instances that analyse the
+     *  same input with the same frame-level parameters - see finish().
+     */
+    struct FrameData {
+        float normalisationGain;
+        std::vector<double> pyinPitchHz;
+        std::vector<double> rawPower;
+        std::vector<double> smoothedPower;
+        std::vector<double> riseFractions;
+        int binCount;
+        BinSets binsAboveNoiseFloor;
+        BinSets binsAboveOffset;
+
+        FrameData() : normalisationGain(1.f), binCount(0) { }
     };
 
     enum class OnsetType {
@@ -114,21 +154,169 @@ public:
         FollowingOnsetReached
     };
 
+    /** A single note, from its onset step to its offset step. */
+    struct Note {
+        int onset;
+        int offset;
+        OnsetType onsetType;
+        OffsetType offsetType;
+
+        bool operator==(const Note &other) const {
+            return onset == other.onset && offset == other.offset &&
+                onsetType == other.onsetType &&
+                offsetType == other.offsetType;
+        }
+        bool operator!=(const Note &other) const {
+            return !(*this == other);
+        }
+    };
+
+    /** The notes found in a signal, held contiguously in order of
+     *  onset, with no two sharing an onset step. Notes are looked up
+     *  by onset step with a binary search.
+     */
+    class NoteTable
+    {
+    public:
+        typedef std::vector<Note>::const_iterator const_iterator;
+
+        /** Add a note, replacing any existing one with the same
+         *  onset. This is quickest when notes are added in order of
+         *  onset, as they normally are.
+         */
+        void add(const Note &note) {
+            if (m_notes.empty() || m_notes.back().onset < note.onset) {
+                m_notes.push_back(note);
+                return;
+            }
+            auto itr = std::lower_bound(m_notes.begin(), m_notes.end(),
+                                        note.onset, isBefore);
+            if (itr != m_notes.end() && itr->onset == note.onset) {
+                *itr = note;
+            } else {
+                m_notes.insert(itr, note);
+            }
+        }
+
+        void clear() { m_notes.clear(); }
+        void reserve(int n) { m_notes.reserve(n); }
+        
+        bool empty() const { return m_notes.empty(); }
+        int size() const { return int(m_notes.size()); }
+
+        const Note &operator[](int i) const { return m_notes[i]; }
+        const_iterator begin() const { return m_notes.begin(); }
+        const_iterator end() const { return m_notes.end(); }
+
+        /** Return the note with exactly the given onset step, or
+         *  end() if there is none.
+         */
+        const_iterator find(int onset) const {
+            auto itr = lower_bound(onset);
+            if (itr != end() && itr->onset == onset) {
+                return itr;
+            }
+            return end();
+        }
+
+        /** Return the first note whose onset is at or after the given
+         *  step, or end() if there is none.
+         */
+        const_iterator lower_bound(int step) const {
+            return std::lower_bound(m_notes.begin(), m_notes.end(),
+                                    step, isBefore);
+        }
+
+        /** Return the first note whose onset is after the given step,
+         *  or end() if there is none.
+         */
+        const_iterator upper_bound(int step) const {
+            return std::upper_bound(m_notes.begin(), m_notes.end(),
+                                    step, isAfter);
+        }
+
+        /** Return the onset step of the note following the given one,
+         *  or the given default if it is the last.
+         */
+        int getFollowingOnset(const_iterator itr, int ifLast) const {
+            if (itr == end() || ++itr == end()) {
+                return ifLast;
+            }
+            return itr->onset;
+        }
+
+        bool operator==(const NoteTable &other) const {
+            return m_notes == other.m_notes;
+        }
+        bool operator!=(const NoteTable &other) const {
+            return !(*this == other);
+        }
+
+    private:
+        std::vector<Note> m_notes;
+
+        static bool isBefore(const Note &note, int step) {
+            return note.onset < step;
+        }
+        static bool isAfter(int step, const Note &note) {
+            return step < note.onset;
+        }
+    };
+
     void initialise(Parameters parameters);
     void reset();
     void process(const float *input, Vamp::RealTime timestamp);
     void finish();
 
+    /** Make the onset and offset decisions again, from the frame data
+     *  already extracted, using the given parameters. This is much
+     *  cheaper than reprocessing the input, but it is only possible
+     *  if the frame-level parameters (see
+     *  Parameters::hasSameFrameParameters) are unchanged - note that
+     *  these include the onset level sensitivity and noise time
+     *  window, which determine the spectral rise fractions. May only
+     *  be called after finish(). Throws std::logic_error if the
+     *  frame-level parameters differ.
+     */
+    void refinish(Parameters parameters);
+
+    /** Write the frame data to the given file, in the format described
+     *  in FrameDataFile.h. May only be called after finish(). Throws
+     *  std::runtime_error if the file cannot be written.
+     */
+    void saveFrameData(std::string filename) const;
+
+    /** Instead of calling process() and finish(), load frame data
+     *  previously written by saveFrameData() and make the onset and
+     *  offset decisions from it. The CoreFeatures must have been
+     *  initialised (or reset) and given no input, and the sample rate
+     *  and frame-level parameters must match those the file was
+     *  written with. Throws std::runtime_error if the file cannot be
+     *  read or does not match.
+     */
+    void finishFromFrameData(std::string filename);
+
     float
     getNormalisationGain() const {
         assertFinished();
-        return m_normalisationGain;
+        return m_frameData->normalisationGain;
+    }
+
+    /** Return the number of segments the frame data were extracted
+     *  in. This is more than 1 only if splitAtSilence was set and
+     *  suitable silences were found, and is 0 if the frame data came
+     *  from the cache or from a file rather than from extraction.
+     */
+    int
+    getSegmentCount() const {
+        assertFinished();
+        return m_segmentCount;
     }
     
     std::vector<double>
     getPYinPitch_Hz() const {
         assertFinished();
-        return m_pyinPitchHz;
+        return m_frameData->pyinPitchHz;
     }
     
     std::vector<double>
@@ -158,37 +346,49 @@ public:
     std::vector<double>
     getRawPower_dB() const {
         assertFinished();
-        return m_rawPower;
+        return m_frameData->rawPower;
     }
     
     std::vector<double>
     getSmoothedPower_dB() const {
         assertFinished();
-        return m_smoothedPower;
+        return m_frameData->smoothedPower;
     }
 
     std::vector<double>
     getOnsetLevelRiseFractions() const {
         assertFinished();
-        return m_onsetLevelRise.getFractions();
+        return m_frameData->riseFractions;
     }
 
     int
     getOnsetBinCount() const {
         assertFinished();
-        return m_onsetLevelRise.getBinCount();
+        return m_frameData->binCount;
     }
     
     std::vector<int>
     getOnsetBinsAboveNoiseFloorAt(int step) const {
         assertFinished();
-        return m_onsetLevelRise.getBinsAboveNoiseFloorAt(step);
+        return m_frameData->binsAboveNoiseFloor.getBinsAt(step);
     }
     
     std::vector<int>
     getOnsetBinsAboveOffsetAt(int step) const {
         assertFinished();
-        return m_onsetLevelRise.getBinsAboveOffsetAt(step);
+        return m_frameData->binsAboveOffset.getBinsAt(step);
+    }
+
+    int
+    countOnsetBinsAboveNoiseFloorAt(int step) const {
+        assertFinished();
+        return m_frameData->binsAboveNoiseFloor.countAt(step);
+    }
+
+    int
+    countOnsetBinsAboveOffsetAt(int step) const {
+        assertFinished();
+        return m_frameData->binsAboveOffset.countAt(step);
     }
 
     std::vector<double>
@@ -197,36 +397,32 @@ public:
         return m_offsetDropDf;
     }
     
-    std::set<int>
+    std::vector<int>
     getPitchOnsets() const {
         assertFinished();
         return m_pitchOnsets;
     }
 
-    std::set<int>
+    std::vector<int>
     getLevelRiseOnsets() const {
         assertFinished();
         return m_levelRiseOnsets;
     }
 
-    std::set<int>
+    std::vector<int>
     getPowerRiseOnsets() const {
         assertFinished();
         return m_powerRiseOnsets;
     }
 
-    std::map<int, OnsetType>
-    getMergedOnsets() const {
+    /** Return the notes found, each with the type of its onset and
+     *  offset. These are the onsets remaining after merging those
+     *  from the pitch, spectral rise, and power rise detectors.
+     */
+    NoteTable
+    getNotes() const {
         assertFinished();
-        return m_mergedOnsets;
-    }
-
-    typedef std::map<int, std::pair<int, OffsetType>> OnsetOffsetMap;
-
-    OnsetOffsetMap
-    getOnsetOffsets() const {
-        assertFinished();
-        return m_onsetOffsets;
+        return m_notes;
     }
 
     Vamp::RealTime getStartTime() const {
@@ -234,7 +430,8 @@ public:
     }
     
     Vamp::RealTime timeForStep(int step) const {
-        // See notes about timing alignment in finish() in the .cpp file
+        // See notes about timing alignment in extractFrameData() in
+        // the .cpp file
         int halfBlock = (m_parameters.blockSize / m_parameters.stepSize) / 2;
         return m_startTime + Vamp::RealTime::frame2RealTime
             ((step + halfBlock) * m_parameters.stepSize, m_sampleRate);
@@ -260,6 +457,18 @@ public:
         return f;
     }
 
+    /** Return the steps, among the first n, at which the raw power
+     *  detection function places power-rise onsets: wherever the
+     *  power rises by more than threshold_dB within windowSteps steps
+     *  without first dipping below its starting level, an onset is
+     *  placed at the next point where the power derivative begins to
+     *  fall. The steps are returned in order. Runs in time linear in
+     *  the length of rawPower.
+     */
+    static std::vector<int> findPowerRiseOnsets(const std::vector<double> &rawPower,
+                                                int n, int windowSteps,
+                                                double threshold_dB);
+
     CoreFeatures(const CoreFeatures &) =delete;
     CoreFeatures &operator=(const CoreFeatures &) =delete;
     
@@ -279,24 +488,87 @@ private:
 
     int m_pyinSmoothedPitchTrackOutput;
     std::vector<double> m_pyinPitchHz;
+    std::vector<double> m_pyinDecodedPitchHz; // when m_pyinDecoded
+    bool m_pyinDecoded; // pitch came from decodePitchInParallel, not m_pyin
+    std::shared_ptr<const FrameData> m_frameData;
     std::vector<double> m_pitch;
     std::vector<double> m_filteredPitch;
     std::vector<double> m_pitchOnsetDf;
     std::vector<bool> m_pitchOnsetDfValidity;
-    std::vector<double> m_rawPower;
-    std::vector<double> m_smoothedPower;
     std::vector<double> m_offsetDropDf;
-    std::set<int> m_pitchOnsets;
-    std::set<int> m_levelRiseOnsets;
-    std::set<int> m_powerRiseOnsets;
-    std::map<int, OnsetType> m_mergedOnsets;
-    OnsetOffsetMap m_onsetOffsets;
-
-    // For normalisation
-    std::vector<std::pair<std::vector<float>, Vamp::RealTime>> m_pending;
+    std::vector<int> m_pitchOnsets;
+    std::vector<int> m_levelRiseOnsets;
+    std::vector<int> m_powerRiseOnsets;
+    NoteTable m_notes;
+
+    // For normalisation and splitting at silences. Successive input
+    // blocks overlap by blockSize - stepSize samples, so we store each
+    // input sample only once, in m_pending, and reconstruct the
+    // blocks from it in finish()
+    std::vector<float> m_pending;
+    std::vector<Vamp::RealTime> m_pendingTimestamps;
+    std::vector<float> m_scaled;
     float m_normalisationGain;
+    int m_segmentCount;
+    bool haveKnownPeak() const {
+        return m_parameters.normalise && m_parameters.knownPeak > 0.f;
+    }
+    // True if we hold on to the input until finish(), either because
+    // we need its peak for normalisation or because we need all of it
+    // to split at silences
+    bool isRetainingInput() const {
+        return m_parameters.splitAtSilence ||
+            (m_parameters.normalise && !haveKnownPeak());
+    }
+    void resetNormalisationGain() {
+        m_normalisationGain =
+            haveKnownPeak() ? 1.f / m_parameters.knownPeak : 1.f;
+    }
+    // Running hash of all input samples received so far, used
+    // together with the sample rate and parameters as the key for
+    // the shared frame data cache
+    uint64_t m_inputHash;
+    uint64_t m_inputLength;
+    void resetInputHash();
+    void hashInput(const float *input, int count);
+
+    std::shared_ptr<const FrameData> findCachedFrameData() const;
+    void cacheFrameData() const;
+    
+    // When threadedExtraction is set, actualProcess() passes blocks
+    // to pYIN, Power and SpectralLevelRise through this, so that
+    // each runs on its own thread. Declared last so as to be
+    // destroyed (and its threads stopped) before the extractors
+    std::unique_ptr<BlockPipeline> m_pipeline;
+    void startPipeline();
+    void finishPipeline();
+
+    // When queueInput is set, process() only pushes each block into
+    // this, and everything else that process() would do happens on
+    // its background thread. Declared after m_pipeline so as to be
+    // destroyed first, as its thread may be pushing into that
+    std::unique_ptr<BlockQueue> m_queue;
+    void startQueue();
+    void finishQueue();
+    
+    void receiveInput(const float *input, Vamp::RealTime timestamp);
+    
     void actualProcess(const float *input, Vamp::RealTime timestamp);
+    void processPitch(const float *input, Vamp::RealTime timestamp);
+    int getExtractionThreadCount() const;
+    void normalisePending();
+    void processPending();
+    std::vector<double> decodePitchInParallel(const float *pending,
+                                              int blocks, int threads) const;
+    std::shared_ptr<const FrameData> extractFrameData();
+    std::shared_ptr<const FrameData> extractFrameDataInSegments();
+    int getPYinStepsToDrop() const;
+    void clearDecisions();
     void actualFinish();
+    std::pair<int, OffsetType> findOffset(const FrameData &frames,
+                                          int sustainBegin, int limit,
+                                          int nBinsAtBegin,
+                                          double powerDropTarget);
 
     void assertFinished() const {
         if (!m_finished) {
@@ -0,0 +1,286 @@
+
+/*
+    Expressive Means
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "FrameDataFile.h"
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+using std::string;
+using std::vector;
+using std::runtime_error;
+
+static const char frameDataMagic[8] = { 'E', 'M', 'F', 'R', 'A', 'M', 'E', 'S' };
+static const uint32_t byteOrderMark = 0x01020304;
+
+namespace {
+
+class Writer
+{
+public:
+    Writer(string filename) : m_filename(filename), m_written(0) {
+        m_file = fopen(filename.c_str(), "wb");
+        if (!m_file) {
+            throw runtime_error("FrameDataFile::write: Failed to open file \"" + filename + "\" for writing");
+        }
+    }
+
+    ~Writer() {
+        if (m_file) {
+            fclose(m_file);
+        }
+    }
+
+    void bytes(const void *data, size_t n) {
+        if (n > 0 && fwrite(data, 1, n, m_file) != n) {
+            throw runtime_error("FrameDataFile::write: Failed to write to file \"" + m_filename + "\"");
+        }
+        m_written += n;
+    }
+
+    size_t position() const {
+        return m_written;
+    }
+
+    template <typename T>
+    void value(T t) {
+        bytes(&t, sizeof(T));
+    }
+
+    template <typename T>
+    void array(const vector<T> &v) {
+        bytes(v.data(), v.size() * sizeof(T));
+        static const char zeros[8] = { 0 };
+        bytes(zeros, (8 - m_written % 8) % 8);
+    }
+
+    void close() {
+        FILE *f = m_file;
+        m_file = nullptr;
+        if (fclose(f) != 0) {
+            throw runtime_error("FrameDataFile::write: Failed to close file \"" + m_filename + "\"");
+        }
+    }
+
+private:
+    string m_filename;
+    FILE *m_file;
+    size_t m_written;
+};
+
+class Reader
+{
+public:
+    Reader(string filename) : m_filename(filename), m_read(0), m_size(0) {
+        m_file = fopen(filename.c_str(), "rb");
+        if (!m_file) {
+            throw runtime_error("FrameDataFile::read: Failed to open file \"" + filename + "\" for reading");
+        }
+        // Array lengths in the file are checked against the size of
+        // the file before anything is allocated for them
+        long size = -1;
+        if (fseek(m_file, 0, SEEK_END) == 0) {
+            size = ftell(m_file);
+        }
+        if (size < 0 || fseek(m_file, 0, SEEK_SET) != 0) {
+            fclose(m_file);
+            throw runtime_error("FrameDataFile::read: Failed to find size of file \"" + filename + "\"");
+        }
+        m_size = uint64_t(size);
+    }
+
+    ~Reader() {
+        fclose(m_file);
+    }
+
+    void bytes(void *data, size_t n) {
+        if (n > 0 && fread(data, 1, n, m_file) != n) {
+            throw runtime_error("FrameDataFile::read: File \"" + m_filename + "\" is truncated or unreadable");
+        }
+        m_read += n;
+    }
+
+    size_t position() const {
+        return m_read;
+    }
+
+    template <typename T>
+    T value() {
+        T t;
+        bytes(&t, sizeof(T));
+        return t;
+    }
+
+    /** Read an array of count * multiplier values of type T, which
+     *  must fit within what is left of the file.
+     */
+    template <typename T>
+    vector<T> array(uint64_t count, uint64_t multiplier = 1) {
+        uint64_t remaining = m_size - std::min<uint64_t>(m_size, m_read);
+        if (multiplier == 0 ||
+            count > remaining / sizeof(T) / multiplier) {
+            throw runtime_error("FrameDataFile::read: File \"" + m_filename + "\" is truncated or has an invalid array length");
+        }
+        count *= multiplier;
+        vector<T> v(count);
+        bytes(v.data(), count * sizeof(T));
+        char padding[8];
+        bytes(padding, (8 - m_read % 8) % 8);
+        return v;
+    }
+
+private:
+    string m_filename;
+    FILE *m_file;
+    size_t m_read;
+    uint64_t m_size;
+};
+
+}
+
+void
+FrameDataFile::write(string filename,
+                     const Header &header,
+                     const CoreFeatures::FrameData &data)
+{
+    const auto &p = header.parameters;
+
+    Writer w(filename);
+
+    w.bytes(frameDataMagic, sizeof(frameDataMagic));
+    w.value<uint32_t>(formatVersion);
+    w.value<uint32_t>(byteOrderMark);
+    w.value<double>(header.sampleRate);
+    w.value<int32_t>(header.startTime.sec);
+    w.value<int32_t>(header.startTime.nsec);
+    w.value<int32_t>(p.stepSize);
+    w.value<int32_t>(p.blockSize);
+    w.value<int32_t>(p.normalise ? 1 : 0);
+    w.value<int32_t>(p.pyinFixedLag ? 1 : 0);
+    w.value<int32_t>(p.pyinPreciseTiming ? 1 : 0);
+    w.value<int32_t>(p.splitAtSilence ? 1 : 0);
+    w.value<float>(p.knownPeak);
+    w.value<float>(p.pyinThresholdDistribution);
+    w.value<float>(p.pyinLowAmpSuppressionThreshold);
+    w.value<float>(p.onsetSensitivityLevel_dB);
+    w.value<float>(p.onsetSensitivityNoiseTimeWindow_ms);
+    w.value<float>(p.spectralNoiseFloor_dB);
+    w.value<float>(p.spectralDropOffset_dB);
+    w.value<float>(p.spectralFrequencyMin_Hz);
+    w.value<float>(p.spectralFrequencyMax_Hz);
+    w.value<float>(data.normalisationGain);
+    w.value<int32_t>(data.binCount);
+    w.value<int32_t>(data.binsAboveNoiseFloor.getFirstBin());
+
+    if (data.smoothedPower.size() != data.rawPower.size()) {
+        throw std::logic_error("FrameDataFile::write: Raw and smoothed power differ in length");
+    }
+    if (data.binsAboveNoiseFloor.getBinCount() != data.binCount ||
+        data.binsAboveOffset.getBinCount() != data.binCount ||
+        data.binsAboveOffset.getFirstBin() !=
+        data.binsAboveNoiseFloor.getFirstBin()) {
+        throw std::logic_error("FrameDataFile::write: Inconsistent bin ranges");
+    }
+
+    if (w.position() != arrayCountsOffset) {
+        throw std::logic_error("FrameDataFile::write: Header size does not match arrayCountsOffset");
+    }
+
+    w.value<uint64_t>(data.pyinPitchHz.size());
+    w.value<uint64_t>(data.rawPower.size());
+    w.value<uint64_t>(data.riseFractions.size());
+    w.value<uint64_t>(data.binsAboveNoiseFloor.getStepCount());
+    w.value<uint64_t>(data.binsAboveOffset.getStepCount());
+
+    w.array(data.pyinPitchHz);
+    w.array(data.rawPower);
+    w.array(data.smoothedPower);
+    w.array(data.riseFractions);
+    w.array(data.binsAboveNoiseFloor.getWords());
+    w.array(data.binsAboveOffset.getWords());
+
+    w.close();
+}
+
+std::shared_ptr<const CoreFeatures::FrameData>
+FrameDataFile::read(string filename, Header &header)
+{
+    Reader r(filename);
+
+    char magic[sizeof(frameDataMagic)];
+    r.bytes(magic, sizeof(magic));
+    if (memcmp(magic, frameDataMagic, sizeof(magic))) {
+        throw runtime_error("FrameDataFile::read: File \"" + filename + "\" is not a frame data file");
+    }
+    uint32_t version = r.value<uint32_t>();
+    if (version != formatVersion) {
+        throw runtime_error("FrameDataFile::read: File \"" + filename + "\" has unsupported format version " + std::to_string(version));
+    }
+    if (r.value<uint32_t>() != byteOrderMark) {
+        throw runtime_error("FrameDataFile::read: File \"" + filename + "\" was written on a machine with a different byte order");
+    }
+
+    header = Header();
+    auto &p = header.parameters;
+
+    header.sampleRate = r.value<double>();
+    header.startTime.sec = r.value<int32_t>();
+    header.startTime.nsec = r.value<int32_t>();
+    p.stepSize = r.value<int32_t>();
+    p.blockSize = r.value<int32_t>();
+    p.normalise = (r.value<int32_t>() != 0);
+    p.pyinFixedLag = (r.value<int32_t>() != 0);
+    p.pyinPreciseTiming = (r.value<int32_t>() != 0);
+    p.splitAtSilence = (r.value<int32_t>() != 0);
+    p.knownPeak = r.value<float>();
+    p.pyinThresholdDistribution = r.value<float>();
+    p.pyinLowAmpSuppressionThreshold = r.value<float>();
+    p.onsetSensitivityLevel_dB = r.value<float>();
+    p.onsetSensitivityNoiseTimeWindow_ms = r.value<float>();
+    p.spectralNoiseFloor_dB = r.value<float>();
+    p.spectralDropOffset_dB = r.value<float>();
+    p.spectralFrequencyMin_Hz = r.value<float>();
+    p.spectralFrequencyMax_Hz = r.value<float>();
+
+    auto data = std::make_shared<CoreFeatures::FrameData>();
+    data->normalisationGain = r.value<float>();
+    data->binCount = r.value<int32_t>();
+    int firstBin = r.value<int32_t>();
+    if (data->binCount < 1) {
+        throw runtime_error("FrameDataFile::read: File \"" + filename + "\" has invalid bin count");
+    }
+    uint64_t wordsPerStep = BinSets(firstBin, data->binCount).getWordsPerStep();
+
+    if (r.position() != arrayCountsOffset) {
+        throw std::logic_error("FrameDataFile::read: Header size does not match arrayCountsOffset");
+    }
+
+    uint64_t pitchCount = r.value<uint64_t>();
+    uint64_t powerCount = r.value<uint64_t>();
+    uint64_t fractionCount = r.value<uint64_t>();
+    uint64_t noiseFloorSteps = r.value<uint64_t>();
+    uint64_t offsetSteps = r.value<uint64_t>();
+
+    data->pyinPitchHz = r.array<double>(pitchCount);
+    data->rawPower = r.array<double>(powerCount);
+    data->smoothedPower = r.array<double>(powerCount);
+    data->riseFractions = r.array<double>(fractionCount);
+    data->binsAboveNoiseFloor = BinSets
+        (firstBin, data->binCount,
+         r.array<uint64_t>(noiseFloorSteps, wordsPerStep));
+    data->binsAboveOffset = BinSets
+        (firstBin, data->binCount,
+         r.array<uint64_t>(offsetSteps, wordsPerStep));
+
+    return data;
+}
@@ -0,0 +1,94 @@
+
+/*
+    Expressive Means
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef EXPRESSIVE_MEANS_FRAME_DATA_FILE_H
+#define EXPRESSIVE_MEANS_FRAME_DATA_FILE_H
+
+#include "CoreFeatures.h"
+
+#include <string>
+#include <memory>
+#include <cstddef>
+
+/** Read and write CoreFeatures::FrameData in a versioned binary file
+ *  format, so that the expensive feature extraction for a recording
+ *  need only be done once.
+ *
+ *  The file consists of a fixed-layout header followed by a sequence
+ *  of arrays. All values are in the byte order of the machine that
+ *  wrote the file (recorded in the header, and checked on reading)
+ *  and every array begins on an 8-byte boundary, so the arrays can
+ *  be used in place if the file is memory-mapped. The header is:
+ *
+ *    char[8]  magic "EMFRAMES"
+ *    uint32   format version
+ *    uint32   byte order mark 0x01020304
+ *    float64  sample rate
+ *    int32    start time seconds, nanoseconds
+ *    int32    step size, block size
+ *    int32    normalise, pYIN fixed lag, pYIN precise timing, split
+ *             at silence (0 or 1)
+ *    float32  known peak, pYIN threshold distribution, pYIN low
+ *             amplitude suppression, onset sensitivity level, onset
+ *             sensitivity noise time window, spectral noise floor,
+ *             spectral drop offset, spectral frequency min and max
+ *    float32  normalisation gain
+ *    int32    spectral bin count, first spectral bin number
+ *    uint64   counts of pitch, power, rise fraction, bins-above-
+ *             noise-floor and bins-above-offset steps
+ *
+ *  followed by the pitch, raw power, smoothed power and rise fraction
+ *  arrays (float64), then the bins above noise floor and above offset
+ *  as the packed bitset words of a BinSets (uint64, step count times
+ *  words per step). The arrays are padded with zeros to 8-byte
+ *  length.
+ *
+ *  Only those parameters that affect the frame data are stored.
+ */
+class FrameDataFile
+{
+public:
+    static const uint32_t formatVersion = 3;
+
+    /** The offset in bytes of the array counts within the file, that
+     *  is the total size of the header fields that precede them.
+     */
+    static const size_t arrayCountsOffset =
+        8 + 4 + 4 +       // magic, version, byte order mark
+        8 + 2 * 4 +       // sample rate, start time
+        2 * 4 + 4 * 4 +   // step and block size, flags
+        9 * 4 + 4 +       // float parameters, normalisation gain
+        2 * 4;            // bin count, first bin
+
+    struct Header {
+        double sampleRate;
+        Vamp::RealTime startTime;
+        CoreFeatures::Parameters parameters;
+        Header() : sampleRate(0.0) { }
+    };
+
+    /** Write the given frame data to the given file. Throws
+     *  std::runtime_error if the file cannot be written.
+     */
+    static void write(std::string filename,
+                      const Header &header,
+                      const CoreFeatures::FrameData &data);
+
+    /** Read frame data from the given file, filling in the header.
+     *  Parameters not stored in the file are left at their
+     *  defaults. Throws std::runtime_error if the file cannot be
+     *  read or is not in a supported format.
+     */
+    static std::shared_ptr<const CoreFeatures::FrameData>
+    read(std::string filename, Header &header);
+};
+
+#endif
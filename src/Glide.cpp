@@ -10,9 +10,9 @@
 */
 
 #include "Glide.h"
+#include "SlidingMedian.h"
 
 #include "../ext/pyin/MeanFilter.h"
-#include "../ext/qm-dsp/maths/MedianFilter.h"
 
 #include <iostream>
 
@@ -25,7 +25,7 @@ using std::map;
 
 Glide::Extents
 Glide::extract_Hz(const vector<double> &pitch_Hz,
-                  const CoreFeatures::OnsetOffsetMap &onsetOffsets)
+                  const CoreFeatures::NoteTable &onsetOffsets)
 {
     int n = int(pitch_Hz.size());
     vector<double> pitch_semis;
@@ -44,7 +44,7 @@ Glide::extract_Hz(const vector<double> &pitch_Hz,
 
 Glide::Extents
 Glide::extract_semis(const vector<double> &rawPitch,
-                     const CoreFeatures::OnsetOffsetMap &onsetOffsets)
+                     const CoreFeatures::NoteTable &onsetOffsets)
 {
     int n = int(rawPitch.size());
     
@@ -55,7 +55,7 @@ Glide::extract_semis(const vector<double> &rawPitch,
             medianFilterInput[i] = medianFilterInput[i-1];
         }
     }
-    vector<double> medianFilteredPitch = MedianFilter<double>::filter
+    vector<double> medianFilteredPitch = SlidingMedian<double>::filter
         (m_parameters.medianFilterLength_steps, medianFilterInput);
 
     vector<double> pitch(n, 0.0);
@@ -323,7 +323,7 @@ Glide::extract_semis(const vector<double> &rawPitch,
         bool found = false;
         
         while (scout != onsetOffsets.end()) {
-            int onset = scout->first;
+            int onset = scout->onset;
             if (onset >= start && onset <= end) {
 #ifdef DEBUG_GLIDE
                 cerr << "for glide from " << start << " to " << end
@@ -345,7 +345,7 @@ Glide::extract_semis(const vector<double> &rawPitch,
             int bestOnset = -1;
             scout = onsetItr;
             while (scout != onsetOffsets.end()) {
-                int onset = scout->first;
+                int onset = scout->onset;
                 if (onset > rangeEnd) {
                     break;
                 }
@@ -53,21 +53,21 @@ public:
      * Identify and return glide extents from the given pitch track
      * and onset/offsets. pitch_Hz is as returned by
      * CoreFeatures::getPYinPitch_Hz() (with unvoiced steps indicated
-     * using zero or negative values) and the onset/offset map is as
-     * returned by CoreFeatures::getOnsetOffsets().
+     * using zero or negative values) and the note table is as
+     * returned by CoreFeatures::getNotes().
      */     
     Extents extract_Hz(const std::vector<double> &pitch_Hz,
-                       const CoreFeatures::OnsetOffsetMap &onsetOffsets);
+                       const CoreFeatures::NoteTable &onsetOffsets);
 
     /**
      * Identify and return glide extents from the given pitch track
      * and onset/offsets. pitch_semis is as returned by
      * CoreFeatures::getPYinPitch_Hz() (with unvoiced steps indicated
-     * using zero or negative values) and the onset/offset map is as
-     * returned by CoreFeatures::getOnsetOffsets().
+     * using zero or negative values) and the note table is as
+     * returned by CoreFeatures::getNotes().
      */     
     Extents extract_semis(const std::vector<double> &pitch_semis,
-                          const CoreFeatures::OnsetOffsetMap &onsetOffsets);
+                          const CoreFeatures::NoteTable &onsetOffsets);
 
 private:
     Parameters m_parameters;
@@ -0,0 +1,146 @@
+
+/*
+    Expressive Means
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef EXPRESSIVE_MEANS_MULTI_CHANNEL_FEATURES_H
+#define EXPRESSIVE_MEANS_MULTI_CHANNEL_FEATURES_H
+
+#include "CoreFeatures.h"
+#include "BlockPipeline.h"
+#include "ParallelFor.h"
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+
+/** An independent CoreFeatures for each of a number of input
+ *  channels. With more than one channel, each channel's feature
+ *  extraction runs on a thread of its own while input is being
+ *  processed, and the channels are finished concurrently as well.
+ *  With a single channel this is just a thin wrapper around one
+ *  CoreFeatures, and no threads are used.
+ */
+class MultiChannelFeatures
+{
+public:
+    MultiChannelFeatures(float inputSampleRate) :
+        m_sampleRate(inputSampleRate),
+        m_blockSize(0) {
+        m_channels.push_back
+            (std::unique_ptr<CoreFeatures>(new CoreFeatures(m_sampleRate)));
+    }
+
+    MultiChannelFeatures(const MultiChannelFeatures &) =delete;
+    MultiChannelFeatures &operator=(const MultiChannelFeatures &) =delete;
+
+    void initialise(int channels, CoreFeatures::Parameters parameters) {
+        if (channels < 1) {
+            throw std::logic_error("MultiChannelFeatures::initialise: At least one channel is required");
+        }
+        m_pipeline.reset();
+        m_channels.resize(1);
+        while (int(m_channels.size()) < channels) {
+            m_channels.push_back
+                (std::unique_ptr<CoreFeatures>(new CoreFeatures(m_sampleRate)));
+        }
+        for (auto &c: m_channels) {
+            c->initialise(parameters);
+        }
+        m_blockSize = parameters.blockSize;
+        m_block.resize(size_t(m_blockSize) * channels);
+        startPipeline();
+    }
+
+    void reset() {
+        m_pipeline.reset();
+        for (auto &c: m_channels) {
+            c->reset();
+        }
+        startPipeline();
+    }
+
+    size_t getPreferredBlockSize() const {
+        return m_channels[0]->getPreferredBlockSize();
+    }
+
+    size_t getPreferredStepSize() const {
+        return m_channels[0]->getPreferredStepSize();
+    }
+
+    /** Process one block for each channel, in the same form as a
+     *  Vamp plugin receives them.
+     */
+    void process(const float *const *inputBuffers, Vamp::RealTime timestamp) {
+        if (!m_pipeline) {
+            m_channels[0]->process(inputBuffers[0], timestamp);
+            return;
+        }
+        for (int c = 0; c < getChannelCount(); ++c) {
+            std::copy(inputBuffers[c], inputBuffers[c] + m_blockSize,
+                      m_block.data() + size_t(c) * m_blockSize);
+        }
+        m_pipeline->push(m_block.data(), timestamp);
+    }
+
+    void finish() {
+        if (m_pipeline) {
+            m_pipeline->finish();
+        }
+        int n = getChannelCount();
+        parallelFor(n, n, [this](int from, int to) {
+            for (int c = from; c < to; ++c) {
+                m_channels[c]->finish();
+            }
+        });
+    }
+
+    int getChannelCount() const {
+        return int(m_channels.size());
+    }
+
+    const CoreFeatures &getChannel(int c) const {
+        return *m_channels.at(c);
+    }
+
+    std::vector<const CoreFeatures *> getChannels() const {
+        std::vector<const CoreFeatures *> channels;
+        for (const auto &c: m_channels) {
+            channels.push_back(c.get());
+        }
+        return channels;
+    }
+
+private:
+    float m_sampleRate;
+    int m_blockSize;
+    std::vector<std::unique_ptr<CoreFeatures>> m_channels;
+    std::vector<float> m_block;
+    std::unique_ptr<BlockPipeline> m_pipeline;
+
+    void startPipeline() {
+        int n = getChannelCount();
+        if (n < 2) {
+            return;
+        }
+        std::vector<BlockPipeline::Consumer> consumers;
+        for (int c = 0; c < n; ++c) {
+            CoreFeatures *channel = m_channels[c].get();
+            size_t offset = size_t(c) * m_blockSize;
+            consumers.push_back([channel, offset](const float *block,
+                                                  Vamp::RealTime timestamp) {
+                channel->process(block + offset, timestamp);
+            });
+        }
+        m_pipeline.reset(new BlockPipeline(m_blockSize * n, 64, consumers));
+    }
+};
+
+#endif
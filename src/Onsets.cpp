@@ -15,6 +15,7 @@
 
 #include <vector>
 #include <set>
+#include <algorithm>
 
 using std::cerr;
 using std::endl;
@@ -25,12 +26,16 @@ Onsets::Onsets(float inputSampleRate) :
     Plugin(inputSampleRate),
     m_stepSize(0),
     m_blockSize(0),
-    m_coreFeatures(inputSampleRate),
+    m_channels(1),
+    m_separateChannels(false),
+    m_channelFeatures(inputSampleRate),
     m_onsetOutput(-1),
     m_offsetOutput(-1),
     m_durationOutput(-1),
     m_pitchOnsetDfOutput(-1),
-    m_transientOnsetDfOutput(-1)
+    m_transientOnsetDfOutput(-1),
+    m_channelOnsetOutput(-1),
+    m_mergedOnsetOutput(-1)
 {
 }
 
@@ -83,13 +88,13 @@ Onsets::getInputDomain() const
 size_t
 Onsets::getPreferredBlockSize() const
 {
-    return m_coreFeatures.getPreferredBlockSize();
+    return m_channelFeatures.getPreferredBlockSize();
 }
 
 size_t 
 Onsets::getPreferredStepSize() const
 {
-    return m_coreFeatures.getPreferredStepSize();
+    return m_channelFeatures.getPreferredStepSize();
 }
 
 size_t
@@ -101,7 +106,9 @@ Onsets::getMinChannelCount() const
 size_t
 Onsets::getMaxChannelCount() const
 {
-    return 1;
+    // Multi-channel input is mixed down unless "separateChannels" is
+    // set, so that there is no need for the host to do it
+    return 32;
 }
 
 Onsets::ParameterList
@@ -109,6 +116,19 @@ Onsets::getParameterDescriptors() const
 {
     ParameterList list;
     m_coreParams.appendVampParameterDescriptors(list, true);
+
+    ParameterDescriptor d;
+    d.identifier = "separateChannels";
+    d.name = "Analyse channels separately";
+    d.unit = "";
+    d.description = "With multi-channel input, analyse each channel independently and in parallel, instead of mixing the channels down to mono first. The per-channel and merged onset outputs then report onsets from every channel; the other outputs describe the first channel only.";
+    d.minValue = 0.f;
+    d.maxValue = 1.f;
+    d.isQuantized = true;
+    d.quantizeStep = 1.f;
+    d.defaultValue = 0.f;
+    list.push_back(d);
+    
     return list;
 }
 
@@ -119,13 +139,21 @@ Onsets::getParameter(string identifier) const
     if (m_coreParams.obtainVampParameter(identifier, value)) {
         return value;
     }
+    if (identifier == "separateChannels") {
+        return m_separateChannels ? 1.f : 0.f;
+    }
     return 0.f;
 }
 
 void
 Onsets::setParameter(string identifier, float value) 
 {
-    (void)m_coreParams.acceptVampParameter(identifier, value);
+    if (m_coreParams.acceptVampParameter(identifier, value)) {
+        return;
+    }
+    if (identifier == "separateChannels") {
+        m_separateChannels = (value > 0.5f);
+    }
 }
 
 Onsets::ProgramList
@@ -233,12 +261,53 @@ Onsets::getOutputDescriptors() const
     d.hasDuration = false;
     m_spectralDropDfOutput = int(list.size());
     list.push_back(d);
+
+    d.identifier = "channelonsets";
+    d.name = "Per-Channel Onsets";
+    d.description = "Identified onset locations in each input channel, labelled as for the Onsets output. Each feature has the number of its channel (counting from 1) as its value. Input channels are only analysed separately if \"Analyse channels separately\" is set; otherwise these are the onsets of the mixed-down input, as channel 1.";
+    d.unit = "";
+    d.hasFixedBinCount = true;
+    d.binCount = 1;
+    d.hasKnownExtents = false;
+    d.hasDuration = false;
+    m_channelOnsetOutput = int(list.size());
+    list.push_back(d);
+
+    d.identifier = "mergedonsets";
+    d.name = "Merged Onsets";
+    d.description = "Onset locations from all input channels merged into a single list. An onset in any channel is included unless it follows an onset already included by less than the minimum onset interval. The label is taken from the earliest channel onset in the group, and the value is the number of channels having an onset in the group.";
+    d.unit = "";
+    d.hasFixedBinCount = true;
+    d.binCount = 1;
+    d.hasKnownExtents = false;
+    d.hasDuration = false;
+    m_mergedOnsetOutput = int(list.size());
+    list.push_back(d);
     
     return list;
 }
 
 bool
 Onsets::initialise(size_t channels, size_t stepSize, size_t blockSize)
+{
+    if (!initialiseForFeaturesFrom(channels, stepSize, blockSize)) {
+        return false;
+    }
+
+    try {
+        m_channelFeatures.initialise(m_separateChannels ? m_channels : 1,
+                                     m_coreParams);
+    } catch (const std::logic_error &e) {
+        cerr << "ERROR: Onsets::initialise: Feature extractor initialisation failed: " << e.what() << endl;
+        return false;
+    }
+    
+    return true;
+}
+
+bool
+Onsets::initialiseForFeaturesFrom(size_t channels, size_t stepSize,
+                                   size_t blockSize)
 {
     if (channels < getMinChannelCount() || channels > getMaxChannelCount()) {
         cerr << "ERROR: Onsets::initialise: unsupported channel count "
@@ -272,15 +341,11 @@ Onsets::initialise(size_t channels, size_t stepSize, size_t blockSize)
     
     m_stepSize = stepSize;
     m_blockSize = blockSize;
+    m_channels = channels;
+    m_mixBuffer.resize(m_blockSize);
 
-    try {
-        m_coreParams.stepSize = m_stepSize;
-        m_coreParams.blockSize = m_blockSize;
-        m_coreFeatures.initialise(m_coreParams);
-    } catch (const std::logic_error &e) {
-        cerr << "ERROR: Onsets::initialise: Feature extractor initialisation failed: " << e.what() << endl;
-        return false;
-    }
+    m_coreParams.stepSize = m_stepSize;
+    m_coreParams.blockSize = m_blockSize;
     
     return true;
 }
@@ -288,74 +353,113 @@ Onsets::initialise(size_t channels, size_t stepSize, size_t blockSize)
 void
 Onsets::reset()
 {
-    m_coreFeatures.reset();
+    m_channelFeatures.reset();
 }
 
 Onsets::FeatureSet
 Onsets::process(const float *const *inputBuffers, Vamp::RealTime timestamp)
 {
-    m_coreFeatures.process(inputBuffers[0], timestamp);
+    if (m_channels == 1 || m_separateChannels) {
+        m_channelFeatures.process(inputBuffers, timestamp);
+        return {};
+    }
+
+    // Mix down the same way as the Vamp SDK's PluginChannelAdapter,
+    // so as to match the results we had when the host did this
+    for (int i = 0; i < m_blockSize; ++i) {
+        m_mixBuffer[i] = inputBuffers[0][i];
+    }
+    for (int c = 1; c < m_channels; ++c) {
+        for (int i = 0; i < m_blockSize; ++i) {
+            m_mixBuffer[i] += inputBuffers[c][i];
+        }
+    }
+    for (int i = 0; i < m_blockSize; ++i) {
+        m_mixBuffer[i] /= float(m_channels);
+    }
+    const float *mixed = m_mixBuffer.data();
+    m_channelFeatures.process(&mixed, timestamp);
     return {};
 }
 
 Onsets::FeatureSet
 Onsets::getRemainingFeatures()
 {
-    FeatureSet fs;
+    m_channelFeatures.finish();
+    return getFeaturesFrom(m_channelFeatures.getChannels());
+}
+
+Onsets::FeatureSet
+Onsets::getFeaturesFrom(const CoreFeatures &coreFeatures)
+{
+    return getFeaturesFrom(vector<const CoreFeatures *> { &coreFeatures });
+}
+
+static string
+onsetTypeLabel(CoreFeatures::OnsetType onsetType)
+{
+    switch (onsetType) {
+    case CoreFeatures::OnsetType::Pitch:
+        return "Pitch Change";
+    case CoreFeatures::OnsetType::SpectralLevelRise:
+        return "Spectral Rise";
+    case CoreFeatures::OnsetType::PowerRise:
+        return "Power Rise";
+    }
+    return "";
+}
 
-    m_coreFeatures.finish();
+Onsets::FeatureSet
+Onsets::getFeaturesFrom(const vector<const CoreFeatures *> &channels)
+{
+    if (channels.empty()) {
+        throw std::logic_error("Onsets::getFeaturesFrom: No channels given");
+    }
+    
+    const CoreFeatures &coreFeatures = *channels[0];
+    
+    FeatureSet fs;
 
-    auto pitchOnsetDf = m_coreFeatures.getPitchOnsetDF();
-    auto pitchOnsetDfValidity = m_coreFeatures.getPitchOnsetDFValidity();
+    auto pitchOnsetDf = coreFeatures.getPitchOnsetDF();
+    auto pitchOnsetDfValidity = coreFeatures.getPitchOnsetDFValidity();
     for (int i = 0; i < int(pitchOnsetDf.size()); ++i) {
         if (pitchOnsetDfValidity[i]) {
             Feature f;
             f.hasTimestamp = true;
-            f.timestamp = m_coreFeatures.timeForStep(i);
+            f.timestamp = coreFeatures.timeForStep(i);
             f.values.push_back(pitchOnsetDf[i] * 100.0);
             fs[m_pitchOnsetDfOutput].push_back(f);
         }
     }
     
-    auto riseFractions = m_coreFeatures.getOnsetLevelRiseFractions();
+    auto riseFractions = coreFeatures.getOnsetLevelRiseFractions();
     for (size_t i = 0; i < riseFractions.size(); ++i) {
         Feature f;
         f.hasTimestamp = true;
         int j = i + (m_blockSize / m_stepSize)/2;
-        f.timestamp = m_coreFeatures.timeForStep(j);
+        f.timestamp = coreFeatures.timeForStep(j);
         f.values.push_back(riseFractions[i]);
         fs[m_transientOnsetDfOutput].push_back(f);
     }
 
-    auto onsets = m_coreFeatures.getMergedOnsets();
-    auto onsetOffsets = m_coreFeatures.getOnsetOffsets();
+    auto notes = coreFeatures.getNotes();
 
-    for (auto pq : onsets) {
+    for (const auto &note : notes) {
         
-        int onset = pq.first;
-        auto onsetType = pq.second;
+        int onset = note.onset;
+        auto onsetType = note.onsetType;
         
-        int offset = onsetOffsets.at(onset).first;
+        int offset = note.offset;
 
         Feature f;
         f.hasTimestamp = true;
-        f.timestamp = m_coreFeatures.timeForStep(onset);
+        f.timestamp = coreFeatures.timeForStep(onset);
         f.hasDuration = false;
-        switch (onsetType) {
-        case CoreFeatures::OnsetType::Pitch:
-            f.label = "Pitch Change";
-            break;
-        case CoreFeatures::OnsetType::SpectralLevelRise:
-            f.label = "Spectral Rise";
-            break;
-        case CoreFeatures::OnsetType::PowerRise:
-            f.label = "Power Rise";
-            break;
-        }
+        f.label = onsetTypeLabel(onsetType);
         fs[m_onsetOutput].push_back(f);
 
         f.hasDuration = true;
-        f.duration = m_coreFeatures.timeForStep(offset) - f.timestamp;
+        f.duration = coreFeatures.timeForStep(offset) - f.timestamp;
         f.label = "";
             
         switch (onsetType) {
@@ -373,16 +477,14 @@ Onsets::getRemainingFeatures()
         fs[m_durationOutput].push_back(f);
     }
 
-    for (auto pq : onsets) {
-        
-        int onset = pq.first;
+    for (const auto &note : notes) {
         
-        int offset = onsetOffsets.at(onset).first;
-        auto offsetType = onsetOffsets.at(onset).second;
+        int offset = note.offset;
+        auto offsetType = note.offsetType;
 
         Feature f;
         f.hasTimestamp = true;
-        f.timestamp = m_coreFeatures.timeForStep(offset);
+        f.timestamp = coreFeatures.timeForStep(offset);
         f.hasDuration = false;
         switch (offsetType) {
         case CoreFeatures::OffsetType::PowerDrop:
@@ -398,25 +500,72 @@ Onsets::getRemainingFeatures()
         fs[m_offsetOutput].push_back(f);
     }
 
-    auto rawPower = m_coreFeatures.getRawPower_dB();
+    auto rawPower = coreFeatures.getRawPower_dB();
         
     for (size_t i = 0; i < rawPower.size(); ++i) {
         Feature f;
         f.hasTimestamp = true;
-        f.timestamp = m_coreFeatures.timeForStep(i);
+        f.timestamp = coreFeatures.timeForStep(i);
         f.values.push_back(rawPower[i]);
         fs[m_rawPowerOutput].push_back(f);
     }
 
-    auto spectralDropDf = m_coreFeatures.getOffsetDropDF();
+    auto spectralDropDf = coreFeatures.getOffsetDropDF();
     
     for (size_t i = 0; i < spectralDropDf.size(); ++i) {
         Feature f;
         f.hasTimestamp = true;
-        f.timestamp = m_coreFeatures.timeForStep(i);
+        f.timestamp = coreFeatures.timeForStep(i);
         f.values.push_back(spectralDropDf[i]);
         fs[m_spectralDropDfOutput].push_back(f);
     }
+
+    struct ChannelOnset {
+        int step;
+        int channel;
+        CoreFeatures::OnsetType type;
+        bool operator<(const ChannelOnset &other) const {
+            if (step != other.step) return step < other.step;
+            return channel < other.channel;
+        }
+    };
+
+    vector<ChannelOnset> channelOnsets;
+    for (int c = 0; c < int(channels.size()); ++c) {
+        for (const auto &note : channels[c]->getNotes()) {
+            channelOnsets.push_back({ note.onset, c, note.onsetType });
+        }
+    }
+    std::sort(channelOnsets.begin(), channelOnsets.end());
+
+    for (const auto &co : channelOnsets) {
+        Feature f;
+        f.hasTimestamp = true;
+        f.timestamp = coreFeatures.timeForStep(co.step);
+        f.values.push_back(co.channel + 1);
+        f.label = onsetTypeLabel(co.type);
+        fs[m_channelOnsetOutput].push_back(f);
+    }
+
+    int minimumOnsetSteps = coreFeatures.msToSteps
+        (m_coreParams.minimumOnsetInterval_ms, m_stepSize, false);
+    
+    size_t i = 0;
+    while (i < channelOnsets.size()) {
+        const auto &first = channelOnsets[i];
+        set<int> groupChannels;
+        while (i < channelOnsets.size() &&
+               channelOnsets[i].step < first.step + minimumOnsetSteps) {
+            groupChannels.insert(channelOnsets[i].channel);
+            ++i;
+        }
+        Feature f;
+        f.hasTimestamp = true;
+        f.timestamp = coreFeatures.timeForStep(first.step);
+        f.values.push_back(float(groupChannels.size()));
+        f.label = onsetTypeLabel(first.type);
+        fs[m_mergedOnsetOutput].push_back(f);
+    }
     
     return fs;
 }
@@ -15,6 +15,7 @@
 #include <vamp-sdk/Plugin.h>
 
 #include "CoreFeatures.h"
+#include "MultiChannelFeatures.h"
 
 #define WITH_DEBUG_OUTPUTS 1
 
@@ -50,6 +51,10 @@ public:
     OutputList getOutputDescriptors() const;
 
     bool initialise(size_t channels, size_t stepSize, size_t blockSize);
+
+    /** As initialise(), but for getFeaturesFrom() only: see Combined.h */
+    bool initialiseForFeaturesFrom(size_t channels, size_t stepSize,
+                                   size_t blockSize);
     void reset();
 
     FeatureSet process(const float *const *inputBuffers,
@@ -57,12 +62,30 @@ public:
 
     FeatureSet getRemainingFeatures();
 
+    /** Features from a shared, finished CoreFeatures: see Combined.h */
+    FeatureSet getFeaturesFrom(const CoreFeatures &coreFeatures);
+
+    /** As above, but from one CoreFeatures per input channel, as when
+     *  the channels are analysed separately. The per-channel and
+     *  merged onset outputs are taken from all of the channels, and
+     *  the remaining outputs from the first only.
+     */
+    FeatureSet getFeaturesFrom(const std::vector<const CoreFeatures *> &channels);
+
+    /** Parameters getFeaturesFrom() expects: see Combined.h */
+    CoreFeatures::Parameters getCoreParameters() const {
+        return m_coreParams;
+    }
+
 protected:
     int m_stepSize;
     int m_blockSize;
+    int m_channels;
+    bool m_separateChannels;
     
-    CoreFeatures m_coreFeatures;
+    MultiChannelFeatures m_channelFeatures;
     CoreFeatures::Parameters m_coreParams;
+    std::vector<float> m_mixBuffer;
 
     mutable int m_onsetOutput;
     mutable int m_offsetOutput;
@@ -71,6 +94,8 @@ protected:
     mutable int m_transientOnsetDfOutput;
     mutable int m_rawPowerOutput;
     mutable int m_spectralDropDfOutput;
+    mutable int m_channelOnsetOutput;
+    mutable int m_mergedOnsetOutput;
 };
 
 #endif
@@ -0,0 +1,79 @@
+
+/*
+    Expressive Means
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef EXPRESSIVE_MEANS_PARALLEL_FOR_H
+#define EXPRESSIVE_MEANS_PARALLEL_FOR_H
+
+#include <vector>
+#include <thread>
+#include <exception>
+
+/** Return the number of threads worth using for data-parallel work on
+ *  this machine, always at least 1.
+ */
+inline int
+getParallelThreadCount()
+{
+    int n = int(std::thread::hardware_concurrency());
+    return n > 0 ? n : 1;
+}
+
+/** Divide the range 0 to count-1 into up to the given number of
+ *  contiguous sub-ranges of roughly equal size, and call f(from, to)
+ *  for each, with from inclusive and to exclusive. The first sub-range
+ *  is handled on the calling thread and the rest each on a thread of
+ *  its own. Returns once all calls have returned; if any of them
+ *  threw, the first exception (by sub-range) is then rethrown.
+ */
+template <typename F>
+void
+parallelFor(int count, int threads, F f)
+{
+    if (count <= 0) {
+        return;
+    }
+    if (threads > count) {
+        threads = count;
+    }
+    if (threads <= 1) {
+        f(0, count);
+        return;
+    }
+
+    std::vector<std::exception_ptr> errors(threads);
+    std::vector<std::thread> workers;
+
+    auto call = [&](int i) {
+        int from = int((long long)count * i / threads);
+        int to = int((long long)count * (i + 1) / threads);
+        try {
+            f(from, to);
+        } catch (...) {
+            errors[i] = std::current_exception();
+        }
+    };
+
+    for (int i = 1; i < threads; ++i) {
+        workers.push_back(std::thread(call, i));
+    }
+    call(0);
+    for (auto &w: workers) {
+        w.join();
+    }
+
+    for (auto e: errors) {
+        if (e) {
+            std::rethrow_exception(e);
+        }
+    }
+}
+
+#endif
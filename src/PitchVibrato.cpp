@@ -11,6 +11,7 @@
 
 #include "PitchVibrato.h"
 #include "Glide.h"
+#include "ParallelFor.h"
 
 #include "version.h"
 
@@ -19,6 +20,10 @@
 #include <vector>
 #include <set>
 #include <sstream>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 
 using std::cerr;
 using std::endl;
@@ -77,16 +82,14 @@ PitchVibrato::PitchVibrato(float inputSampleRate) :
     m_glideThresholdDuration_ms(default_glideThresholdDuration_ms),
     m_glideThresholdProximity_ms(default_glideThresholdProximity_ms),
     m_segmentationType(default_segmentationType),
+    m_noteThreadCount(0),
     m_summaryOutput(-1),
     m_pitchTrackOutput(-1),
     m_vibratoTypeOutput(-1),
     m_vibratoIndexOutput(-1),
-    m_vibratoPitchTrackOutput(-1)
-#ifdef WITH_DEBUG_OUTPUTS
-    ,
+    m_vibratoPitchTrackOutput(-1),
     m_rawPeaksOutput(-1),
     m_acceptedPeaksOutput(-1)
-#endif
 {
 }
 
@@ -535,6 +538,24 @@ PitchVibrato::getOutputDescriptors() const
 
 bool
 PitchVibrato::initialise(size_t channels, size_t stepSize, size_t blockSize)
+{
+    if (!initialiseForFeaturesFrom(channels, stepSize, blockSize)) {
+        return false;
+    }
+
+    try {
+        m_coreFeatures.initialise(m_coreParams);
+    } catch (const std::logic_error &e) {
+        cerr << "ERROR: PitchVibrato::initialise: Feature extractor initialisation failed: " << e.what() << endl;
+        return false;
+    }
+    
+    return true;
+}
+
+bool
+PitchVibrato::initialiseForFeaturesFrom(size_t channels, size_t stepSize,
+                                         size_t blockSize)
 {
     if (channels < getMinChannelCount() || channels > getMaxChannelCount()) {
         cerr << "ERROR: PitchVibrato::initialise: unsupported channel count "
@@ -569,14 +590,8 @@ PitchVibrato::initialise(size_t channels, size_t stepSize, size_t blockSize)
     m_stepSize = stepSize;
     m_blockSize = blockSize;
 
-    try {
-        m_coreParams.stepSize = m_stepSize;
-        m_coreParams.blockSize = m_blockSize;
-        m_coreFeatures.initialise(m_coreParams);
-    } catch (const std::logic_error &e) {
-        cerr << "ERROR: PitchVibrato::initialise: Feature extractor initialisation failed: " << e.what() << endl;
-        return false;
-    }
+    m_coreParams.stepSize = m_stepSize;
+    m_coreParams.blockSize = m_blockSize;
     
     return true;
 }
@@ -595,7 +610,8 @@ PitchVibrato::process(const float *const *inputBuffers, Vamp::RealTime timestamp
 }
 
 vector<PitchVibrato::VibratoElement>
-PitchVibrato::extractElements(const vector<double> &pyinPitch_Hz,
+PitchVibrato::extractElements(const CoreFeatures &coreFeatures,
+                              const vector<double> &pyinPitch_Hz,
                               vector<double> &smoothedPitch_semis,
                               vector<int> &rawPeaks) const
 {
@@ -607,7 +623,7 @@ PitchVibrato::extractElements(const vector<double> &pyinPitch_Hz,
     // code that it is 35ms either side of the centre, so 70ms
     // total. We make the value configurable but with 70ms default.)
 
-    int filterLength_steps = m_coreFeatures.msToSteps
+    int filterLength_steps = coreFeatures.msToSteps
         (m_smoothingWindowLength_ms, m_coreParams.stepSize, true);
     
 #ifdef DEBUG_PITCH_VIBRATO
@@ -618,7 +634,7 @@ PitchVibrato::extractElements(const vector<double> &pyinPitch_Hz,
     vector<double> unsmoothedPitch_semis;
     for (auto hz : pyinPitch_Hz) {
         if (hz > 0.0) {
-            unsmoothedPitch_semis.push_back(m_coreFeatures.hzToPitch(hz));
+            unsmoothedPitch_semis.push_back(coreFeatures.hzToPitch(hz));
         } else {
             unsmoothedPitch_semis.push_back(0.0);
         }
@@ -628,29 +644,55 @@ PitchVibrato::extractElements(const vector<double> &pyinPitch_Hz,
     smoothedPitch_semis = vector<double>(n, 0.0);
 
     // Filter in a way that accounts correctly for missing data (zero
-    // pitch values)
-    for (int i = 0; i < n; ++i) {
-        if (unsmoothedPitch_semis[i] != 0.0) {
-            double total = 0.0;
-            int count = 0;
-            for (int j = 0; j < filterLength_steps/2; ++j) {
-                int ix = i - j;
-                if (ix < 0 || unsmoothedPitch_semis[ix] == 0.0) {
-                    break;
-                }
-                total += unsmoothedPitch_semis[ix];
-                count += 1;
+    // pitch values). Each voiced hop is averaged with up to half the
+    // filter length of hops on either side of it, counting itself
+    // once for each side, with the window cut short on either side
+    // at the end of the voiced run the hop belongs to. Running totals
+    // that restart at each unvoiced hop give the sum over any range
+    // within a voiced run in constant time, so the cost doesn't
+    // depend on the filter length.
+    //
+    // The totals are kept in fixed point, so that they are exact and
+    // the same window contents always give the same mean wherever
+    // they occur. (Differences of floating-point running totals pick
+    // up last-bit errors that vary along a run of constant pitch,
+    // and the peak picking below would find spurious local maxima in
+    // them.) The quantisation step is far below anything pYIN can
+    // resolve
+    const double fixedPointScale = 4294967296.0; // 2^32
+    int half = filterLength_steps/2;
+    if (half > 0) {
+        vector<int64_t> cumulative(n + 1, 0);
+        for (int i = 0; i < n; ++i) {
+            if (unsmoothedPitch_semis[i] != 0.0) {
+                cumulative[i+1] = cumulative[i] +
+                    std::llround(unsmoothedPitch_semis[i] * fixedPointScale);
+            }
+        }
+        int i = 0;
+        while (i < n) {
+            if (unsmoothedPitch_semis[i] == 0.0) {
+                ++i;
+                continue;
             }
-            for (int j = 0; j < filterLength_steps/2; ++j) {
-                int ix = i + j;
-                if (ix >= n || unsmoothedPitch_semis[ix] == 0.0) {
-                    break;
-                }
-                total += unsmoothedPitch_semis[ix];
-                count += 1;
+            int runStart = i;
+            int runEnd = i;
+            while (runEnd + 1 < n && unsmoothedPitch_semis[runEnd + 1] != 0.0) {
+                ++runEnd;
             }
-            if (count > 0) {
-                smoothedPitch_semis[i] = total / count;
+            for (i = runStart; i <= runEnd; ++i) {
+                int from = std::max(runStart, i - half + 1);
+                int to = std::min(runEnd, i + half - 1);
+                int64_t total = (cumulative[i+1] - cumulative[from]) +
+                    (cumulative[to+1] - cumulative[i]);
+                int count = (i - from + 1) + (to - i + 1);
+                // Divide in integers first, so that a window of equal
+                // values gives exactly that value back
+                int64_t quotient = total / count;
+                int64_t remainder = total % count;
+                smoothedPitch_semis[i] =
+                    (double(quotient) + double(remainder) / count) /
+                    fixedPointScale;
             }
         }
     }
@@ -765,9 +807,9 @@ PitchVibrato::extractElements(const vector<double> &pyinPitch_Hz,
     cerr << "** 3-5. Evaluate peak-to-peak pairs against basic vibrato criteria" << endl;
 #endif
     
-    int minDistSteps = m_coreFeatures.msToSteps
+    int minDistSteps = coreFeatures.msToSteps
         (1000.0 / m_vibratoRateMaximum_Hz, m_coreParams.stepSize, false);
-    int maxDistSteps = m_coreFeatures.msToSteps
+    int maxDistSteps = coreFeatures.msToSteps
         (1000.0 / m_vibratoRateMinimum_Hz, m_coreParams.stepSize, false);
 
     int minPitchedHops = (minDistSteps / 5) * 4;
@@ -907,7 +949,7 @@ PitchVibrato::extractElements(const vector<double> &pyinPitch_Hz,
         while (min0 > 0 &&
                smoothedPitch_semis[min0 - 1] > 0.0 &&
                smoothedPitch_semis[min0 - 1] < smoothedPitch_semis[min0]) {
-//            cerr << "at hop " << min0-1 << " we see " << smoothedPitch_semis[min0 - 1] << " (unsmoothed = " << unsmoothedPitch_semis[min0 - 1] << ", " << m_coreFeatures.pitchToHz(unsmoothedPitch_semis[min0 - 1]) << " Hz)" << endl;
+//            cerr << "at hop " << min0-1 << " we see " << smoothedPitch_semis[min0 - 1] << " (unsmoothed = " << unsmoothedPitch_semis[min0 - 1] << ", " << coreFeatures.pitchToHz(unsmoothedPitch_semis[min0 - 1]) << " Hz)" << endl;
             --min0;
         }
         
@@ -1032,8 +1074,9 @@ PitchVibrato::extractElements(const vector<double> &pyinPitch_Hz,
 }
 
 vector<PitchVibrato::VibratoElement>
-PitchVibrato::extractElementsSegmented(const vector<double> &pyinPitch_Hz,
-                                       const CoreFeatures::OnsetOffsetMap &onsetOffsets,
+PitchVibrato::extractElementsSegmented(const CoreFeatures &coreFeatures,
+                                       const vector<double> &pyinPitch_Hz,
+                                       const CoreFeatures::NoteTable &onsetOffsets,
                                        vector<double> &smoothedPitch_semis,
                                        vector<int> &rawPeaks) const
 {
@@ -1049,39 +1092,66 @@ PitchVibrato::extractElementsSegmented(const vector<double> &pyinPitch_Hz,
     // discarded and would not contribute to the analysis for any
     // note"
 
-    int startClip_steps = m_coreFeatures.msToSteps
+    int startClip_steps = coreFeatures.msToSteps
         (25.0, m_coreParams.stepSize, false);
+
+    struct Note {
+        int onset;
+        int followingOnset;
+        vector<VibratoElement> elements;
+        vector<double> smoothedPitch;
+        vector<int> peaks;
+    };
+    vector<Note> notes;
     
     for (auto itr = onsetOffsets.begin(); itr != onsetOffsets.end(); ++itr) {
 
-        int onset = itr->first;
-        int followingOnset = itr->second.first;
-
-        auto jtr = itr;
-        ++jtr;
-        if (jtr != onsetOffsets.end()) {
-            followingOnset = jtr->first;
-        }
+        int onset = itr->onset;
+        int followingOnset = onsetOffsets.getFollowingOnset(itr, itr->offset);
 
         onset += startClip_steps;
         
         if (onset >= followingOnset) {
             continue;
         }
-        
-        vector<double> notePitches(pyinPitch_Hz.begin() + onset,
-                                   pyinPitch_Hz.begin() + followingOnset);
 
-        vector<int> notePeaks;
-        vector<double> noteSmoothedPitch;
-        
-        auto noteElements = extractElements
-            (notePitches, noteSmoothedPitch, notePeaks);
+        Note note;
+        note.onset = onset;
+        note.followingOnset = followingOnset;
+        notes.push_back(note);
+    }
+
+    // Each note is analysed independently of the others. Their
+    // lengths vary a great deal, so rather than divide them up in
+    // advance, each thread takes the next one available whenever it
+    // becomes free
+    int noteCount = int(notes.size());
+    int threads = m_noteThreadCount;
+    if (threads <= 0) {
+        threads = (noteCount >= 8 ? getParallelThreadCount() : 1);
+    }
+    std::atomic<int> nextNote(0);
+    parallelFor(noteCount, threads, [&](int, int) {
+        int i;
+        while ((i = nextNote++) < noteCount) {
+            Note &note = notes[i];
+            vector<double> notePitches
+                (pyinPitch_Hz.begin() + note.onset,
+                 pyinPitch_Hz.begin() + note.followingOnset);
+            note.elements = extractElements
+                (coreFeatures, notePitches, note.smoothedPitch, note.peaks);
+        }
+    });
+
+    // Then the results are put together in onset order
+    for (const auto &note : notes) {
 
+        int onset = note.onset;
+        
         double onsetPosition_sec = 
-            m_coreFeatures.stepsToMs(onset, m_coreParams.stepSize) / 1000.0;
+            coreFeatures.stepsToMs(onset, m_coreParams.stepSize) / 1000.0;
         
-        for (auto e : noteElements) {
+        for (auto e : note.elements) {
             e.hop += onset;
             e.followingHop += onset;
             e.peakIndex += peakCount;
@@ -1089,7 +1159,7 @@ PitchVibrato::extractElementsSegmented(const vector<double> &pyinPitch_Hz,
             elements.push_back(e);
         }
 
-        for (auto p : notePeaks) {
+        for (auto p : note.peaks) {
             rawPeaks.push_back(p + onset);
             ++peakCount;
         }
@@ -1098,7 +1168,7 @@ PitchVibrato::extractElementsSegmented(const vector<double> &pyinPitch_Hz,
             smoothedPitch_semis.push_back(0.0);
         }            
 
-        for (auto p : noteSmoothedPitch) {
+        for (auto p : note.smoothedPitch) {
             smoothedPitch_semis.push_back(p);
         }
     }
@@ -1112,8 +1182,9 @@ PitchVibrato::extractElementsSegmented(const vector<double> &pyinPitch_Hz,
 }
 
 std::vector<double>
-PitchVibrato::filterGlides(const std::vector<double> &pyinPitch_Hz,
-                           const CoreFeatures::OnsetOffsetMap &onsetOffsets)
+PitchVibrato::filterGlides(const CoreFeatures &coreFeatures,
+                           const std::vector<double> &pyinPitch_Hz,
+                           const CoreFeatures::NoteTable &onsetOffsets)
     const
 {
 #ifdef DEBUG_PITCH_VIBRATO
@@ -1122,17 +1193,17 @@ PitchVibrato::filterGlides(const std::vector<double> &pyinPitch_Hz,
     
     Glide::Parameters glideParams;
     glideParams.durationThreshold_steps =
-        m_coreFeatures.msToSteps(m_glideThresholdDuration_ms,
-                                 m_coreParams.stepSize, false);
+        coreFeatures.msToSteps(m_glideThresholdDuration_ms,
+                               m_coreParams.stepSize, false);
     glideParams.onsetProximityThreshold_steps =
-        m_coreFeatures.msToSteps(m_glideThresholdProximity_ms,
-                                 m_coreParams.stepSize, false);
+        coreFeatures.msToSteps(m_glideThresholdProximity_ms,
+                               m_coreParams.stepSize, false);
     glideParams.minimumPitchThreshold_cents = m_glideThresholdPitch_cents;
     glideParams.minimumHopDifference_cents = m_glideThresholdHopMinimum_cents;
     glideParams.maximumHopDifference_cents = m_glideThresholdHopMaximum_cents;
     glideParams.medianFilterLength_steps =
-        m_coreFeatures.msToSteps(m_coreParams.pitchAverageWindow_ms,
-                                 m_coreParams.stepSize, true);
+        coreFeatures.msToSteps(m_coreParams.pitchAverageWindow_ms,
+                               m_coreParams.stepSize, true);
     glideParams.useSmoothing = false;
     Glide glide(glideParams);
     Glide::Extents glides = glide.extract_Hz(pyinPitch_Hz, onsetOffsets);
@@ -1161,25 +1232,30 @@ PitchVibrato::filterGlides(const std::vector<double> &pyinPitch_Hz,
 }
 
 vector<PitchVibrato::VibratoElement>
-PitchVibrato::extractElementsWithoutGlides(const vector<double> &pyinPitch_Hz,
-                                           const CoreFeatures::OnsetOffsetMap &onsetOffsets,
+PitchVibrato::extractElementsWithoutGlides(const CoreFeatures &coreFeatures,
+                                           const vector<double> &pyinPitch_Hz,
+                                           const CoreFeatures::NoteTable &onsetOffsets,
                                            vector<double> &smoothedPitch_semis,
                                            vector<int> &rawPeaks) const
 {
-    auto glideFilteredPitch_Hz = filterGlides(pyinPitch_Hz, onsetOffsets);
-    return extractElements(glideFilteredPitch_Hz,
+    auto glideFilteredPitch_Hz =
+        filterGlides(coreFeatures, pyinPitch_Hz, onsetOffsets);
+    return extractElements(coreFeatures, glideFilteredPitch_Hz,
                            smoothedPitch_semis, rawPeaks);
 }
 
 vector<PitchVibrato::VibratoElement>
-PitchVibrato::extractElementsWithoutGlidesAndSegmented(const vector<double> &pyinPitch_Hz,
-                                                       const CoreFeatures::OnsetOffsetMap &onsetOffsets,
+PitchVibrato::extractElementsWithoutGlidesAndSegmented(const CoreFeatures &coreFeatures,
+                                                       const vector<double> &pyinPitch_Hz,
+                                                       const CoreFeatures::NoteTable &onsetOffsets,
                                                        vector<double> &smoothedPitch_semis,
                                                        vector<int> &rawPeaks) const
 {
-    auto glideFilteredPitch_Hz = filterGlides(pyinPitch_Hz, onsetOffsets);
-    return extractElementsSegmented(glideFilteredPitch_Hz, onsetOffsets,
-                                    smoothedPitch_semis, rawPeaks);
+    auto glideFilteredPitch_Hz =
+        filterGlides(coreFeatures, pyinPitch_Hz, onsetOffsets);
+    return extractElementsSegmented(coreFeatures, glideFilteredPitch_Hz,
+                                    onsetOffsets, smoothedPitch_semis,
+                                    rawPeaks);
 }
 
 PitchVibrato::VibratoChains
@@ -1300,8 +1376,9 @@ PitchVibrato::selectBestChainForNote(const VibratoChains &allChains,
 }
 
 map<int, PitchVibrato::VibratoClassification>
-PitchVibrato::classify(const vector<VibratoElement> &elements,
-                       const CoreFeatures::OnsetOffsetMap &onsetOffsets) const
+PitchVibrato::classify(const CoreFeatures &coreFeatures,
+                       const vector<VibratoElement> &elements,
+                       const CoreFeatures::NoteTable &onsetOffsets) const
 {
     map<int, VibratoClassification> classifications;
 
@@ -1315,8 +1392,8 @@ PitchVibrato::classify(const vector<VibratoElement> &elements,
 
         // Identify onset, offset, and the following onset
         
-        int onset = pitr->first;
-        int offset = pitr->second.first;
+        int onset = pitr->onset;
+        int offset = pitr->offset;
 
 #ifdef DEBUG_PITCH_VIBRATO
         cerr << "-- Classifying note from " << onset << " to " << offset << endl;
@@ -1341,9 +1418,9 @@ PitchVibrato::classify(const vector<VibratoElement> &elements,
         const VibratoElement &last = chain.at(nelts - 1);
 
         double noteStart_ms =
-            m_coreFeatures.stepsToMs(onset, m_coreParams.stepSize);
+            coreFeatures.stepsToMs(onset, m_coreParams.stepSize);
         double noteEnd_ms =
-            m_coreFeatures.stepsToMs(offset, m_coreParams.stepSize);
+            coreFeatures.stepsToMs(offset, m_coreParams.stepSize);
 
         double vibratoStart_ms = first.position_sec * 1000.0;
         double vibratoEnd_ms = (last.position_sec + last.waveLength_sec) * 1000.0;
@@ -1518,12 +1595,17 @@ PitchVibrato::classificationToIndex(const PitchVibrato::VibratoClassification &
 PitchVibrato::FeatureSet
 PitchVibrato::getRemainingFeatures()
 {
-    FeatureSet fs;
-
     m_coreFeatures.finish();
+    return getFeaturesFrom(m_coreFeatures);
+}
+
+PitchVibrato::FeatureSet
+PitchVibrato::getFeaturesFrom(const CoreFeatures &coreFeatures)
+{
+    FeatureSet fs;
 
-    auto pyinPitch_Hz = m_coreFeatures.getPYinPitch_Hz();
-    auto onsetOffsets = m_coreFeatures.getOnsetOffsets();
+    auto pyinPitch_Hz = coreFeatures.getPYinPitch_Hz();
+    auto onsetOffsets = coreFeatures.getNotes();
 
     vector<int> rawPeaks;
     vector<double> smoothedPitch_semis;
@@ -1532,22 +1614,25 @@ PitchVibrato::getRemainingFeatures()
     switch (m_segmentationType) {
     case SegmentationType::Unsegmented:
         elements = extractElements
-            (pyinPitch_Hz, smoothedPitch_semis, rawPeaks);
+            (coreFeatures, pyinPitch_Hz, smoothedPitch_semis, rawPeaks);
         break;
 
     case SegmentationType::Segmented:
         elements = extractElementsSegmented
-            (pyinPitch_Hz, onsetOffsets, smoothedPitch_semis, rawPeaks);
+            (coreFeatures, pyinPitch_Hz, onsetOffsets,
+             smoothedPitch_semis, rawPeaks);
         break;
 
     case SegmentationType::WithoutGlides:
         elements = extractElementsWithoutGlides 
-           (pyinPitch_Hz, onsetOffsets, smoothedPitch_semis, rawPeaks);
+           (coreFeatures, pyinPitch_Hz, onsetOffsets,
+            smoothedPitch_semis, rawPeaks);
         break;
 
     case SegmentationType::WithoutGlidesAndSegmented:
         elements = extractElementsWithoutGlidesAndSegmented
-           (pyinPitch_Hz, onsetOffsets, smoothedPitch_semis, rawPeaks);
+           (coreFeatures, pyinPitch_Hz, onsetOffsets,
+            smoothedPitch_semis, rawPeaks);
         break;
     }
 
@@ -1557,13 +1642,13 @@ PitchVibrato::getRemainingFeatures()
         if (smoothedPitch_semis[i] <= 0.0) continue;
         Feature f;
         f.hasTimestamp = true;
-        f.timestamp = m_coreFeatures.timeForStep(i);
-        f.values.push_back(m_coreFeatures.pitchToHz(smoothedPitch_semis[i]));
+        f.timestamp = coreFeatures.timeForStep(i);
+        f.values.push_back(coreFeatures.pitchToHz(smoothedPitch_semis[i]));
         fs[m_pitchTrackOutput].push_back(f);
     }
 
     map<int, VibratoClassification> classifications =
-        classify(elements, onsetOffsets);
+        classify(coreFeatures, elements, onsetOffsets);
 
     double meanOverallRate = 0.0;
     double meanClampedDuration = 0.0;
@@ -1572,13 +1657,9 @@ PitchVibrato::getRemainingFeatures()
 
     for (auto pitr = onsetOffsets.begin(); pitr != onsetOffsets.end(); ++pitr) {
 
-        int onset = pitr->first;
+        int onset = pitr->onset;
 
-        int followingOnset = n;
-        auto pj = pitr;
-        if (++pj != onsetOffsets.end()) {
-            followingOnset = pj->first;
-        }
+        int followingOnset = onsetOffsets.getFollowingOnset(pitr, n);
 
         if (classifications.find(onset) == classifications.end()) {
             
@@ -1592,7 +1673,7 @@ PitchVibrato::getRemainingFeatures()
 
             string code = "N";
             
-            f.timestamp = m_coreFeatures.timeForStep(onset);
+            f.timestamp = coreFeatures.timeForStep(onset);
             f.hasDuration = false;
             f.label = code;
             fs[m_vibratoTypeOutput].push_back(f);
@@ -1603,9 +1684,9 @@ PitchVibrato::getRemainingFeatures()
             fs[m_vibratoIndexOutput].push_back(f);
         
             ostringstream os;
-            os << m_coreFeatures.timeForStep(onset).toText() << " / "
-               << (m_coreFeatures.timeForStep(followingOnset) -
-                   m_coreFeatures.timeForStep(onset)).toText() << "\n"
+            os << coreFeatures.timeForStep(onset).toText() << " / "
+               << (coreFeatures.timeForStep(followingOnset) -
+                   coreFeatures.timeForStep(onset)).toText() << "\n"
                << code << "\n"
                << "IVibr = " << 0.0;
             f.label = os.str();
@@ -1626,7 +1707,7 @@ PitchVibrato::getRemainingFeatures()
             
             Feature f;
             f.hasTimestamp = true;
-            f.timestamp = m_coreFeatures.timeForStep(onset);
+            f.timestamp = coreFeatures.timeForStep(onset);
             f.hasDuration = false;
             f.label = code;
             fs[m_vibratoTypeOutput].push_back(f);
@@ -1647,9 +1728,9 @@ PitchVibrato::getRemainingFeatures()
             meanDivisor ++;
             
             ostringstream os;
-            os << m_coreFeatures.timeForStep(onset).toText() << " / "
-               << (m_coreFeatures.timeForStep(followingOnset) -
-                   m_coreFeatures.timeForStep(onset)).toText() << "\n"
+            os << coreFeatures.timeForStep(onset).toText() << " / "
+               << (coreFeatures.timeForStep(followingOnset) -
+                   coreFeatures.timeForStep(onset)).toText() << "\n"
                << code << "\n"
                << int(round(clampedRelativeDuration * 100.0)) << "%\n"
                << classification.meanRate_Hz << "Hz\n"
@@ -1683,7 +1764,7 @@ PitchVibrato::getRemainingFeatures()
             if (j < n && pyinPitch_Hz[j] > 0.0) {
                 Feature f;
                 f.hasTimestamp = true;
-                f.timestamp = m_coreFeatures.timeForStep(j);
+                f.timestamp = coreFeatures.timeForStep(j);
                 f.values.push_back(pyinPitch_Hz[j]);
                 fs[m_vibratoPitchTrackOutput].push_back(f);
             }
@@ -1695,14 +1776,14 @@ PitchVibrato::getRemainingFeatures()
     for (int i = 0; i < int(rawPeaks.size()); ++i) {
         Feature f;
         f.hasTimestamp = true;
-        f.timestamp = m_coreFeatures.timeForStep(rawPeaks[i]);
+        f.timestamp = coreFeatures.timeForStep(rawPeaks[i]);
         fs[m_rawPeaksOutput].push_back(f);
     }
     
     for (auto e: elements) {
         Feature f;
         f.hasTimestamp = true;
-        f.timestamp = m_coreFeatures.getStartTime() +
+        f.timestamp = coreFeatures.getStartTime() +
             Vamp::RealTime::fromSeconds(e.position_sec);
         f.values.push_back(pyinPitch_Hz[e.hop]);
         fs[m_acceptedPeaksOutput].push_back(f);
@@ -1712,9 +1793,9 @@ PitchVibrato::getRemainingFeatures()
 
     Feature f;
     f.hasTimestamp = true;
-    f.timestamp = m_coreFeatures.getStartTime();
+    f.timestamp = coreFeatures.getStartTime();
     f.hasDuration = true;
-    f.duration = m_coreFeatures.timeForStep(n) - f.timestamp;
+    f.duration = coreFeatures.timeForStep(n) - f.timestamp;
     f.values.clear();
     {
         ostringstream os;
@@ -16,6 +16,8 @@
 
 #include "CoreFeatures.h"
 
+#include <map>
+
 using std::string;
 
 //#define WITH_DEBUG_OUTPUTS 1
@@ -50,6 +52,10 @@ public:
     OutputList getOutputDescriptors() const;
 
     bool initialise(size_t channels, size_t stepSize, size_t blockSize);
+
+    /** As initialise(), but for getFeaturesFrom() only: see Combined.h */
+    bool initialiseForFeaturesFrom(size_t channels, size_t stepSize,
+                                   size_t blockSize);
     void reset();
 
     FeatureSet process(const float *const *inputBuffers,
@@ -57,6 +63,24 @@ public:
 
     FeatureSet getRemainingFeatures();
 
+    /** Features from a shared, finished CoreFeatures: see Combined.h */
+    FeatureSet getFeaturesFrom(const CoreFeatures &coreFeatures);
+
+    /** Parameters getFeaturesFrom() expects: see Combined.h */
+    CoreFeatures::Parameters getCoreParameters() const {
+        return m_coreParams;
+    }
+
+    /** Extract the elements of each note in the segmented modes on
+     *  exactly the given number of threads, however few notes there
+     *  are, rather than choosing a number according to the note
+     *  count. Zero, the default, restores the automatic choice.
+     *  Intended for testing.
+     */
+    void setNoteThreadCount(int threads) {
+        m_noteThreadCount = threads;
+    }
+
     struct VibratoElement {
         int hop;
         int peakIndex;
@@ -199,31 +223,36 @@ public:
     };
 
     std::vector<VibratoElement> extractElements
-    (const std::vector<double> &pyinPitch_Hz,  // in
+    (const CoreFeatures &coreFeatures,         // in
+     const std::vector<double> &pyinPitch_Hz,  // in
      std::vector<double> &smoothedPitch_semis, // out
      std::vector<int> &rawPeaks) const;        // out
 
     std::vector<VibratoElement> extractElementsSegmented
-    (const std::vector<double> &pyinPitch_Hz,  // in
-     const CoreFeatures::OnsetOffsetMap &onsetOffsets, // in
+    (const CoreFeatures &coreFeatures,         // in
+     const std::vector<double> &pyinPitch_Hz,  // in
+     const CoreFeatures::NoteTable &onsetOffsets, // in
      std::vector<double> &smoothedPitch_semis, // out
      std::vector<int> &rawPeaks) const;        // out
 
     std::vector<VibratoElement> extractElementsWithoutGlides
-    (const std::vector<double> &pyinPitch_Hz,  // in
-     const CoreFeatures::OnsetOffsetMap &onsetOffsets, // in
+    (const CoreFeatures &coreFeatures,         // in
+     const std::vector<double> &pyinPitch_Hz,  // in
+     const CoreFeatures::NoteTable &onsetOffsets, // in
      std::vector<double> &smoothedPitch_semis, // out
      std::vector<int> &rawPeaks) const;        // out
 
     std::vector<VibratoElement> extractElementsWithoutGlidesAndSegmented
-    (const std::vector<double> &pyinPitch_Hz,  // in
-     const CoreFeatures::OnsetOffsetMap &onsetOffsets, // in
+    (const CoreFeatures &coreFeatures,         // in
+     const std::vector<double> &pyinPitch_Hz,  // in
+     const CoreFeatures::NoteTable &onsetOffsets, // in
      std::vector<double> &smoothedPitch_semis, // out
      std::vector<int> &rawPeaks) const;        // out
 
     std::map<int, VibratoClassification> classify
-    (const std::vector<VibratoElement> &elements,
-     const CoreFeatures::OnsetOffsetMap &onsetOffsets) const;
+    (const CoreFeatures &coreFeatures,
+     const std::vector<VibratoElement> &elements,
+     const CoreFeatures::NoteTable &onsetOffsets) const;
 
     std::string classificationToCode(const VibratoClassification &) const;
     double classificationToIndex(const VibratoClassification &) const;
@@ -264,6 +293,8 @@ protected:
     float m_glideThresholdProximity_ms;
 
     SegmentationType m_segmentationType;
+
+    int m_noteThreadCount;
     
     mutable int m_summaryOutput;
     mutable int m_pitchTrackOutput;
@@ -271,17 +302,19 @@ protected:
     mutable int m_vibratoIndexOutput;
     mutable int m_vibratoPitchTrackOutput;
 
-#ifdef WITH_DEBUG_OUTPUTS
+    // These are only used when WITH_DEBUG_OUTPUTS is defined, but are
+    // declared regardless so that the class layout does not depend
+    // on whether some other header (such as Onsets.h) has defined it
     mutable int m_rawPeaksOutput;
     mutable int m_acceptedPeaksOutput;
-#endif
 
     mutable int m_meanDurationOutput;
     mutable int m_meanRateOutput;
     mutable int m_meanMaxRangeOutput;
     
-    std::vector<double> filterGlides(const std::vector<double> &,
-                                     const CoreFeatures::OnsetOffsetMap &) const;
+    std::vector<double> filterGlides(const CoreFeatures &,
+                                     const std::vector<double> &,
+                                     const CoreFeatures::NoteTable &) const;
     
     typedef std::vector<VibratoElement> VibratoChain;
     typedef std::vector<VibratoChain> VibratoChains;
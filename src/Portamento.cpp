@@ -489,6 +489,24 @@ Portamento::getOutputDescriptors() const
 
 bool
 Portamento::initialise(size_t channels, size_t stepSize, size_t blockSize)
+{
+    if (!initialiseForFeaturesFrom(channels, stepSize, blockSize)) {
+        return false;
+    }
+
+    try {
+        m_coreFeatures.initialise(m_coreParams);
+    } catch (const std::logic_error &e) {
+        cerr << "ERROR: Portamento::initialise: Feature extractor initialisation failed: " << e.what() << endl;
+        return false;
+    }
+    
+    return true;
+}
+
+bool
+Portamento::initialiseForFeaturesFrom(size_t channels, size_t stepSize,
+                                       size_t blockSize)
 {
     if (channels < getMinChannelCount() || channels > getMaxChannelCount()) {
         cerr << "ERROR: Portamento::initialise: unsupported channel count "
@@ -523,14 +541,8 @@ Portamento::initialise(size_t channels, size_t stepSize, size_t blockSize)
     m_stepSize = stepSize;
     m_blockSize = blockSize;
 
-    try {
-        m_coreParams.stepSize = m_stepSize;
-        m_coreParams.blockSize = m_blockSize;
-        m_coreFeatures.initialise(m_coreParams);
-    } catch (const std::logic_error &e) {
-        cerr << "ERROR: Portamento::initialise: Feature extractor initialisation failed: " << e.what() << endl;
-        return false;
-    }
+    m_coreParams.stepSize = m_stepSize;
+    m_coreParams.blockSize = m_blockSize;
     
     return true;
 }
@@ -549,8 +561,9 @@ Portamento::process(const float *const *inputBuffers, Vamp::RealTime timestamp)
 }
 
 Portamento::GlideClassification
-Portamento::classifyGlide(const std::pair<int, Glide::Extent> &extentPair,
-                          const CoreFeatures::OnsetOffsetMap &onsetOffsets,
+Portamento::classifyGlide(const CoreFeatures &coreFeatures,
+                          const std::pair<int, Glide::Extent> &extentPair,
+                          const CoreFeatures::NoteTable &onsetOffsets,
                           const vector<double> &pyinPitch,
                           const vector<double> &smoothedPower)
 {
@@ -570,8 +583,8 @@ Portamento::classifyGlide(const std::pair<int, Glide::Extent> &extentPair,
     // Range
     
     double range =
-        m_coreFeatures.hzToPitch(pyinPitch[extent.end]) -
-        m_coreFeatures.hzToPitch(pyinPitch[extent.start]);
+        coreFeatures.hzToPitch(pyinPitch[extent.end]) -
+        coreFeatures.hzToPitch(pyinPitch[extent.start]);
 
     classification.range_cents = range * 100.0;
     
@@ -586,8 +599,8 @@ Portamento::classifyGlide(const std::pair<int, Glide::Extent> &extentPair,
     // Duration
     
     double duration_ms =
-        m_coreFeatures.stepsToMs(extent.end - extent.start + 1,
-                                 m_coreParams.stepSize);
+        coreFeatures.stepsToMs(extent.end - extent.start + 1,
+                               m_coreParams.stepSize);
 
     if (duration_ms > m_durationBoundaryLong_ms) {
         classification.duration = GlideDuration::Long;
@@ -601,12 +614,12 @@ Portamento::classifyGlide(const std::pair<int, Glide::Extent> &extentPair,
 
     // Link
 
-    double startPitch_semis = m_coreFeatures.hzToPitch(pyinPitch[extent.start]);
-    double endPitch_semis = m_coreFeatures.hzToPitch(pyinPitch[extent.end]);
+    double startPitch_semis = coreFeatures.hzToPitch(pyinPitch[extent.start]);
+    double endPitch_semis = coreFeatures.hzToPitch(pyinPitch[extent.end]);
 
     bool matchingPreceding = false, matchingAssociated = false;
 
-    int matchingMedianLength = m_coreFeatures.msToSteps
+    int matchingMedianLength = coreFeatures.msToSteps
         (50.0, m_coreParams.stepSize, false);
     
     auto onsetItr = onsetOffsets.find(onset);
@@ -617,10 +630,10 @@ Portamento::classifyGlide(const std::pair<int, Glide::Extent> &extentPair,
         if (onsetItr != onsetOffsets.begin()) {
             auto prevItr = onsetItr;
             --prevItr;
-            int p0 = prevItr->first;
+            int p0 = prevItr->onset;
             int p1 = p0 + 1;
             while (p1 <= p0 + matchingMedianLength) {
-                if (p1 >= prevItr->second.first || p1 >= extent.start) {
+                if (p1 >= prevItr->offset || p1 >= extent.start) {
                     break;
                 } else if (pyinPitch[p1] <= 0.0) {
                     break;
@@ -629,7 +642,7 @@ Portamento::classifyGlide(const std::pair<int, Glide::Extent> &extentPair,
             }
             double prevMedian = MathUtilities::median(pyinPitch.data() + p0,
                                                       p1 - p0);
-            double prevMedian_semis = m_coreFeatures.hzToPitch(prevMedian);
+            double prevMedian_semis = coreFeatures.hzToPitch(prevMedian);
             if (100.0 * fabs(startPitch_semis - prevMedian_semis) <
                 m_linkThreshold_cents) {
                 matchingPreceding = true;
@@ -645,10 +658,10 @@ Portamento::classifyGlide(const std::pair<int, Glide::Extent> &extentPair,
 #endif
         }
 
-        int p0 = onsetItr->first;
+        int p0 = onsetItr->onset;
         int p1 = p0 + 1;
         while (p1 <= p0 + matchingMedianLength) {
-            if (p1 >= onsetItr->second.first) {
+            if (p1 >= onsetItr->offset) {
                 break;
             } else if (pyinPitch[p1] <= 0.0) {
                 break;
@@ -657,7 +670,7 @@ Portamento::classifyGlide(const std::pair<int, Glide::Extent> &extentPair,
         }
         double assocMedian = MathUtilities::median(pyinPitch.data() + p0,
                                                    p1 - p0);
-        double assocMedian_semis = m_coreFeatures.hzToPitch(assocMedian);
+        double assocMedian_semis = coreFeatures.hzToPitch(assocMedian);
         if (100.0 * fabs(endPitch_semis - assocMedian_semis) <
             m_linkThreshold_cents) {
             matchingAssociated = true;
@@ -744,36 +757,41 @@ Portamento::classifyGlide(const std::pair<int, Glide::Extent> &extentPair,
 Portamento::FeatureSet
 Portamento::getRemainingFeatures()
 {
-    FeatureSet fs;
-
     m_coreFeatures.finish();
+    return getFeaturesFrom(m_coreFeatures);
+}
 
-    auto pyinPitch = m_coreFeatures.getPYinPitch_Hz();
-    auto smoothedPower = m_coreFeatures.getSmoothedPower_dB();
-    auto onsetOffsets = m_coreFeatures.getOnsetOffsets();
+Portamento::FeatureSet
+Portamento::getFeaturesFrom(const CoreFeatures &coreFeatures)
+{
+    FeatureSet fs;
+
+    auto pyinPitch = coreFeatures.getPYinPitch_Hz();
+    auto smoothedPower = coreFeatures.getSmoothedPower_dB();
+    auto onsetOffsets = coreFeatures.getNotes();
 
     for (int i = 0; i < int(pyinPitch.size()); ++i) {
         if (pyinPitch[i] <= 0) continue;
         Feature f;
         f.hasTimestamp = true;
-        f.timestamp = m_coreFeatures.timeForStep(i);
+        f.timestamp = coreFeatures.timeForStep(i);
         f.values.push_back(pyinPitch[i]);
         fs[m_pitchTrackOutput].push_back(f);
     }
 
     Glide::Parameters glideParams;
     glideParams.durationThreshold_steps =
-        m_coreFeatures.msToSteps(m_glideThresholdDuration_ms,
-                                 m_coreParams.stepSize, false);
+        coreFeatures.msToSteps(m_glideThresholdDuration_ms,
+                               m_coreParams.stepSize, false);
     glideParams.onsetProximityThreshold_steps =
-        m_coreFeatures.msToSteps(m_glideThresholdProximity_ms,
-                                 m_coreParams.stepSize, false);
+        coreFeatures.msToSteps(m_glideThresholdProximity_ms,
+                               m_coreParams.stepSize, false);
     glideParams.minimumPitchThreshold_cents = m_glideThresholdPitch_cents;
     glideParams.minimumHopDifference_cents = m_glideThresholdHopMinimum_cents;
     glideParams.maximumHopDifference_cents = m_glideThresholdHopMaximum_cents;
     glideParams.medianFilterLength_steps =
-        m_coreFeatures.msToSteps(m_coreParams.pitchAverageWindow_ms,
-                                 m_coreParams.stepSize, true);
+        coreFeatures.msToSteps(m_coreParams.pitchAverageWindow_ms,
+                               m_coreParams.stepSize, true);
     glideParams.useSmoothing = false;
 
     Glide glide(glideParams);
@@ -784,7 +802,8 @@ Portamento::getRemainingFeatures()
     
     for (auto m : glides) {
         classifications[m.first] =
-            classifyGlide(m, onsetOffsets, pyinPitch, smoothedPower);
+            classifyGlide(coreFeatures, m, onsetOffsets, pyinPitch,
+                          smoothedPower);
     }
     
     int glideNo = 1;
@@ -797,13 +816,9 @@ Portamento::getRemainingFeatures()
     
     for (auto pitr = onsetOffsets.begin(); pitr != onsetOffsets.end(); ++pitr) {
 
-        int onset = pitr->first;
+        int onset = pitr->onset;
 
-        int followingOnset = onset;
-        auto pj = pitr;
-        if (++pj != onsetOffsets.end()) {
-            followingOnset = pj->first;
-        }
+        int followingOnset = onsetOffsets.getFollowingOnset(pitr, onset);
 
         if (glides.find(onset) == glides.end()) {
 
@@ -817,7 +832,7 @@ Portamento::getRemainingFeatures()
 
             string code = "N";
             
-            f.timestamp = m_coreFeatures.timeForStep(onset);
+            f.timestamp = coreFeatures.timeForStep(onset);
             f.hasDuration = false;
             f.label = code;
             fs[m_portamentoTypeOutput].push_back(f);
@@ -828,9 +843,9 @@ Portamento::getRemainingFeatures()
             fs[m_portamentoIndexOutput].push_back(f);
         
             ostringstream os;
-            os << m_coreFeatures.timeForStep(onset).toText() << " / "
-               << (m_coreFeatures.timeForStep(followingOnset) -
-                   m_coreFeatures.timeForStep(onset)).toText() << "\n"
+            os << coreFeatures.timeForStep(onset).toText() << " / "
+               << (coreFeatures.timeForStep(followingOnset) -
+                   coreFeatures.timeForStep(onset)).toText() << "\n"
                << code << "\n"
                << "IPort = " << 0.0;
             f.label = os.str();
@@ -877,7 +892,7 @@ Portamento::getRemainingFeatures()
 
             index *= m_scalingFactor;
         
-            f.timestamp = m_coreFeatures.timeForStep(onset);
+            f.timestamp = coreFeatures.timeForStep(onset);
             f.hasDuration = false;
             f.label = code;
             fs[m_portamentoTypeOutput].push_back(f);
@@ -900,14 +915,14 @@ Portamento::getRemainingFeatures()
             double emax2dp = round(classifications[onset].dynamicMax * 100.0) / 100.0;
 
             ostringstream os;
-            os << m_coreFeatures.timeForStep(onset).toText() << " / "
-               << (m_coreFeatures.timeForStep(followingOnset) -
-                   m_coreFeatures.timeForStep(onset)).toText() << "\n"
+            os << coreFeatures.timeForStep(onset).toText() << " / "
+               << (coreFeatures.timeForStep(followingOnset) -
+                   coreFeatures.timeForStep(onset)).toText() << "\n"
                << code << "\n"
                << sp2dp << "Hz / " << ep2dp << "Hz (" << range2dp << "c)\n"
-               << m_coreFeatures.timeForStep(glideStart).toText() << " / "
-               << m_coreFeatures.timeForStep(glideEnd).toText() << " ("
-               << round(m_coreFeatures.stepsToMs
+               << coreFeatures.timeForStep(glideStart).toText() << " / "
+               << coreFeatures.timeForStep(glideEnd).toText() << " ("
+               << round(coreFeatures.stepsToMs
                         (glideEnd - glideStart + 1, m_coreParams.stepSize))
                << "ms)\n"
                << emax2dp << "dB / " << emin2dp << "dB\n"
@@ -919,7 +934,7 @@ Portamento::getRemainingFeatures()
             {
                 ostringstream os;
                 os << "Glide " << glideNo << ": Start";
-                f.timestamp = m_coreFeatures.timeForStep(glideStart);
+                f.timestamp = coreFeatures.timeForStep(glideStart);
                 f.values.clear();
                 f.values.push_back(pyinPitch[glideStart]);
                 f.label = os.str();
@@ -929,7 +944,7 @@ Portamento::getRemainingFeatures()
             {
                 ostringstream os;
                 os << "Glide " << glideNo << ": Onset";
-                f.timestamp = m_coreFeatures.timeForStep(onset);
+                f.timestamp = coreFeatures.timeForStep(onset);
                 f.values.clear();
                 f.values.push_back(pyinPitch[onset]);
                 f.label = os.str();
@@ -950,7 +965,7 @@ Portamento::getRemainingFeatures()
             {
                 ostringstream os;
                 os << "Glide " << glideNo << ": End";
-                f.timestamp = m_coreFeatures.timeForStep(glideEnd);
+                f.timestamp = coreFeatures.timeForStep(glideEnd);
                 f.values.clear();
                 f.values.push_back(pyinPitch[glideEnd]);
                 f.label = os.str();
@@ -959,7 +974,7 @@ Portamento::getRemainingFeatures()
 
             for (int k = glideStart; k <= glideEnd; ++k) {
                 if (pyinPitch[k] > 0.0) {
-                    f.timestamp = m_coreFeatures.timeForStep(k);
+                    f.timestamp = coreFeatures.timeForStep(k);
                     f.values.clear();
                     f.values.push_back(pyinPitch[k]);
                     f.label = "";
@@ -980,9 +995,9 @@ Portamento::getRemainingFeatures()
     
     Feature f;
     f.hasTimestamp = true;
-    f.timestamp = m_coreFeatures.getStartTime();
+    f.timestamp = coreFeatures.getStartTime();
     f.hasDuration = true;
-    f.duration = m_coreFeatures.timeForStep(pyinPitch.size()) - f.timestamp;
+    f.duration = coreFeatures.timeForStep(pyinPitch.size()) - f.timestamp;
     f.values.clear();
     {
         ostringstream os;
@@ -52,12 +52,24 @@ public:
     OutputList getOutputDescriptors() const;
 
     bool initialise(size_t channels, size_t stepSize, size_t blockSize);
+
+    /** As initialise(), but for getFeaturesFrom() only: see Combined.h */
+    bool initialiseForFeaturesFrom(size_t channels, size_t stepSize,
+                                   size_t blockSize);
     void reset();
 
     FeatureSet process(const float *const *inputBuffers,
                        Vamp::RealTime timestamp);
 
     FeatureSet getRemainingFeatures();
+
+    /** Features from a shared, finished CoreFeatures: see Combined.h */
+    FeatureSet getFeaturesFrom(const CoreFeatures &coreFeatures);
+
+    /** Parameters getFeaturesFrom() expects: see Combined.h */
+    CoreFeatures::Parameters getCoreParameters() const {
+        return m_coreParams;
+    }
     
     enum class GlideDirection {
         Ascending, Descending
@@ -201,8 +213,9 @@ public:
         double dynamicMin;
     };
 
-    GlideClassification classifyGlide(const std::pair<int, Glide::Extent> &,
-                                      const CoreFeatures::OnsetOffsetMap &onsetOffsets,
+    GlideClassification classifyGlide(const CoreFeatures &coreFeatures,
+                                      const std::pair<int, Glide::Extent> &,
+                                      const CoreFeatures::NoteTable &onsetOffsets,
                                       const std::vector<double> &pyinPitch,
                                       const std::vector<double> &smoothedPower);
     
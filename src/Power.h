@@ -14,12 +14,28 @@
 
 #include "../ext/pyin/MeanFilter.h"
 
+#include "ParallelFor.h"
+
 #include <vector>
 #include <cmath>
 #include <iostream>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
 /** Filtered power calculation, somewhat like Mazurka MzPowerCurve's
  *  smoothedpower output
+ *
+ *  The sum of squares for each block is calculated with SSE2 or AVX2
+ *  where the compiler targets them. Each square is still calculated
+ *  in single precision and accumulated in double precision, as in
+ *  the plain loop, but the order of accumulation differs, so the
+ *  results can differ from those of the plain loop by a relative
+ *  error of the order of blockSize * 2^-53 in the sum. For any
+ *  realistic block size that is less than 1e-9 dB in the result.
  */
 class Power
 {
@@ -66,15 +82,43 @@ public:
             throw std::logic_error("Power::process: Not initialised");
         }
         
-        double sum = 0.0;
-        for (size_t i = 0; i < m_blockSize; ++i) {
-            sum += input[i] * input[i];
+        m_rawPower.push_back(toDecibels(sumOfSquares(input)));
+    }
+
+    /** Process count blocks at once from a contiguous buffer, with
+     *  block i starting at input + i * stepSize. The buffer must
+     *  therefore contain at least (count - 1) * stepSize + blockSize
+     *  samples. The blocks are shared out between up to the given
+     *  number of threads. The results are the same as calling
+     *  process() for each block in turn.
+     *
+     *  Only the sums of squares are vectorised. The conversion to dB
+     *  is a separate pass over the contiguous sums, but it calls the
+     *  scalar log10 for each of them, because a vectorised log would
+     *  not give results identical to process().
+     */
+    void processBatch(const float *input, int stepSize, int count,
+                      int threads) {
+        if (!m_initialised) {
+            throw std::logic_error("Power::processBatch: Not initialised");
         }
-        if (sum < m_threshold) {
-            sum = m_threshold;
+        if (count <= 0) {
+            return;
         }
-        double dB = 10.0 * log10(sum / double(m_blockSize));
-        m_rawPower.push_back(dB);
+        
+        size_t base = m_rawPower.size();
+        m_rawPower.resize(base + count);
+        double *out = m_rawPower.data() + base;
+        
+        parallelFor(count, threads, [&](int from, int to) {
+            for (int i = from; i < to; ++i) {
+                out[i] = sumOfSquares(input + size_t(i) * stepSize);
+            }
+            // Scalar log10, see above
+            for (int i = from; i < to; ++i) {
+                out[i] = toDecibels(out[i]);
+            }
+        });
     }
 
     std::vector<double> getRawPower() const {
@@ -90,6 +134,48 @@ public:
     }
     
 private:
+    double sumOfSquares(const float *input) const {
+        size_t n = m_blockSize;
+        size_t i = 0;
+        double sum = 0.0;
+#if defined(__AVX2__)
+        __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+        for (; i + 8 <= n; i += 8) {
+            __m256 v = _mm256_loadu_ps(input + i);
+            __m256 sq = _mm256_mul_ps(v, v);
+            acc0 = _mm256_add_pd
+                (acc0, _mm256_cvtps_pd(_mm256_castps256_ps128(sq)));
+            acc1 = _mm256_add_pd
+                (acc1, _mm256_cvtps_pd(_mm256_extractf128_ps(sq, 1)));
+        }
+        double parts[4];
+        _mm256_storeu_pd(parts, _mm256_add_pd(acc0, acc1));
+        sum = (parts[0] + parts[1]) + (parts[2] + parts[3]);
+#elif defined(__SSE2__) || defined(_M_X64)
+        __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+        for (; i + 4 <= n; i += 4) {
+            __m128 v = _mm_loadu_ps(input + i);
+            __m128 sq = _mm_mul_ps(v, v);
+            acc0 = _mm_add_pd(acc0, _mm_cvtps_pd(sq));
+            acc1 = _mm_add_pd(acc1, _mm_cvtps_pd(_mm_movehl_ps(sq, sq)));
+        }
+        double parts[2];
+        _mm_storeu_pd(parts, _mm_add_pd(acc0, acc1));
+        sum = parts[0] + parts[1];
+#endif
+        for (; i < n; ++i) {
+            sum += input[i] * input[i];
+        }
+        return sum;
+    }
+
+    double toDecibels(double sum) const {
+        if (sum < m_threshold) {
+            sum = m_threshold;
+        }
+        return 10.0 * log10(sum / double(m_blockSize));
+    }
+    
     size_t m_blockSize;
     int m_filterLength;
     double m_threshold;
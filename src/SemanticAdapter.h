@@ -13,9 +13,13 @@
 
 #include <vamp-sdk/Plugin.h>
 
+#include "CoreFeatures.h"
+#include "ParallelFor.h"
+
 #include <set>
 #include <map>
 #include <vector>
+#include <memory>
 #include <cmath>
 
 //#define DEBUG_SEMANTIC_ADAPTER 1
@@ -72,7 +76,10 @@ protected:
         m_numberedOptionsParameters(numberedOptionsParameters),
         m_toggleParameters(toggleParameters),
         m_semanticParameterDefaults(parameterDefaults),
-        m_semanticParameterValues(parameterDefaults)
+        m_semanticParameterValues(parameterDefaults),
+        m_comparePresets(0.f),
+        m_channels(1),
+        m_blockSize(0)
     {
         for (auto pm : m_parameterMetadata) {
             if (m_semanticParameterValues.find(pm.first) ==
@@ -180,11 +187,33 @@ public:
                 list.push_back(d);
             }
         }
+
+        auto comparable = getComparableParameters();
+        if (!comparable.empty()) {
+            ParameterDescriptor d;
+            d.identifier = "comparePresets";
+            d.name = "Compare presets";
+            d.description = "Instead of a single analysis, carry out one for each of the choices available for the selected parameter, with all other parameters as set, and return a separate set of outputs for each. The input is only processed once for all choices that share the same feature extraction settings.";
+            d.unit = "";
+            d.minValue = 0.f;
+            d.maxValue = float(comparable.size());
+            d.defaultValue = 0.f;
+            d.isQuantized = true;
+            d.quantizeStep = 1.f;
+            d.valueNames.push_back("None");
+            for (auto id : comparable) {
+                d.valueNames.push_back(m_parameterMetadata.at(id).name);
+            }
+            list.push_back(d);
+        }
+        
         return list;
     }
     
     float getParameter(string id) const {
-        if (m_parameterMetadata.find(id) != m_parameterMetadata.end()) {
+        if (id == "comparePresets") {
+            return m_comparePresets;
+        } else if (m_parameterMetadata.find(id) != m_parameterMetadata.end()) {
             // It's a semantic parameter
             return m_semanticParameterValues.at(id);
         } else {
@@ -194,17 +223,22 @@ public:
     }
     
     void setParameter(string id, float value) {
-        if (m_parameterMetadata.find(id) != m_parameterMetadata.end()) {
+        if (id == "comparePresets") {
+            m_comparePresets = value;
+        } else if (m_parameterMetadata.find(id) != m_parameterMetadata.end()) {
             // It's a semantic parameter
             m_semanticParameterValues[id] = value;
         } else {
             // It's just passed through
             m_adapted.setParameter(id, value);
+            m_passThroughValues[id] = value;
         }
     }
 
     OutputList getOutputDescriptors() const {
-        OutputList upstream = m_adapted.getOutputDescriptors();
+        OutputList upstream = m_presets.empty() ?
+            m_adapted.getOutputDescriptors() :
+            m_presets[0].plugin->getOutputDescriptors();
         OutputList list;
         IdSet found;
         for (int i = 0; i < int(upstream.size()); ++i) {
@@ -223,12 +257,200 @@ public:
                 throw std::logic_error("Output not found upstream: " + out);
             }
         }
+
+        string compared = getComparedParameter();
+        if (compared == "") {
+            return list;
+        }
+
+        // One copy of the selected outputs for each preset, in order
+        OutputList single = list;
+        list.clear();
+        auto presets = getPresetValues(compared);
+        for (int k = 0; k < int(presets.size()); ++k) {
+            for (auto out : single) {
+                out.identifier += "-preset" + std::to_string(k + 1);
+                out.name += " (" + presets[k].first + ")";
+                list.push_back(out);
+            }
+        }
         return list;
     }
 
     bool initialise(size_t channels, size_t stepSize, size_t blockSize) {
 
-        for (auto pv : m_semanticParameterValues) {
+        m_presets.clear();
+        m_presetFeatures.clear();
+        
+        string compared = getComparedParameter();
+        if (compared == "") {
+            applySemanticParameters(m_adapted, m_semanticParameterValues);
+            if (m_adapted.initialise(channels, stepSize, blockSize)) {
+                (void)getOutputDescriptors();
+                return true;
+            } else {
+                return false;
+            }
+        }
+
+        // Each preset has its own adapted plugin, which is used for
+        // its parameters, outputs, and classification logic but is
+        // never given any input, so it needs no CoreFeatures of its
+        // own. Presets whose frame-level parameters match share a
+        // single CoreFeatures, which is all that input is fed to
+
+        for (auto pv : getPresetValues(compared)) {
+            Preset preset;
+            preset.plugin.reset(new Adapted(m_inputSampleRate));
+            for (auto ppv : m_passThroughValues) {
+                preset.plugin->setParameter(ppv.first, ppv.second);
+            }
+            ValueMap values = m_semanticParameterValues;
+            values[compared] = pv.second;
+            applySemanticParameters(*preset.plugin, values);
+            if (!preset.plugin->initialiseForFeaturesFrom
+                (channels, stepSize, blockSize)) {
+                m_presets.clear();
+                m_presetFeatures.clear();
+                return false;
+            }
+            auto params = preset.plugin->getCoreParameters();
+            preset.features = -1;
+            for (int i = 0; i < int(m_presetFeatures.size()); ++i) {
+                if (m_presetFeatures[i].parameters.hasSameFrameParameters(params)) {
+                    preset.features = i;
+                    break;
+                }
+            }
+            if (preset.features < 0) {
+                PresetFeatures pf;
+                pf.features.reset(new CoreFeatures(m_inputSampleRate));
+                try {
+                    pf.features->initialise(params);
+                } catch (const std::logic_error &e) {
+                    std::cerr << "ERROR: SemanticAdapter::initialise: Feature extractor initialisation failed: " << e.what() << std::endl;
+                    m_presets.clear();
+                    m_presetFeatures.clear();
+                    return false;
+                }
+                pf.parameters = params;
+                preset.features = int(m_presetFeatures.size());
+                m_presetFeatures.push_back(std::move(pf));
+            }
+            m_presets.push_back(std::move(preset));
+        }
+
+        m_channels = int(channels);
+        m_blockSize = int(blockSize);
+        m_mixBuffer.resize(m_blockSize);
+        
+        (void)getOutputDescriptors();
+        return true;
+    }
+    
+    void reset() {
+        if (m_presets.empty()) {
+            m_adapted.reset();
+            return;
+        }
+        for (auto &pf : m_presetFeatures) {
+            pf.features->reset();
+        }
+    }
+
+    FeatureSet process(const float *const *inputBuffers,
+                       Vamp::RealTime timestamp) {
+        if (m_presets.empty()) {
+            FeatureSet upstream = m_adapted.process(inputBuffers, timestamp);
+            return selectFeatures(upstream, 0);
+        }
+        const float *input = inputBuffers[0];
+        if (m_channels > 1) {
+            // Mix down the same way as the Vamp SDK's
+            // PluginChannelAdapter
+            for (int i = 0; i < m_blockSize; ++i) {
+                m_mixBuffer[i] = inputBuffers[0][i];
+            }
+            for (int c = 1; c < m_channels; ++c) {
+                for (int i = 0; i < m_blockSize; ++i) {
+                    m_mixBuffer[i] += inputBuffers[c][i];
+                }
+            }
+            for (int i = 0; i < m_blockSize; ++i) {
+                m_mixBuffer[i] /= float(m_channels);
+            }
+            input = m_mixBuffer.data();
+        }
+        for (auto &pf : m_presetFeatures) {
+            pf.features->process(input, timestamp);
+        }
+        return {};
+    }
+
+    FeatureSet getRemainingFeatures() {
+        if (m_presets.empty()) {
+            return selectFeatures(m_adapted.getRemainingFeatures(), 0);
+        }
+        
+        int n = int(m_presetFeatures.size());
+        parallelFor(n, n, [this](int from, int to) {
+            for (int i = from; i < to; ++i) {
+                m_presetFeatures[i].features->finish();
+            }
+        });
+
+        FeatureSet fs;
+        int outputsPerPreset = int(m_outputSelection.size());
+        for (int k = 0; k < int(m_presets.size()); ++k) {
+            auto &preset = m_presets[k];
+            auto &pf = m_presetFeatures[preset.features];
+            auto params = preset.plugin->getCoreParameters();
+            if (params != pf.parameters) {
+                pf.features->refinish(params);
+                pf.parameters = params;
+            }
+            FeatureSet upstream = preset.plugin->getFeaturesFrom(*pf.features);
+            for (auto &ff : selectFeatures(upstream, k * outputsPerPreset)) {
+                fs[ff.first] = ff.second;
+            }
+        }
+        return fs;
+    }
+
+
+protected:
+    Adapted m_adapted;
+
+    const IdSelection m_outputSelection;
+    const IdSet m_outputSet;
+    const IdSelection m_parameterSelection;
+    const ParameterMetadata m_parameterMetadata;
+    const NamedOptionsParameters m_namedOptionsParameters;
+    const NumberedOptionsParameters m_numberedOptionsParameters;
+    const ToggleParameters m_toggleParameters;
+    mutable std::map<string, int> m_outputIndicesHere;
+    mutable std::map<string, int> m_outputIndicesThere;
+    const std::map<string, float> m_semanticParameterDefaults;
+    std::map<string, float> m_semanticParameterValues;
+    std::map<string, float> m_passThroughValues;
+    float m_comparePresets;
+
+    struct Preset {
+        std::unique_ptr<Adapted> plugin;
+        int features; // index into m_presetFeatures
+    };
+    struct PresetFeatures {
+        std::unique_ptr<CoreFeatures> features;
+        CoreFeatures::Parameters parameters; // as last finished with
+    };
+    std::vector<Preset> m_presets;
+    std::vector<PresetFeatures> m_presetFeatures;
+    int m_channels;
+    int m_blockSize;
+    std::vector<float> m_mixBuffer;
+
+    void applySemanticParameters(Adapted &target, const ValueMap &values) {
+        for (auto pv : values) {
             string id = pv.first;
             int v = int(roundf(pv.second));
             if (m_namedOptionsParameters.find(id) !=
@@ -243,7 +465,7 @@ public:
                         std::cerr << "[named] " << ppv.first << " -> "
                                   << ppv.second << std::endl;
 #endif
-                        m_adapted.setParameter(ppv.first, ppv.second);
+                        target.setParameter(ppv.first, ppv.second);
                     }
                 }
             } else if (m_numberedOptionsParameters.find(id) !=
@@ -258,7 +480,7 @@ public:
                         std::cerr << "[numbered] " << ppv.first << " -> "
                                   << ppv.second << std::endl;
 #endif
-                        m_adapted.setParameter(ppv.first, ppv.second);
+                        target.setParameter(ppv.first, ppv.second);
                     }
                 }
             } else if (m_toggleParameters.find(id) !=
@@ -270,55 +492,69 @@ public:
                     std::cerr << "[toggled] " << ppv.first << " -> "
                               << value << std::endl;
 #endif
-                    m_adapted.setParameter(ppv.first, value);
+                    target.setParameter(ppv.first, value);
                 }                    
             } else {
                 throw std::logic_error("Parameter in semantic parameter values not found in named, numbered, or toggled: " + id);
             }
         }
-        
-        if (m_adapted.initialise(channels, stepSize, blockSize)) {
-            (void)getOutputDescriptors();
-            return true;
-        } else {
-            return false;
-        }
-    }
-    
-    void reset() {
-        m_adapted.reset();
     }
 
-    FeatureSet process(const float *const *inputBuffers,
-                       Vamp::RealTime timestamp) {
-        FeatureSet upstream = m_adapted.process(inputBuffers, timestamp);
-        return selectFeatures(upstream);
+    /** Return the semantic parameters that may be compared, in the
+     *  order they are listed in the "comparePresets" parameter.
+     */
+    IdSelection getComparableParameters() const {
+        IdSelection ids;
+        for (auto id : m_parameterSelection) {
+            if (m_parameterMetadata.find(id) != m_parameterMetadata.end()) {
+                ids.push_back(id);
+            }
+        }
+        return ids;
     }
 
-    FeatureSet getRemainingFeatures() {
-        return selectFeatures(m_adapted.getRemainingFeatures());
+    /** Return the semantic parameter selected for comparison, or an
+     *  empty string if we are not comparing presets.
+     */
+    string getComparedParameter() const {
+        int v = int(roundf(m_comparePresets));
+        auto comparable = getComparableParameters();
+        if (v < 1 || v > int(comparable.size())) {
+            return "";
+        }
+        return comparable[v-1];
     }
 
-protected:
-    Adapted m_adapted;
-
-    const IdSelection m_outputSelection;
-    const IdSet m_outputSet;
-    const IdSelection m_parameterSelection;
-    const ParameterMetadata m_parameterMetadata;
-    const NamedOptionsParameters m_namedOptionsParameters;
-    const NumberedOptionsParameters m_numberedOptionsParameters;
-    const ToggleParameters m_toggleParameters;
-    mutable std::map<string, int> m_outputIndicesHere;
-    mutable std::map<string, int> m_outputIndicesThere;
-    const std::map<string, float> m_semanticParameterDefaults;
-    std::map<string, float> m_semanticParameterValues;
+    /** Return a label and semantic parameter value for each of the
+     *  choices available for the given semantic parameter.
+     */
+    std::vector<std::pair<string, float>> getPresetValues(string id) const {
+        std::vector<std::pair<string, float>> presets;
+        if (m_namedOptionsParameters.find(id) !=
+            m_namedOptionsParameters.end()) {
+            const auto &options = m_namedOptionsParameters.at(id);
+            for (int i = 0; i < int(options.size()); ++i) {
+                presets.push_back({ options[i].first, float(i) });
+            }
+        } else if (m_numberedOptionsParameters.find(id) !=
+                   m_numberedOptionsParameters.end()) {
+            int n = int(m_numberedOptionsParameters.at(id).size());
+            for (int i = 1; i <= n; ++i) {
+                presets.push_back({ std::to_string(i), float(i) });
+            }
+        } else if (m_toggleParameters.find(id) !=
+                   m_toggleParameters.end()) {
+            presets.push_back({ "Off", 0.f });
+            presets.push_back({ "On", 1.f });
+        }
+        return presets;
+    }
 
-    FeatureSet selectFeatures(const FeatureSet &upstream) {
+    FeatureSet selectFeatures(const FeatureSet &upstream, int offset) {
         FeatureSet selection;
         for (auto id : m_outputSelection) {
             if (upstream.find(m_outputIndicesThere.at(id)) != upstream.end()) {
-                selection[m_outputIndicesHere.at(id)] =
+                selection[offset + m_outputIndicesHere.at(id)] =
                     upstream.at(m_outputIndicesThere.at(id));
             }
         }
@@ -17,7 +17,7 @@ SemanticPortamento::SemanticPortamento(float inputSampleRate) :
      // Output selection (to be passed through)
      { "summary", "portamentoType", "portamentoIndex", "portamentoPoints" },
      // Parameter selection (passed through, or new)
-     { "clef", "instrumentType", "noteDurations", "normaliseAudio", "pyin-precisetime"
+     { "clef", "instrumentType", "noteDurations", "normaliseAudio", "knownPeak", "pyin-precisetime"
      },
      // Parameter metadata (map)
      { { "clef",
@@ -0,0 +1,132 @@
+
+/*
+    Expressive Means
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef EXPRESSIVE_MEANS_SLIDING_MEDIAN_H
+#define EXPRESSIVE_MEANS_SLIDING_MEDIAN_H
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+/** A sliding median filter giving exactly the same output as the
+ *  qm-dsp MedianFilter<T>::filter() function, but in time that grows
+ *  only logarithmically with the filter length.
+ *
+ *  As with the qm-dsp filter, the window starts out full of zeros,
+ *  NaN inputs are treated as zeros, the output is aligned so that
+ *  each value is the median of a window centred on the corresponding
+ *  input, and the end of the input is padded with zeros.
+ *
+ *  Because the whole input is known in advance, each distinct value
+ *  can be given a rank up front, and the window is then held as a
+ *  count of the values at each rank in a Fenwick tree. Adding or
+ *  removing a value and finding the median are then each O(log n),
+ *  with everything stored in flat arrays.
+ */
+template <typename T>
+class SlidingMedian
+{
+public:
+    static std::vector<T> filter(int size, const std::vector<T> &in) {
+
+        if (size < 1) {
+            throw std::logic_error("SlidingMedian::filter: size must be > 0");
+        }
+
+        int n = int(in.size());
+
+        // Index into the sorted window, as qm-dsp calculates it for
+        // the 50th percentile
+        int index = int((size * 50.f) / 100.f);
+        if (index >= size) index = size - 1;
+        if (index < 0) index = 0;
+
+        // The inputs in the order they enter the window, followed by
+        // the zero padding. qm-dsp pads with as many zeros as it
+        // takes to make up the output length
+        int latency = std::min(n, size / 2);
+        std::vector<T> entering;
+        entering.reserve(n + latency);
+        for (int i = 0; i < n; ++i) {
+            T value = in[i];
+            if (value != value) {
+                value = T();
+            }
+            entering.push_back(value);
+        }
+        for (int i = 0; i < latency; ++i) {
+            entering.push_back(T());
+        }
+
+        std::vector<T> values(entering);
+        values.push_back(T()); // for the zeros the window starts with
+        std::sort(values.begin(), values.end());
+        values.erase(std::unique(values.begin(), values.end()), values.end());
+
+        int nvalues = int(values.size());
+
+        std::vector<int> ranks;
+        ranks.reserve(entering.size());
+        for (auto value : entering) {
+            ranks.push_back(int(std::lower_bound(values.begin(), values.end(),
+                                                 value) - values.begin()));
+        }
+        int zeroRank = int(std::lower_bound(values.begin(), values.end(), T())
+                           - values.begin());
+
+        std::vector<int> tree(nvalues + 1, 0);
+        add(tree, zeroRank, size);
+
+        int topBit = 1;
+        while (topBit * 2 <= nvalues) {
+            topBit *= 2;
+        }
+
+        std::vector<T> out;
+        out.reserve(n);
+
+        for (int i = 0; i < int(entering.size()); ++i) {
+            int leaving = (i < size ? zeroRank : ranks[i - size]);
+            add(tree, leaving, -1);
+            add(tree, ranks[i], 1);
+            if (i >= latency) {
+                out.push_back(values[findByOrder(tree, topBit, index)]);
+            }
+        }
+
+        return out;
+    }
+
+private:
+    static void add(std::vector<int> &tree, int rank, int count) {
+        for (int i = rank + 1; i < int(tree.size()); i += (i & (-i))) {
+            tree[i] += count;
+        }
+    }
+
+    // Return the rank of the value at the given (zero-based) position
+    // in sorted order among those counted in the tree
+    static int findByOrder(const std::vector<int> &tree, int topBit,
+                           int position) {
+        int pos = 0;
+        int remaining = position;
+        for (int bit = topBit; bit > 0; bit /= 2) {
+            int next = pos + bit;
+            if (next < int(tree.size()) && tree[next] <= remaining) {
+                pos = next;
+                remaining -= tree[next];
+            }
+        }
+        return pos;
+    }
+};
+
+#endif
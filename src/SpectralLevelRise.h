@@ -14,12 +14,16 @@
 
 #include <vamp-sdk/FFT.h>
 
+#include "BinSets.h"
+#include "ParallelFor.h"
+
 #include <vector>
 #include <cmath>
 #include <iostream>
-#include <deque>
+#include <algorithm>
 #include <array>
 #include <map>
+#include <memory>
 
 /** Calculate and return the fraction of spectral bins in a given
  *  frequency range whose magnitudes have risen by more than the given
@@ -126,13 +130,29 @@ public:
         m_noiseFloor_mag = pow(10.0, m_parameters.noiseFloor_dB / 20.0);
         m_offset_mag = pow(10.0, m_parameters.offset_dB / 20.0);
 
+        m_binsAboveNoiseFloor = BinSets(m_binmin, getBinCount());
+        m_binsAboveOffset = BinSets(m_binmin, getBinCount());
+
+        int n = getBinCount();
+        int h = m_parameters.historyLength;
+        m_magHistory = std::vector<double>(size_t(n) * h, 0.0);
+        m_maxQueues = std::vector<int>(size_t(n) * h, 0);
+        m_maxQueueStarts = std::vector<int>(n, 0);
+        m_maxQueueSizes = std::vector<int>(n, 0);
+        m_stepCount = 0;
+
         // Hann window
+        m_window.clear();
         m_window.reserve(m_parameters.blockSize);
         for (int i = 0; i < m_parameters.blockSize; ++i) {
             m_window.push_back(0.5 - 0.5 * cos((2.0 * M_PI * i) /
                                                m_parameters.blockSize));
         }
 
+        m_fft = std::make_unique<Vamp::FFTReal>(m_parameters.blockSize);
+        m_windowed = std::vector<double>(m_parameters.blockSize, 0.0);
+        m_spectrum = std::vector<double>(m_parameters.blockSize + 2, 0.0);
+
         m_initialised = true;
     }
 
@@ -141,50 +161,76 @@ public:
             throw std::logic_error("SpectralLevelRise::reset: Never initialised");
         }
 
-        m_magHistory.clear();
+        std::fill(m_maxQueueSizes.begin(), m_maxQueueSizes.end(), 0);
+        m_stepCount = 0;
         m_fractions.clear();
+        m_binsAboveNoiseFloor.clear();
+        m_binsAboveOffset.clear();
     }
     
     void process(const float *timeDomain) {
         if (!m_initialised) {
             throw std::logic_error("SpectralLevelRise::process: Not initialised");
         }
-        
-        std::vector<double> windowed;
-        windowed.reserve(m_parameters.blockSize);
-        for (int i = 0; i < m_parameters.blockSize; ++i) {
-            windowed.push_back(m_window[i] * timeDomain[i]);
-        }
 
-        // No fftshift; we don't use phase
-        std::vector<double> ro(m_parameters.blockSize, 0.0);
-        std::vector<double> io(m_parameters.blockSize, 0.0);
-        Vamp::FFT::forward(m_parameters.blockSize,
-                           windowed.data(), nullptr,
-                           ro.data(), io.data());
+        int step = m_binsAboveNoiseFloor.appendStep();
+        m_binsAboveOffset.appendStep();
+
+        calculateMagnitudes(timeDomain, *m_fft, m_windowed.data(),
+                            m_spectrum.data(), historyAt(m_stepCount), step);
+        advanceHistory();
+    }
 
+    /** Process count blocks at once from a contiguous buffer, with
+     *  block i starting at input + i * stepSize. The spectra, which
+     *  are independent of one another, are calculated using up to the
+     *  given number of threads; the rise fractions are then
+     *  calculated from them serially. The results are identical to
+     *  those from calling process() for each block in turn.
+     */
+    void processBatch(const float *input, int stepSize, int count,
+                      int threads) {
+        if (!m_initialised) {
+            throw std::logic_error("SpectralLevelRise::processBatch: Not initialised");
+        }
+
+        // Work through in chunks to bound the memory needed for the
+        // magnitudes waiting to go into the history
+        const int chunkSize = 4096;
+        int n = getBinCount();
+        int bs = m_parameters.blockSize;
         std::vector<double> magnitudes;
-        std::vector<int> aboveNoiseFloor, aboveOffset;
-        for (int i = m_binmin; i <= m_binmax; ++i) {
-            double mag = sqrt(ro[i] * ro[i] + io[i] * io[i]);
-            mag /= double(m_parameters.blockSize);
-            magnitudes.push_back(mag);
-            if (mag > m_noiseFloor_mag) {
-                aboveNoiseFloor.push_back(i);
-            }
-            if (mag > m_offset_mag) {
-                aboveOffset.push_back(i);
+        
+        for (int chunkStart = 0; chunkStart < count; chunkStart += chunkSize) {
+
+            int chunkCount = std::min(chunkSize, count - chunkStart);
+            int firstStep = m_binsAboveNoiseFloor.getStepCount();
+            for (int i = 0; i < chunkCount; ++i) {
+                m_binsAboveNoiseFloor.appendStep();
+                m_binsAboveOffset.appendStep();
             }
-        }
+            magnitudes.resize(size_t(chunkCount) * n);
 
-        m_binsAboveNoiseFloor.push_back(aboveNoiseFloor);
-        m_binsAboveOffset.push_back(aboveOffset);
-        m_magHistory.push_back(magnitudes);
+            // Each step has its own words in the bin sets, so the
+            // threads can safely add to them concurrently
+            parallelFor(chunkCount, threads, [&](int from, int to) {
+                Vamp::FFTReal fft(bs);
+                std::vector<double> windowed(bs, 0.0);
+                std::vector<double> spectrum(bs + 2, 0.0);
+                for (int i = from; i < to; ++i) {
+                    calculateMagnitudes
+                        (input + size_t(chunkStart + i) * stepSize,
+                         fft, windowed.data(), spectrum.data(),
+                         magnitudes.data() + size_t(i) * n,
+                         firstStep + i);
+                }
+            });
 
-        if (int(m_magHistory.size()) >= m_parameters.historyLength) {
-            double fraction = extractFraction();
-            m_fractions.push_back(fraction);
-            m_magHistory.pop_front();
+            for (int i = 0; i < chunkCount; ++i) {
+                const double *m = magnitudes.data() + size_t(i) * n;
+                std::copy(m, m + n, historyAt(m_stepCount));
+                advanceHistory();
+            }
         }
     }
 
@@ -200,20 +246,20 @@ public:
         return m_fractions;
     }
     
+    const BinSets &getBinsAboveNoiseFloor() const {
+        return m_binsAboveNoiseFloor;
+    }
+    
+    const BinSets &getBinsAboveOffset() const {
+        return m_binsAboveOffset;
+    }
+    
     std::vector<int> getBinsAboveNoiseFloorAt(int step) const {
-        if (step < int(m_binsAboveNoiseFloor.size())) {
-            return m_binsAboveNoiseFloor.at(step);
-        } else {
-            return {};
-        }
+        return m_binsAboveNoiseFloor.getBinsAt(step);
     }
     
     std::vector<int> getBinsAboveOffsetAt(int step) const {
-        if (step < int(m_binsAboveOffset.size())) {
-            return m_binsAboveOffset.at(step);
-        } else {
-            return {};
-        }
+        return m_binsAboveOffset.getBinsAt(step);
     }
 
 private:
@@ -225,28 +271,131 @@ private:
     double m_offset_mag;
     bool m_initialised;
     std::vector<float> m_window;
-    std::deque<std::vector<double>> m_magHistory;
+    std::unique_ptr<Vamp::FFTReal> m_fft;
+    std::vector<double> m_windowed;
+    std::vector<double> m_spectrum;
     std::vector<double> m_fractions;
-    std::vector<std::vector<int>> m_binsAboveNoiseFloor;
-    std::vector<std::vector<int>> m_binsAboveOffset;
 
-    double extractFraction() const {
+    // Magnitudes of the most recent historyLength steps, bin-major
+    // within each step, indexed by step number modulo historyLength
+    std::vector<double> m_magHistory;
+
+    // For each bin, a queue of step numbers (a circular buffer of up
+    // to historyLength entries, starting at m_maxQueueStarts[bin])
+    // whose magnitudes are in decreasing order, so that the first is
+    // the step with the greatest magnitude in the current window
+    std::vector<int> m_maxQueues;
+    std::vector<int> m_maxQueueStarts;
+    std::vector<int> m_maxQueueSizes;
+    int m_stepCount;
+    BinSets m_binsAboveNoiseFloor;
+    BinSets m_binsAboveOffset;
+
+    void calculateMagnitudes(const float *timeDomain,
+                             Vamp::FFTReal &fft,
+                             double *windowed,
+                             double *spectrum,
+                             double *magnitudes,
+                             int step) {
+        
+        for (int i = 0; i < m_parameters.blockSize; ++i) {
+            windowed[i] = m_window[i] * timeDomain[i];
+        }
+
+        // No fftshift; we don't use phase. The output is interleaved
+        // real and imaginary parts for bins 0 to blockSize/2
+        fft.forward(windowed, spectrum);
+
+        for (int i = m_binmin; i <= m_binmax; ++i) {
+            double re = spectrum[i * 2], im = spectrum[i * 2 + 1];
+            double mag = sqrt(re * re + im * im);
+            mag /= double(m_parameters.blockSize);
+            magnitudes[i - m_binmin] = mag;
+            if (mag > m_noiseFloor_mag) {
+                m_binsAboveNoiseFloor.add(step, i);
+            }
+            if (mag > m_offset_mag) {
+                m_binsAboveOffset.add(step, i);
+            }
+        }
+    }
+
+    // Called once the magnitudes for the current step are in the
+    // history
+    void advanceHistory() {
+        
+        // The rise test for the history ending at this step looks at
+        // the steps after the first and before the last, so the
+        // previous step is the one that now enters the window
+        if (m_stepCount > 0) {
+            updateMaxQueues(m_stepCount - 1,
+                            m_stepCount - m_parameters.historyLength + 2);
+        }
+        
+        if (m_stepCount + 1 >= m_parameters.historyLength) {
+            double fraction = extractFraction(getBinCount());
+            m_fractions.push_back(fraction);
+        }
+
+        ++m_stepCount;
+    }
+
+    double *historyAt(int step) {
+        return m_magHistory.data() +
+            size_t(step % m_parameters.historyLength) * getBinCount();
+    }
+
+    const double *historyAt(int step) const {
+        return m_magHistory.data() +
+            size_t(step % m_parameters.historyLength) * getBinCount();
+    }
+
+    void updateMaxQueues(int enteringStep, int firstStepInWindow) {
+        int n = getBinCount();
+        int h = m_parameters.historyLength;
+        const double *entering = historyAt(enteringStep);
+        for (int i = 0; i < n; ++i) {
+            int *queue = m_maxQueues.data() + size_t(i) * h;
+            int &start = m_maxQueueStarts[i];
+            int &size = m_maxQueueSizes[i];
+            while (size > 0 && queue[start] < firstStepInWindow) {
+                start = (start + 1) % h;
+                --size;
+            }
+            double mag = entering[i];
+            if (std::isnan(mag)) {
+                // Can never pass the rise test, so can never be the
+                // maximum we are interested in
+                continue;
+            }
+            while (size > 0 &&
+                   historyAt(queue[(start + size - 1) % h])[i] <= mag) {
+                --size;
+            }
+            queue[(start + size) % h] = enteringStep;
+            ++size;
+        }
+    }
+
+    double extractFraction(int n) const {
         // If, for a given bin i, there is a value anywhere in the
-        // magnitude history (m_magHistory[j][i] for some j > 0) that
-        // exceeds that at the start of the magnitude history
-        // (m_magHistory[0][i]) by the required ratio, then we count
-        // that bin toward the total. This may be open to adjustment
-        int n = m_binmax - m_binmin + 1;
-        int m = m_magHistory.size() - 1;
-        if (m < 2) return 0.0;
+        // magnitude history after the first and before the last step
+        // that exceeds that at the start of the history by the
+        // required ratio, and also exceeds the noise floor, then we
+        // count that bin toward the total. This may be open to
+        // adjustment. The max queues hold the largest such value, so
+        // this is a single comparison per bin
+        int h = m_parameters.historyLength;
+        if (h < 3) return 0.0;
+        const double *first = historyAt(m_stepCount - h + 1);
         int above = 0;
         for (int i = 0; i < n; ++i) {
-            for (int j = 1; j < m; ++j) {
-                if (m_magHistory[j][i] > m_magHistory[0][i] * m_rise_ratio &&
-                    m_magHistory[j][i] > m_noiseFloor_mag) {
-                    ++above;
-                    break;
-                }
+            if (m_maxQueueSizes[i] == 0) continue;
+            const int *queue = m_maxQueues.data() + size_t(i) * h;
+            double max = historyAt(queue[m_maxQueueStarts[i]])[i];
+            if (max > first[i] * m_rise_ratio &&
+                max > m_noiseFloor_mag) {
+                ++above;
             }
         }
         return double(above) / double(n);
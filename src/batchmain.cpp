@@ -0,0 +1,171 @@
+
+/*
+    Expressive Means
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "BatchAnalyser.h"
+#include "ParallelFor.h"
+
+#include <iostream>
+#include <fstream>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+static void
+usage(string program)
+{
+    cerr << "Usage: " << program << " [options] -d <transform> [-d <transform> ...] <audiofile> ...\n"
+         << "\n"
+         << "Run Expressive Means analyses over a list of audio files, writing\n"
+         << "CSV output in the same form as sonic-annotator's.\n"
+         << "\n"
+         << "Options:\n"
+         << "  -d, --default <transform>  Run the given plugin output with default\n"
+         << "                             parameters. The transform may be given as\n"
+         << "                             plugin:output or as the full\n"
+         << "                             vamp:expressive-means:plugin:output\n"
+         << "  -j, --threads <n>          Analyse up to n files at once (default is\n"
+         << "                             the number of hardware threads)\n"
+         << "  --csv-basedir <dir>        Write CSV files into <dir> instead of\n"
+         << "                             alongside the audio files\n"
+         << "  --csv-stdout               Write all CSV to standard output, in the\n"
+         << "                             order the audio files were given\n"
+         << "  --csv-omit-filename        With --csv-stdout, omit the file name column\n"
+         << "  -h, --help                 Show this help\n"
+         << "\n"
+         << "Plugins available:";
+    for (auto id: BatchAnalyser::getPluginIdentifiers()) {
+        cerr << " " << id;
+    }
+    cerr << endl;
+}
+
+int
+main(int argc, char **argv)
+{
+    string program = argv[0];
+
+    vector<BatchAnalyser::Transform> transforms;
+    vector<string> files;
+    int threads = getParallelThreadCount();
+    string baseDir;
+    bool toStdout = false;
+    bool omitFilename = false;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            string arg = argv[i];
+            bool hasNext = (i + 1 < argc);
+            if (arg == "-h" || arg == "--help") {
+                usage(program);
+                return 0;
+            } else if ((arg == "-d" || arg == "--default") && hasNext) {
+                transforms.push_back(BatchAnalyser::parseTransform(argv[++i]));
+            } else if ((arg == "-j" || arg == "--threads") && hasNext) {
+                threads = std::stoi(argv[++i]);
+                if (threads < 1) {
+                    throw std::invalid_argument("Thread count must be at least 1");
+                }
+            } else if (arg == "--csv-basedir" && hasNext) {
+                baseDir = argv[++i];
+            } else if (arg == "--csv-stdout") {
+                toStdout = true;
+            } else if (arg == "--csv-omit-filename") {
+                omitFilename = true;
+            } else if (arg != "" && arg[0] == '-') {
+                cerr << "ERROR: Unknown or incomplete option " << arg << endl;
+                usage(program);
+                return 2;
+            } else {
+                files.push_back(arg);
+            }
+        }
+    } catch (const std::exception &e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return 2;
+    }
+
+    if (transforms.empty() || files.empty()) {
+        usage(program);
+        return 2;
+    }
+
+    std::unique_ptr<BatchAnalyser> analyser;
+    try {
+        analyser.reset(new BatchAnalyser(transforms));
+    } catch (const std::exception &e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return 2;
+    }
+
+    // Workers take files from a shared counter rather than fixed
+    // ranges, as files may differ greatly in length. Results for
+    // standard output are held until all earlier files are printed.
+    int n = int(files.size());
+    std::atomic<int> next(0);
+    std::atomic<int> failures(0);
+    std::mutex outputMutex;
+    vector<vector<string>> pending(n);
+    vector<bool> done(n, false);
+    int nextToPrint = 0;
+
+    parallelFor(threads, threads, [&](int, int) {
+        int i;
+        while ((i = next++) < n) {
+            vector<string> results;
+            bool failed = false;
+            try {
+                results = analyser->analyseFile
+                    (files[i], toStdout && !omitFilename);
+                if (!toStdout) {
+                    for (int t = 0; t < int(results.size()); ++t) {
+                        string name = analyser->getOutputFileName
+                            (files[i], t, baseDir);
+                        std::ofstream out(name, std::ios::binary);
+                        out << results[t];
+                        if (!out) {
+                            throw std::runtime_error
+                                ("Failed to write output file " + name);
+                        }
+                    }
+                }
+            } catch (const std::exception &e) {
+                std::lock_guard<std::mutex> guard(outputMutex);
+                cerr << "ERROR: " << files[i] << ": " << e.what() << endl;
+                ++failures;
+                failed = true;
+            }
+            std::lock_guard<std::mutex> guard(outputMutex);
+            if (!failed) {
+                cerr << "Analysed " << files[i] << endl;
+            }
+            if (toStdout) {
+                pending[i] = results;
+                done[i] = true;
+                while (nextToPrint < n && done[nextToPrint]) {
+                    for (const auto &r: pending[nextToPrint]) {
+                        cout << r;
+                    }
+                    cout.flush();
+                    pending[nextToPrint].clear();
+                    ++nextToPrint;
+                }
+            }
+        }
+    });
+
+    return failures > 0 ? 1 : 0;
+}
@@ -17,6 +17,7 @@
 #include "Articulation.h"
 #include "PitchVibrato.h"
 #include "Portamento.h"
+#include "Combined.h"
 
 #include "SemanticOnsets.h"
 #include "SemanticArticulation.h"
@@ -27,6 +28,7 @@ static Vamp::PluginAdapter<Onsets> onsetsPluginAdapter;
 static Vamp::PluginAdapter<Articulation> articulationPluginAdapter;
 static Vamp::PluginAdapter<PitchVibrato> pitchVibratoPluginAdapter;
 static Vamp::PluginAdapter<Portamento> portamentoPluginAdapter;
+static Vamp::PluginAdapter<Combined> combinedPluginAdapter;
 
 static Vamp::PluginAdapter<SemanticOnsets> semanticOnsetsPluginAdapter;
 static Vamp::PluginAdapter<SemanticArticulation> semanticArticulationPluginAdapter;
@@ -47,6 +49,7 @@ vampGetPluginDescriptor(unsigned int version, unsigned int index)
     case  5: return articulationPluginAdapter.getDescriptor();
     case  6: return pitchVibratoPluginAdapter.getDescriptor();
     case  7: return portamentoPluginAdapter.getDescriptor();
+    case  8: return combinedPluginAdapter.getDescriptor();
     default: return 0;
     }
 }
@@ -14,6 +14,10 @@
 #include "../src/Articulation.h"
 
 #include <iostream>
+#include <random>
+#include <cmath>
+
+using std::vector;
 
 std::ostream &operator<<(std::ostream &os, Articulation::LevelDevelopment ld)
 {
@@ -21,6 +25,62 @@ std::ostream &operator<<(std::ostream &os, Articulation::LevelDevelopment ld)
     return os;
 }
 
+static int testSignalRate = 44100;
+
+static
+vector<float>
+makeManyNotes(int noteCount)
+{
+    // Notes of various pitches, lengths and envelopes, some starting
+    // with a burst of noise, separated by short silences
+
+    int rate = testSignalRate;
+    std::mt19937 rng(17);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+    
+    vector<float> signal(rate / 4, 0.f);
+
+    for (int n = 0; n < noteCount; ++n) {
+        float freq = 196.f * powf(2.f, float(n % 12) / 12.f);
+        int length = int(rate * (0.25f + 0.25f * unit(rng)));
+        float growth = 2.f * unit(rng) - 1.f;
+        int noiseLength = (n % 3 == 0 ? 0 : int(rate * 0.01f * (n % 3)));
+        float arg = 0.f;
+        for (int i = 0; i < length; ++i) {
+            float t = float(i) / length;
+            float mag = 0.3f * (1.f + growth * t) * std::min(1.f, 50.f * t);
+            arg += 2.f * float(M_PI) * freq / float(rate);
+            float x = 0.f;
+            for (int h = 1; h <= 4; ++h) {
+                x += (mag / h) * sinf(arg * h);
+            }
+            if (i < noiseLength) {
+                x += 0.3f * (2.f * unit(rng) - 1.f);
+            }
+            signal.push_back(x);
+        }
+        signal.resize(signal.size() + rate / 10, 0.f);
+    }
+
+    signal.resize(signal.size() + rate / 4, 0.f);
+    return signal;
+}
+
+static
+Vamp::Plugin::FeatureSet
+run(Vamp::Plugin &plugin, const vector<float> &signal)
+{
+    int blockSize = plugin.getPreferredBlockSize();
+    int stepSize = plugin.getPreferredStepSize();
+    BOOST_REQUIRE(plugin.initialise(1, stepSize, blockSize));
+    for (int i = 0; i + blockSize <= int(signal.size()); i += stepSize) {
+        const float *block = signal.data() + i;
+        plugin.process(&block, Vamp::RealTime::frame2RealTime
+                       (i, testSignalRate));
+    }
+    return plugin.getRemainingFeatures();
+}
+
 BOOST_AUTO_TEST_SUITE(TestArticulation)
 
 BOOST_AUTO_TEST_CASE(volumeDevelopment)
@@ -90,4 +150,45 @@ BOOST_AUTO_TEST_CASE(volumeDevelopment)
                 == Articulation::LevelDevelopment::Other);
 }
 
+BOOST_AUTO_TEST_CASE(threadedNotes)
+{
+    // With a few dozen notes the classification would normally run
+    // on one thread. Forcing several should make no difference to any
+    // output, including the means summed across notes
+    
+    auto signal = makeManyNotes(24);
+
+    Articulation serial(testSignalRate);
+    auto expected = run(serial, signal);
+
+    Articulation threaded(testSignalRate);
+    threaded.setNoteThreadCount(4);
+    auto actual = run(threaded, signal);
+
+    auto outputs = serial.getOutputDescriptors();
+    int noiseTypeOutput = -1;
+    for (int i = 0; i < int(outputs.size()); ++i) {
+        if (outputs[i].identifier == "noiseType") {
+            noiseTypeOutput = i;
+        }
+    }
+    BOOST_REQUIRE(noiseTypeOutput >= 0);
+    BOOST_CHECK_GE(expected[noiseTypeOutput].size(), 16);
+
+    BOOST_CHECK_EQUAL(actual.size(), expected.size());
+    for (const auto &ff : expected) {
+        BOOST_TEST_CONTEXT("output " << outputs[ff.first].identifier) {
+            BOOST_REQUIRE(actual.find(ff.first) != actual.end());
+            const auto &af = actual.at(ff.first);
+            BOOST_REQUIRE_EQUAL(af.size(), ff.second.size());
+            for (int i = 0; i < int(af.size()); ++i) {
+                BOOST_CHECK_EQUAL(af[i].timestamp, ff.second[i].timestamp);
+                BOOST_CHECK_EQUAL(af[i].duration, ff.second[i].duration);
+                BOOST_CHECK_EQUAL(af[i].label, ff.second[i].label);
+                BOOST_CHECK(af[i].values == ff.second[i].values);
+            }
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,398 @@
+/*
+    Expressive Means Batch Analyser
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include <boost/test/unit_test.hpp>
+
+#include "../src/BatchAnalyser.h"
+#include "../src/Onsets.h"
+#include "../src/PitchVibrato.h"
+
+#include "bqaudiostream/AudioReadStream.h"
+#include "bqaudiostream/AudioReadStreamFactory.h"
+#include "bqaudiostream/AudioWriteStream.h"
+#include "bqaudiostream/AudioWriteStreamFactory.h"
+
+#include <sstream>
+#include <stdexcept>
+#include <filesystem>
+#include <memory>
+#include <cmath>
+
+using std::string;
+using std::vector;
+
+BOOST_AUTO_TEST_SUITE(TestBatchAnalyser)
+
+static
+string
+written(const Vamp::Plugin::Feature &f, Vamp::RealTime t)
+{
+    std::ostringstream out;
+    BatchAnalyser::writeFeature(out, f, t);
+    return out.str();
+}
+
+BOOST_AUTO_TEST_CASE(writeFeature)
+{
+    // Expected lines are as written by sonic-annotator's CSV writer
+    // for the same features
+
+    Vamp::Plugin::Feature f;
+    f.label = "Spectral Rise";
+    BOOST_CHECK_EQUAL(written(f, Vamp::RealTime::fromSeconds(1.985306122)),
+                      "1.985306122,\"Spectral Rise\"\n");
+
+    f = {};
+    f.values = { 0.5f, 60.25f, 1.0e-5f, 123456789.f, -3.f };
+    BOOST_CHECK_EQUAL(written(f, Vamp::RealTime::zeroTime),
+                      "0.000000000,0.5,60.25,1e-05,1.23457e+08,-3\n");
+
+    f = {};
+    f.hasDuration = true;
+    f.duration = Vamp::RealTime(0, 250000000);
+    f.values = { 2.f };
+    f.label = "He said \"legato\", twice";
+    BOOST_CHECK_EQUAL(written(f, Vamp::RealTime(12, 5)),
+                      "12.000000005,0.250000000,2,\"He said \"\"legato\"\", twice\"\n");
+
+    f = {};
+    BOOST_CHECK_EQUAL(written(f, Vamp::RealTime(0, -500000000)),
+                      "-0.500000000\n");
+}
+
+BOOST_AUTO_TEST_CASE(parseTransform)
+{
+    auto t = BatchAnalyser::parseTransform("onsets:durations");
+    BOOST_CHECK_EQUAL(t.plugin, "onsets");
+    BOOST_CHECK_EQUAL(t.output, "durations");
+
+    t = BatchAnalyser::parseTransform
+        ("vamp:expressive-means:pitch-vibrato:summary");
+    BOOST_CHECK_EQUAL(t.plugin, "pitch-vibrato");
+    BOOST_CHECK_EQUAL(t.output, "summary");
+
+    for (string bad : { "", "onsets", "onsets:", ":onsets",
+                        "onsets:onsets:onsets",
+                        "vamp:other-library:onsets:onsets",
+                        "vamp:expressive-means:onsets" }) {
+        BOOST_TEST_CONTEXT("transform \"" << bad << "\"") {
+            BOOST_CHECK_THROW(BatchAnalyser::parseTransform(bad),
+                              std::invalid_argument);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(getOutputFileName)
+{
+    BatchAnalyser analyser
+        ({ BatchAnalyser::parseTransform("onsets:onsets"),
+           BatchAnalyser::parseTransform("portamento:summary") });
+
+    std::filesystem::path audio =
+        std::filesystem::path("recordings") / "take 1.wav";
+
+    BOOST_CHECK_EQUAL
+        (analyser.getOutputFileName(audio.string(), 0, ""),
+         (std::filesystem::path("recordings") /
+          "take 1_vamp_expressive-means_onsets_onsets.csv").string());
+
+    BOOST_CHECK_EQUAL
+        (analyser.getOutputFileName(audio.string(), 1, "out"),
+         (std::filesystem::path("out") /
+          "take 1_vamp_expressive-means_portamento_summary.csv").string());
+
+    BOOST_CHECK_THROW(analyser.getOutputFileName(audio.string(), 2, ""),
+                      std::logic_error);
+
+    BOOST_CHECK_THROW(BatchAnalyser
+                      ({ BatchAnalyser::parseTransform("no-such-plugin:onsets") }),
+                      std::invalid_argument);
+    BOOST_CHECK_THROW(BatchAnalyser
+                      ({ BatchAnalyser::parseTransform("onsets:no-such-output") }),
+                      std::invalid_argument);
+}
+
+// A plugin that reports exactly what it was fed, without timestamps:
+// on "blocks", one feature per block with the block's sum and its
+// first and last samples, and the block count at the end; on "fixed",
+// a feature every tenth block and one at the end, at a fixed rate
+class ProbePlugin : public Vamp::Plugin
+{
+public:
+    ProbePlugin(float rate) : Plugin(rate) { }
+
+    string getIdentifier() const override { return "probe"; }
+    string getName() const override { return "Probe"; }
+    string getDescription() const override { return ""; }
+    string getMaker() const override { return ""; }
+    string getCopyright() const override { return ""; }
+    int getPluginVersion() const override { return 1; }
+    InputDomain getInputDomain() const override { return TimeDomain; }
+    size_t getPreferredStepSize() const override { return 512; }
+    size_t getPreferredBlockSize() const override { return 2048; }
+
+    bool initialise(size_t channels, size_t, size_t block) override {
+        m_block = block;
+        m_count = 0;
+        return channels == 1;
+    }
+    
+    void reset() override {
+        m_count = 0;
+    }
+
+    OutputList getOutputDescriptors() const override {
+        OutputList list;
+        OutputDescriptor d;
+        d.identifier = "blocks";
+        d.hasFixedBinCount = true;
+        d.binCount = 3;
+        d.sampleType = OutputDescriptor::OneSamplePerStep;
+        list.push_back(d);
+        d.identifier = "fixed";
+        d.binCount = 1;
+        d.sampleType = OutputDescriptor::FixedSampleRate;
+        d.sampleRate = 10.f;
+        list.push_back(d);
+        return list;
+    }
+
+    FeatureSet process(const float *const *buffers, Vamp::RealTime) override {
+        FeatureSet fs;
+        Feature f;
+        float sum = 0.f;
+        for (size_t i = 0; i < m_block; ++i) {
+            sum += buffers[0][i];
+        }
+        f.values = { sum, buffers[0][0], buffers[0][m_block - 1] };
+        fs[0].push_back(f);
+        if (++m_count % 10 == 0) {
+            f.values = { float(m_count) };
+            fs[1].push_back(f);
+        }
+        return fs;
+    }
+
+    FeatureSet getRemainingFeatures() override {
+        FeatureSet fs;
+        Feature f;
+        f.values = { float(m_count), 0.f, 0.f };
+        fs[0].push_back(f);
+        f.values = { float(m_count) };
+        fs[1].push_back(f);
+        return fs;
+    }
+
+private:
+    size_t m_block = 0;
+    int m_count = 0;
+};
+
+// Run a plugin over the whole of the given mono input at once, fed
+// the way BatchAnalyser should feed it: zero-padded to a whole number
+// of blocks, then every block that fits within that, then one further
+// zero-padded block if any input is left. Return the CSV for each
+// feature on the output with the given identifier
+static
+vector<string>
+runDirectly(Vamp::Plugin &plugin, string outputId, const vector<float> &mono,
+            int rate)
+{
+    size_t step = plugin.getPreferredStepSize();
+    size_t block = plugin.getPreferredBlockSize();
+    BOOST_REQUIRE(plugin.initialise(1, step, block));
+
+    int output = -1;
+    auto outputs = plugin.getOutputDescriptors();
+    for (int i = 0; i < int(outputs.size()); ++i) {
+        if (outputs[i].identifier == outputId) output = i;
+    }
+    BOOST_REQUIRE(output >= 0);
+    auto od = outputs[output];
+
+    vector<string> features;
+    bool haveLast = false;
+    Vamp::RealTime last;
+    auto write = [&](const Vamp::Plugin::FeatureSet &fs,
+                     Vamp::RealTime blockTime) {
+        if (fs.find(output) == fs.end()) return;
+        for (const auto &f : fs.at(output)) {
+            Vamp::RealTime t = blockTime;
+            if (f.hasTimestamp) {
+                t = f.timestamp;
+            } else if (od.sampleType ==
+                       Vamp::Plugin::OutputDescriptor::FixedSampleRate) {
+                t = haveLast ?
+                    last + Vamp::RealTime::fromSeconds(1.0 / od.sampleRate) :
+                    Vamp::RealTime::zeroTime;
+            }
+            last = t;
+            haveLast = true;
+            std::ostringstream out;
+            BatchAnalyser::writeFeature(out, f, t);
+            features.push_back(out.str());
+        }
+    };
+    
+    size_t padded = ((mono.size() + block - 1) / block) * block;
+    auto feed = [&](size_t start) {
+        vector<float> buffer(block, 0.f);
+        for (size_t i = 0; i < block && start + i < mono.size(); ++i) {
+            buffer[i] = mono[start + i];
+        }
+        const float *buffers[] = { buffer.data() };
+        auto t = Vamp::RealTime::frame2RealTime(long(start), (unsigned int)rate);
+        write(plugin.process(buffers, t), t);
+    };
+    
+    size_t start = 0;
+    while (start + block <= padded) {
+        feed(start);
+        start += step;
+    }
+    if (start < padded) {
+        feed(start);
+    }
+    write(plugin.getRemainingFeatures(),
+          Vamp::RealTime::frame2RealTime(long(start), (unsigned int)rate));
+    return features;
+}
+
+BOOST_AUTO_TEST_CASE(analyseFile)
+{
+    // A stereo file of a few seconds, so more than one chunk is read,
+    // with a different note in each channel so that the mixdown
+    // matters, and a length that is not a whole number of blocks
+    
+    int rate = 44100;
+    int channels = 2;
+    int frames = rate * 3 + 1234;
+    vector<float> interleaved(size_t(frames) * channels, 0.f);
+    for (int i = 0; i < frames; ++i) {
+        float t = float(i) / float(rate);
+        float env = (t > 0.5f && t < 2.5f) ? 0.4f : 0.f;
+        interleaved[i * 2] = env * sinf(2.f * float(M_PI) * 220.f * t);
+        if (t > 1.2f) {
+            interleaved[i * 2 + 1] = env * 0.5f *
+                sinf(2.f * float(M_PI) * 277.f * t);
+        }
+    }
+
+    std::filesystem::path path =
+        std::filesystem::temp_directory_path() /
+        "expressive-means-analyseFile.wav";
+    struct Remover {
+        std::filesystem::path path;
+        ~Remover() {
+            std::error_code ec;
+            std::filesystem::remove(path, ec);
+        }
+    } remover { path };
+
+    {
+        std::unique_ptr<breakfastquay::AudioWriteStream> writer
+            (breakfastquay::AudioWriteStreamFactory::createWriteStream
+             (path.string(), channels, rate));
+        BOOST_REQUIRE(writer);
+        writer->putInterleavedFrames(frames, interleaved.data());
+    }
+
+    // What the analyser should be fed is what it reads back, which
+    // may not be exactly what we wrote if the file format is not float
+    vector<float> mono;
+    {
+        std::unique_ptr<breakfastquay::AudioReadStream> reader
+            (breakfastquay::AudioReadStreamFactory::createReadStream
+             (path.string()));
+        BOOST_REQUIRE(reader);
+        BOOST_REQUIRE_EQUAL(int(reader->getChannelCount()), channels);
+        vector<float> readBack(size_t(frames) * channels);
+        size_t got = reader->getInterleavedFrames(frames, readBack.data());
+        BOOST_REQUIRE_EQUAL(int(got), frames);
+        for (int i = 0; i < frames; ++i) {
+            float sum = 0.f;
+            for (int c = 0; c < channels; ++c) {
+                sum += readBack[i * channels + c];
+            }
+            mono.push_back(sum / float(channels));
+        }
+    }
+
+    // Plugins are constructed through our own factories so that the
+    // probe can be included alongside the real ones
+    auto factory = [](auto make) -> BatchAnalyser::Factory {
+        return [make](float r) -> std::unique_ptr<Vamp::Plugin> {
+            return std::unique_ptr<Vamp::Plugin>(make(r));
+        };
+    };
+    BatchAnalyser analyser
+        ({ BatchAnalyser::parseTransform("onsets:onsets"),
+           BatchAnalyser::parseTransform("pitch-vibrato:summary"),
+           BatchAnalyser::parseTransform("onsets:power"),
+           BatchAnalyser::parseTransform("probe:blocks"),
+           BatchAnalyser::parseTransform("probe:fixed") },
+         { { "onsets", factory([](float r) { return new Onsets(r); }) },
+           { "pitch-vibrato",
+             factory([](float r) { return new PitchVibrato(r); }) },
+           { "probe", factory([](float r) { return new ProbePlugin(r); }) } });
+
+    Onsets onsets(static_cast<float>(rate));
+    Onsets onsetsForPower(static_cast<float>(rate));
+    PitchVibrato pitchVibrato(static_cast<float>(rate));
+    ProbePlugin probe(static_cast<float>(rate));
+    ProbePlugin probeForFixed(static_cast<float>(rate));
+    vector<vector<string>> features {
+        runDirectly(onsets, "onsets", mono, rate),
+        runDirectly(pitchVibrato, "summary", mono, rate),
+        runDirectly(onsetsForPower, "power", mono, rate),
+        runDirectly(probe, "blocks", mono, rate),
+        runDirectly(probeForFixed, "fixed", mono, rate)
+    };
+
+    // Check the probe's timing independently of runDirectly: a block
+    // every 512 frames and one beyond the last full one, with the
+    // count at the time of that last block, and then fixed-rate
+    // features a tenth of a second apart starting from zero
+    size_t blocks = (((frames + 2047) / 2048) * 2048 - 2048) / 512 + 2;
+    BOOST_REQUIRE_EQUAL(features[3].size(), blocks + 1);
+    BOOST_CHECK_EQUAL(features[3][1].substr(0, 12), "0.011609977,");
+    BOOST_CHECK_EQUAL(features[3][blocks],
+                      "3.030204082," + std::to_string(blocks) + ",0,0\n");
+    BOOST_REQUIRE_EQUAL(features[4].size(), blocks / 10 + 1);
+    BOOST_CHECK_EQUAL(features[4][0], "0.000000000,10\n");
+    BOOST_CHECK_EQUAL(features[4][1], "0.100000000,20\n");
+
+    // With the file name column, the first feature gets the quoted
+    // file name and the rest an empty column
+    vector<string> expected, expectedNamed;
+    for (const auto &ff : features) {
+        BOOST_CHECK(!ff.empty());
+        string plain, named;
+        for (int i = 0; i < int(ff.size()); ++i) {
+            plain += ff[i];
+            named += (i == 0 ? "\"" + path.string() + "\"," : ",") + ff[i];
+        }
+        expected.push_back(plain);
+        expectedNamed.push_back(named);
+    }
+
+    auto results = analyser.analyseFile(path.string(), false);
+    BOOST_REQUIRE_EQUAL(results.size(), features.size());
+    auto named = analyser.analyseFile(path.string(), true);
+    BOOST_REQUIRE_EQUAL(named.size(), features.size());
+    for (int i = 0; i < int(features.size()); ++i) {
+        BOOST_TEST_CONTEXT("transform " << i) {
+            BOOST_CHECK_EQUAL(results[i], expected[i]);
+            BOOST_CHECK_EQUAL(named[i], expectedNamed[i]);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,172 @@
+
+/*
+    Expressive Means Combined
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include <boost/test/unit_test.hpp>
+
+#include "../src/Combined.h"
+
+#include <iostream>
+
+using std::vector;
+
+static int testSignalRate = 44100;
+
+static
+vector<float>
+makeTestSignal()
+{
+    // Three notes with a glide between the second and third, the
+    // last one with some vibrato, separated by short silences
+
+    int rate = testSignalRate;
+    int quarter = rate / 4;
+    int duration = quarter * 14;
+    vector<float> signal(duration, 0.f);
+    float arg = 0.f;
+    float mag = 0.4f;
+
+    for (int i = quarter; i < quarter * 13; ++i) {
+        float freq;
+        if (i < quarter * 4) {
+            freq = 220.f;
+        } else if (i < quarter * 5) {
+            continue;
+        } else if (i < quarter * 8) {
+            freq = 247.f;
+        } else if (i < quarter * 9) {
+            freq = 247.f + (294.f - 247.f) * float(i - quarter * 8) / quarter;
+        } else {
+            float t = float(i - quarter * 9) / rate;
+            freq = 294.f * powf(2.f, (0.5f * sinf(2.f * M_PI * 6.f * t)) / 12.f);
+        }
+        arg += 2.0 * M_PI * freq / float(rate);
+        for (int h = 1; h <= 4; ++h) {
+            signal[i] += (mag / h) * sinf(arg * h);
+        }
+    }
+
+    return signal;
+}
+
+static
+Vamp::Plugin::FeatureSet
+run(Vamp::Plugin &plugin, const vector<float> &signal)
+{
+    int blockSize = plugin.getPreferredBlockSize();
+    int stepSize = plugin.getPreferredStepSize();
+    BOOST_REQUIRE(plugin.initialise(1, stepSize, blockSize));
+    for (int i = 0; i + blockSize <= int(signal.size()); i += stepSize) {
+        const float *block = signal.data() + i;
+        plugin.process(&block, Vamp::RealTime::frame2RealTime
+                       (i, testSignalRate));
+    }
+    return plugin.getRemainingFeatures();
+}
+
+static
+void
+compare(const Vamp::Plugin::FeatureSet &combined, int firstOutput,
+        const Vamp::Plugin::FeatureSet &separate)
+{
+    for (const auto &ff : separate) {
+        BOOST_TEST_CONTEXT("output " << ff.first) {
+            BOOST_REQUIRE(combined.find(firstOutput + ff.first) !=
+                          combined.end());
+            const auto &cf = combined.at(firstOutput + ff.first);
+            BOOST_REQUIRE_EQUAL(cf.size(), ff.second.size());
+            for (int i = 0; i < int(cf.size()); ++i) {
+                BOOST_CHECK_EQUAL(cf[i].timestamp, ff.second[i].timestamp);
+                BOOST_CHECK_EQUAL(cf[i].duration, ff.second[i].duration);
+                BOOST_CHECK_EQUAL(cf[i].label, ff.second[i].label);
+                BOOST_CHECK(cf[i].values == ff.second[i].values);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(TestCombined)
+
+BOOST_AUTO_TEST_CASE(outputs)
+{
+    Combined combined(testSignalRate);
+    Onsets onsets(testSignalRate);
+    Articulation articulation(testSignalRate);
+    PitchVibrato pitchVibrato(testSignalRate);
+    Portamento portamento(testSignalRate);
+
+    int expectedOutputCount =
+        onsets.getOutputDescriptors().size() +
+        articulation.getOutputDescriptors().size() +
+        pitchVibrato.getOutputDescriptors().size() +
+        portamento.getOutputDescriptors().size();
+
+    auto outputs = combined.getOutputDescriptors();
+    BOOST_CHECK_EQUAL(int(outputs.size()), expectedOutputCount);
+    BOOST_CHECK_EQUAL(outputs[0].identifier, "onsets-onsets");
+    BOOST_CHECK_EQUAL(outputs.back().identifier, "portamento-meanDynamics");
+}
+
+BOOST_AUTO_TEST_CASE(parameters)
+{
+    Combined combined(testSignalRate);
+
+    combined.setParameter("onsetSensitivityLevel", 12.f);
+    BOOST_CHECK_EQUAL(combined.getParameter("onsetSensitivityLevel"), 12.f);
+
+    combined.setParameter("portamento-scalingFactor", 0.002f);
+    BOOST_CHECK_EQUAL(combined.getParameter("portamento-scalingFactor"), 0.002f);
+    BOOST_CHECK(combined.getParameter("articulation-scalingFactor") != 0.002f);
+
+    // Core parameters are only exposed unprefixed
+    auto params = combined.getParameterDescriptors();
+    for (const auto &p : params) {
+        BOOST_CHECK(p.identifier != "articulation-onsetSensitivityLevel");
+    }
+}
+
+BOOST_AUTO_TEST_CASE(matchesSeparatePlugins)
+{
+    auto signal = makeTestSignal();
+
+    Combined combined(testSignalRate);
+    combined.setParameter("onsetSensitivityLevel", 10.f);
+    combined.setParameter("pitch-vibrato-segmentationType", 1.f);
+    auto combinedFeatures = run(combined, signal);
+
+    int firstOutput = 0;
+
+    {
+        Onsets plugin(testSignalRate);
+        plugin.setParameter("onsetSensitivityLevel", 10.f);
+        compare(combinedFeatures, firstOutput, run(plugin, signal));
+        firstOutput += plugin.getOutputDescriptors().size();
+    }
+    {
+        Articulation plugin(testSignalRate);
+        plugin.setParameter("onsetSensitivityLevel", 10.f);
+        compare(combinedFeatures, firstOutput, run(plugin, signal));
+        firstOutput += plugin.getOutputDescriptors().size();
+    }
+    {
+        PitchVibrato plugin(testSignalRate);
+        plugin.setParameter("onsetSensitivityLevel", 10.f);
+        plugin.setParameter("segmentationType", 1.f);
+        compare(combinedFeatures, firstOutput, run(plugin, signal));
+        firstOutput += plugin.getOutputDescriptors().size();
+    }
+    {
+        Portamento plugin(testSignalRate);
+        plugin.setParameter("onsetSensitivityLevel", 10.f);
+        compare(combinedFeatures, firstOutput, run(plugin, signal));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -13,8 +13,13 @@
 
 #include "../src/Glide.h"
 #include "../src/Portamento.h"
+#include "../src/SlidingMedian.h"
+
+#include "../ext/qm-dsp/maths/MedianFilter.h"
 
 #include <iostream>
+#include <random>
+#include <cmath>
 using std::cerr;
 using std::endl;
 
@@ -37,7 +42,7 @@ std::ostream &operator<<(std::ostream &os, Portamento::GlideDynamic x) {
 BOOST_AUTO_TEST_SUITE(TestGlide)
 
 static void testSingleGlide(const vector<double> &pitch_Hz,
-                            const CoreFeatures::OnsetOffsetMap &onsets,
+                            const CoreFeatures::NoteTable &onsets,
                             int expectedOnset,
                             int expectedStart,
                             int expectedEnd)
@@ -59,7 +64,7 @@ static void testSingleGlide(const vector<double> &pitch_Hz,
 }
 
 static void testGlideClassification(const pair<int, Glide::Extent> &glide,
-                                    const CoreFeatures::OnsetOffsetMap &onsetOffsets,
+                                    const CoreFeatures::NoteTable &onsetOffsets,
                                     const vector<double> &pyinPitch,
                                     const vector<double> &smoothedPower,
                                     Portamento::GlideDirection expectedDirection,
@@ -73,7 +78,8 @@ static void testGlideClassification(const pair<int, Glide::Extent> &glide,
                           portamento.getPreferredStepSize(),
                           portamento.getPreferredBlockSize());
 
-    auto classification = portamento.classifyGlide(glide,
+    auto classification = portamento.classifyGlide(CoreFeatures(44100.f),
+                                                   glide,
                                                    onsetOffsets,
                                                    pyinPitch,
                                                    smoothedPower);
@@ -139,10 +145,12 @@ BOOST_AUTO_TEST_CASE(roehn_2180)
         1067.5, 1063.48, 1054.21, 1041.29, 1031.94
     };
 
-    CoreFeatures::OnsetOffsetMap onsets;
-    onsets[1] = { 68, CoreFeatures::OffsetType::FollowingOnsetReached };
+    CoreFeatures::NoteTable onsets;
+    onsets.add({ 1, 68, CoreFeatures::OnsetType::SpectralLevelRise,
+                 CoreFeatures::OffsetType::FollowingOnsetReached });
     // Offset here is arbitrary
-    onsets[68] = { 140, CoreFeatures::OffsetType::FollowingOnsetReached };
+    onsets.add({ 68, 140, CoreFeatures::OnsetType::SpectralLevelRise,
+                 CoreFeatures::OffsetType::FollowingOnsetReached });
 
     testSingleGlide(pitch_Hz, onsets, 68, 50, 64);
 }
@@ -202,9 +210,11 @@ BOOST_AUTO_TEST_CASE(huberman_11987)
         385.111, 385.804, 386.092, 385.92, 385.583 // 220
     };
 
-    CoreFeatures::OnsetOffsetMap onsets;
-    onsets[0] = { 108, CoreFeatures::OffsetType::SpectralLevelDrop };
-    onsets[169] = { 195, CoreFeatures::OffsetType::SpectralLevelDrop };
+    CoreFeatures::NoteTable onsets;
+    onsets.add({ 0, 108, CoreFeatures::OnsetType::SpectralLevelRise,
+                 CoreFeatures::OffsetType::SpectralLevelDrop });
+    onsets.add({ 169, 195, CoreFeatures::OnsetType::SpectralLevelRise,
+                 CoreFeatures::OffsetType::SpectralLevelDrop });
 
     testSingleGlide(pitch_Hz, onsets, 169, 84, 146);
 }
@@ -270,9 +280,11 @@ BOOST_AUTO_TEST_CASE(zimmermann_458)
         -25.8968, -25.9818, -26.0933
     };
 
-    CoreFeatures::OnsetOffsetMap onsetOffsets;
-    onsetOffsets[6] = { 57, CoreFeatures::OffsetType::FollowingOnsetReached };
-    onsetOffsets[57] = { 90, CoreFeatures::OffsetType::FollowingOnsetReached };
+    CoreFeatures::NoteTable onsetOffsets;
+    onsetOffsets.add({ 6, 57, CoreFeatures::OnsetType::SpectralLevelRise,
+                       CoreFeatures::OffsetType::FollowingOnsetReached });
+    onsetOffsets.add({ 57, 90, CoreFeatures::OnsetType::SpectralLevelRise,
+                       CoreFeatures::OffsetType::FollowingOnsetReached });
 
     int begin = 36;
     int end = 61;
@@ -291,5 +303,36 @@ BOOST_AUTO_TEST_CASE(zimmermann_458)
 }
 
 
+BOOST_AUTO_TEST_CASE(slidingMedian)
+{
+    // Compare with the qm-dsp median filter that this replaces, over
+    // inputs with plenty of repeated values and zeros, and filter
+    // lengths longer and shorter than the input. A few trials also
+    // have NaNs, which qm-dsp warns about every time
+    std::mt19937 rng(42);
+    
+    for (int trial = 0; trial < 300; ++trial) {
+        BOOST_TEST_CONTEXT("trial " << trial) {
+            int n = int(rng() % 500);
+            int size = 1 + int(rng() % 80);
+            bool withNaNs = (trial % 50 == 0);
+            std::vector<double> in;
+            for (int i = 0; i < n; ++i) {
+                int r = int(rng() % 20);
+                if (r == 0) {
+                    in.push_back(0.0);
+                } else if (r == 1 && withNaNs) {
+                    in.push_back(NAN);
+                } else {
+                    in.push_back(double(int(rng() % 40)) - 5.0);
+                }
+            }
+            auto expected = MedianFilter<double>::filter(size, in);
+            auto actual = SlidingMedian<double>::filter(size, in);
+            BOOST_CHECK(expected == actual);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
@@ -12,11 +12,20 @@
 #include <boost/test/unit_test.hpp>
 
 #include "../src/CoreFeatures.h"
+#include "../src/Onsets.h"
+#include "../src/SemanticOnsets.h"
+#include "../src/FrameDataFile.h"
 
 #include "bqaudiostream/AudioWriteStream.h"
 #include "bqaudiostream/AudioWriteStreamFactory.h"
 
 #include <iostream>
+#include <algorithm>
+#include <random>
+#include <fstream>
+#include <iterator>
+#include <cstring>
+#include <filesystem>
 
 using std::cerr;
 using std::endl;
@@ -111,25 +120,25 @@ BOOST_AUTO_TEST_CASE(defaultParams)
     }
     */
     
-    auto onsets = cf.getMergedOnsets();
+    auto notes = cf.getNotes();
 
     // We should see onsets at 0.5 sec, 2.0 sec, 3.0 sec. The first
     // and third are spectral rise type, the second pitch change.
-    BOOST_CHECK(onsets.size() == 3);
+    BOOST_CHECK(notes.size() == 3);
 
     vector<int> hops;
     vector<Vamp::RealTime> times;
     vector<CoreFeatures::OnsetType> types;
     
-    for (auto onset : onsets) {
+    for (const auto &note : notes) {
         /*
-        cerr << "Onset at " << onset.first
-             << " (" << cf.timeForStep(onset.first) << " )"
-             << " of type " << int(onset.second) << endl;
+        cerr << "Onset at " << note.onset
+             << " (" << cf.timeForStep(note.onset) << " )"
+             << " of type " << int(note.onsetType) << endl;
         */
-        hops.push_back(onset.first);
-        times.push_back(cf.timeForStep(onset.first));
-        types.push_back(onset.second);
+        hops.push_back(note.onset);
+        times.push_back(cf.timeForStep(note.onset));
+        types.push_back(note.onsetType);
     }
 
     // These are the "acceptance" ranges
@@ -153,4 +162,624 @@ BOOST_AUTO_TEST_CASE(defaultParams)
     BOOST_CHECK(hops[2] == 511);
 }
 
+BOOST_AUTO_TEST_CASE(refinish)
+{
+    auto signal = makeTestSignal();
+
+    CoreFeatures::Parameters params;
+    params.pyinFixedLag = false;
+    
+    CoreFeatures cf(testSignalRate);
+    int bs = cf.getPreferredBlockSize();
+    int hop = cf.getPreferredStepSize();
+    cf.initialise(params);
+    for (int i = 0; i + bs <= int(signal.size()); i += hop) {
+        cf.process(signal.data() + i,
+                   Vamp::RealTime::frame2RealTime(i, testSignalRate));
+    }
+    cf.finish();
+
+    params.onsetSensitivityNoise_percent = 30.f;
+    params.minimumOnsetInterval_ms = 200.f;
+    params.noteDurationThreshold_dB = 6.f;
+    cf.refinish(params);
+
+    CoreFeatures reprocessed(testSignalRate);
+    reprocessed.initialise(params);
+    for (int i = 0; i + bs <= int(signal.size()); i += hop) {
+        reprocessed.process(signal.data() + i,
+                            Vamp::RealTime::frame2RealTime(i, testSignalRate));
+    }
+    reprocessed.finish();
+
+    BOOST_CHECK(cf.getNotes() == reprocessed.getNotes());
+    BOOST_CHECK(cf.getOffsetDropDF() == reprocessed.getOffsetDropDF());
+
+    params.onsetSensitivityLevel_dB = 4.f;
+    BOOST_CHECK_THROW(cf.refinish(params), std::logic_error);
+}
+
+// A directory for a test's files, removed with everything in it when
+// the test is done
+struct TemporaryDirectory {
+    std::filesystem::path path;
+    TemporaryDirectory(std::string name) :
+        path(std::filesystem::temp_directory_path() / name) {
+        std::filesystem::remove_all(path);
+        std::filesystem::create_directories(path);
+    }
+    ~TemporaryDirectory() {
+        std::error_code ec;
+        std::filesystem::remove_all(path, ec);
+    }
+    std::string file(std::string name) const {
+        return (path / name).string();
+    }
+};
+
+BOOST_AUTO_TEST_CASE(frameDataFile)
+{
+    auto signal = makeTestSignal();
+
+    TemporaryDirectory dir("expressive-means-frameDataFile");
+    std::string frames = dir.file("testsignal.frames");
+    std::string truncated = dir.file("truncated.frames");
+    std::string corrupt = dir.file("corrupt.frames");
+
+    CoreFeatures::Parameters params;
+    params.pyinFixedLag = false;
+    
+    CoreFeatures cf(testSignalRate);
+    int bs = cf.getPreferredBlockSize();
+    int hop = cf.getPreferredStepSize();
+    cf.initialise(params);
+    for (int i = 0; i + bs <= int(signal.size()); i += hop) {
+        cf.process(signal.data() + i,
+                   Vamp::RealTime::frame2RealTime(i, testSignalRate));
+    }
+    cf.finish();
+    cf.saveFrameData(frames);
+
+    // Loading with different decision-level parameters is fine,
+    // and must give the same result as processing with them
+    params.noteDurationThreshold_dB = 6.f;
+
+    CoreFeatures loaded(testSignalRate);
+    loaded.initialise(params);
+    loaded.finishFromFrameData(frames);
+
+    BOOST_CHECK(loaded.getPYinPitch_Hz() == cf.getPYinPitch_Hz());
+    BOOST_CHECK(loaded.getRawPower_dB() == cf.getRawPower_dB());
+    BOOST_CHECK(loaded.getSmoothedPower_dB() == cf.getSmoothedPower_dB());
+    BOOST_CHECK(loaded.getOnsetLevelRiseFractions() ==
+                cf.getOnsetLevelRiseFractions());
+    BOOST_CHECK_EQUAL(loaded.getNormalisationGain(),
+                      cf.getNormalisationGain());
+    BOOST_CHECK_EQUAL(loaded.getOnsetBinCount(), cf.getOnsetBinCount());
+    for (int i = 0; i < int(cf.getRawPower_dB().size()); ++i) {
+        BOOST_CHECK(loaded.getOnsetBinsAboveNoiseFloorAt(i) ==
+                    cf.getOnsetBinsAboveNoiseFloorAt(i));
+        BOOST_CHECK(loaded.getOnsetBinsAboveOffsetAt(i) ==
+                    cf.getOnsetBinsAboveOffsetAt(i));
+    }
+    BOOST_CHECK(loaded.getNotes() == cf.getNotes());
+
+    CoreFeatures reprocessed(testSignalRate);
+    reprocessed.initialise(params);
+    for (int i = 0; i + bs <= int(signal.size()); i += hop) {
+        reprocessed.process(signal.data() + i,
+                            Vamp::RealTime::frame2RealTime(i, testSignalRate));
+    }
+    reprocessed.finish();
+    BOOST_CHECK(loaded.getNotes() == reprocessed.getNotes());
+
+    // But not with different frame-level ones
+    params.spectralFrequencyMax_Hz = 3000.f;
+
+    CoreFeatures mismatched(testSignalRate);
+    mismatched.initialise(params);
+    BOOST_CHECK_THROW(mismatched.finishFromFrameData(frames),
+                      std::runtime_error);
+
+    // A truncated file, or one with a nonsense array length, must
+    // fail with runtime_error rather than by trying to allocate it
+    std::string contents;
+    {
+        std::ifstream in(frames, std::ios::binary);
+        contents.assign(std::istreambuf_iterator<char>(in),
+                        std::istreambuf_iterator<char>());
+    }
+    {
+        std::ofstream out(truncated, std::ios::binary);
+        out << contents.substr(0, contents.size() / 2);
+    }
+    FrameDataFile::Header header;
+    BOOST_CHECK_THROW(FrameDataFile::read(truncated, header),
+                      std::runtime_error);
+
+    // The pitch array length is the first of the array counts
+    size_t pitchCountOffset = FrameDataFile::arrayCountsOffset;
+    uint64_t pitchCount = 0;
+    BOOST_REQUIRE(contents.size() > pitchCountOffset + sizeof(pitchCount));
+    memcpy(&pitchCount, contents.data() + pitchCountOffset, sizeof(pitchCount));
+    BOOST_REQUIRE_EQUAL(pitchCount, cf.getPYinPitch_Hz().size());
+    pitchCount = uint64_t(1) << 60;
+    memcpy(&contents[pitchCountOffset], &pitchCount, sizeof(pitchCount));
+    {
+        std::ofstream out(corrupt, std::ios::binary);
+        out << contents;
+    }
+    BOOST_CHECK_THROW(FrameDataFile::read(corrupt, header),
+                      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(powerBatch)
+{
+    auto signal = makeTestSignal();
+
+    Power::Parameters params;
+    params.blockSize = 2047; // not a multiple of the vector width
+    int hop = 256;
+    int count = (int(signal.size()) - params.blockSize) / hop + 1;
+
+    Power single;
+    single.initialise(params);
+    for (int i = 0; i < count; ++i) {
+        single.process(signal.data() + i * hop);
+    }
+
+    Power batch;
+    batch.initialise(params);
+    batch.processBatch(signal.data(), hop, count / 2, 1);
+    batch.processBatch(signal.data() + (count / 2) * hop, hop,
+                       count - count / 2, 3);
+
+    auto s = single.getRawPower();
+    auto b = batch.getRawPower();
+    BOOST_REQUIRE_EQUAL(int(s.size()), count);
+    BOOST_CHECK(s == b);
+
+    // Against plain double-precision accumulation, within the
+    // tolerance documented in Power.h
+    for (int i = 0; i < count; ++i) {
+        const float *block = signal.data() + i * hop;
+        double sum = 0.0;
+        for (int j = 0; j < params.blockSize; ++j) {
+            sum += block[j] * block[j];
+        }
+        sum = std::max(sum, pow(10.0, params.threshold_dB / 10.0));
+        double dB = 10.0 * log10(sum / double(params.blockSize));
+        BOOST_CHECK_SMALL(s[i] - dB, 1e-9);
+    }
+}
+
+struct ExtractionResults {
+    std::vector<double> pitch;
+    std::vector<double> power;
+    std::vector<double> fractions;
+    CoreFeatures::NoteTable notes;
+    int segments;
+};
+
+static
+ExtractionResults
+extract(const std::vector<float> &signal, CoreFeatures::Parameters params)
+{
+    // The CoreFeatures object is gone by the time we return, so its
+    // frame data can't be found in the cache by the next caller
+    CoreFeatures cf(testSignalRate);
+    int bs = cf.getPreferredBlockSize();
+    int hop = cf.getPreferredStepSize();
+    cf.initialise(params);
+    // Run twice to exercise reset() too
+    for (int pass = 0; pass < 2; ++pass) {
+        if (pass > 0) cf.reset();
+        for (int i = 0; i + bs <= int(signal.size()); i += hop) {
+            cf.process(signal.data() + i,
+                       Vamp::RealTime::frame2RealTime(i, testSignalRate));
+        }
+        cf.finish();
+    }
+    return { cf.getPYinPitch_Hz(), cf.getRawPower_dB(),
+             cf.getOnsetLevelRiseFractions(), cf.getNotes(),
+             cf.getSegmentCount() };
+}
+
+BOOST_AUTO_TEST_CASE(threadedExtraction)
+{
+    auto signal = makeTestSignal();
+
+    // Deferred normalisation, normalisation with a known peak, and no
+    // normalisation all take different routes into the extractors
+    for (int mode = 0; mode < 3; ++mode) {
+        BOOST_TEST_CONTEXT("mode " << mode) {
+            CoreFeatures::Parameters params;
+            params.pyinFixedLag = false;
+            params.normalise = (mode < 2);
+            params.knownPeak = (mode == 1 ? 0.9f : 0.f);
+            auto plain = extract(signal, params);
+
+            params.threadedExtraction = true;
+            auto threaded = extract(signal, params);
+
+            BOOST_CHECK(plain.pitch == threaded.pitch);
+            BOOST_CHECK(plain.power == threaded.power);
+            BOOST_CHECK(plain.fractions == threaded.fractions);
+            BOOST_CHECK(plain.notes == threaded.notes);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(parallelPitch)
+{
+    auto signal = makeTestSignal();
+
+    // Without fixed-lag decoding, threaded extraction from retained
+    // input does pYIN's per-block work itself, in parallel, and then
+    // decodes the whole pitch track at once. This should give exactly
+    // the pitch track that PYinVamp does when fed block by block, in
+    // fast and precise timing modes, and with a low-amplitude
+    // threshold high enough to reweight some of the candidates
+    for (int mode = 0; mode < 3; ++mode) {
+        BOOST_TEST_CONTEXT("mode " << mode) {
+            CoreFeatures::Parameters params;
+            params.pyinFixedLag = false;
+            params.pyinPreciseTiming = (mode == 1);
+            params.pyinLowAmpSuppressionThreshold = (mode == 2 ? 0.3f : 0.1f);
+            auto plain = extract(signal, params);
+
+            params.threadedExtraction = true;
+            auto parallel = extract(signal, params);
+
+            BOOST_CHECK(std::any_of(plain.pitch.begin(), plain.pitch.end(),
+                                    [](double hz) { return hz > 0.0; }));
+            BOOST_CHECK(plain.pitch == parallel.pitch);
+            BOOST_CHECK(plain.notes == parallel.notes);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(queueInput)
+{
+    auto signal = makeTestSignal();
+
+    // As for threadedExtraction, plus the two together, as then the
+    // queue's thread is the one pushing into the pipeline
+    for (int mode = 0; mode < 4; ++mode) {
+        BOOST_TEST_CONTEXT("mode " << mode) {
+            CoreFeatures::Parameters params;
+            params.pyinFixedLag = false;
+            params.normalise = (mode != 2);
+            params.knownPeak = (mode == 1 || mode == 3 ? 0.9f : 0.f);
+            auto plain = extract(signal, params);
+
+            params.queueInput = true;
+            params.threadedExtraction = (mode == 3);
+            auto queued = extract(signal, params);
+
+            BOOST_CHECK(plain.pitch == queued.pitch);
+            BOOST_CHECK(plain.power == queued.power);
+            BOOST_CHECK(plain.fractions == queued.fractions);
+            BOOST_CHECK(plain.notes == queued.notes);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(queueInputReset)
+{
+    auto signal = makeTestSignal();
+
+    CoreFeatures::Parameters params;
+    params.pyinFixedLag = false;
+    auto plain = extract(signal, params);
+
+    // Resetting, or destroying, with input still queued should drop
+    // it without affecting what follows
+    params.queueInput = true;
+    params.threadedExtraction = true;
+    CoreFeatures cf(testSignalRate);
+    int bs = cf.getPreferredBlockSize();
+    int hop = cf.getPreferredStepSize();
+    cf.initialise(params);
+    for (int pass = 0; pass < 3; ++pass) {
+        if (pass > 0) cf.reset();
+        int end = (pass < 2 ? int(signal.size()) / 2 : int(signal.size()));
+        for (int i = 0; i + bs <= end; i += hop) {
+            cf.process(signal.data() + i,
+                       Vamp::RealTime::frame2RealTime(i, testSignalRate));
+        }
+    }
+    cf.finish();
+
+    BOOST_CHECK(plain.pitch == cf.getPYinPitch_Hz());
+    BOOST_CHECK(plain.power == cf.getRawPower_dB());
+    BOOST_CHECK(plain.fractions == cf.getOnsetLevelRiseFractions());
+    BOOST_CHECK(plain.notes == cf.getNotes());
+
+    CoreFeatures abandoned(testSignalRate);
+    abandoned.initialise(params);
+    for (int i = 0; i + bs <= int(signal.size()); i += hop) {
+        abandoned.process(signal.data() + i,
+                          Vamp::RealTime::frame2RealTime(i, testSignalRate));
+    }
+}
+
+// The original power-rise onset detector, which scans the whole
+// window following every step
+static
+std::vector<int>
+findPowerRiseOnsetsByScanning(const std::vector<double> &rawPower,
+                              int n, int windowSteps, double threshold_dB)
+{
+    std::vector<int> onsets;
+    bool onsetComing = false;
+    double prevDerivative = 0.0;
+    for (int i = 0; i + 1 < n; ++i) {
+        double derivative = rawPower[i+1] - rawPower[i];
+        if (onsetComing) {
+            if (derivative < prevDerivative) {
+                onsets.push_back(i);
+                onsetComing = false;
+            }
+        } else if (i + windowSteps < int(rawPower.size())) {
+            for (int j = i; j <= i + windowSteps; ++j) {
+                if (rawPower[j] < rawPower[i]) {
+                    break;
+                }
+                if (rawPower[j] > rawPower[i] + threshold_dB) {
+                    onsetComing = true;
+                    break;
+                }
+            }
+        }
+        prevDerivative = derivative;
+    }
+    return onsets;
+}
+
+BOOST_AUTO_TEST_CASE(powerRiseOnsets)
+{
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> step(-3.0, 3.5);
+    std::uniform_int_distribution<int> jump(0, 40);
+    std::uniform_int_distribution<int> quantum(0, 2);
+
+    for (int trial = 0; trial < 200; ++trial) {
+        BOOST_TEST_CONTEXT("trial " << trial) {
+            // A random walk in dB with occasional jumps, sometimes
+            // rounded so as to have plenty of equal values
+            int size = 1 + int(rng() % 2000);
+            double q = quantum(rng);
+            std::vector<double> power(size);
+            double level = -60.0;
+            for (int i = 0; i < size; ++i) {
+                level += step(rng);
+                if (jump(rng) == 0) level += step(rng) * 8.0;
+                power[i] = (q > 0.0 ? round(level / q) * q : level);
+            }
+            int n = size - int(rng() % 5);
+            int window = int(rng() % 30);
+            double threshold = int(rng() % 13) - 1;
+
+            auto expected = findPowerRiseOnsetsByScanning
+                (power, n, window, threshold);
+            auto actual = CoreFeatures::findPowerRiseOnsets
+                (power, n, window, threshold);
+            BOOST_CHECK(expected == actual);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(splitAtSilence)
+{
+    // Three notes separated by two seconds of silence, long enough to
+    // split at
+    int rate = testSignalRate;
+    std::vector<float> signal(rate * 11, 0.f);
+    float freqs[] = { 220.f, 330.f, 196.f };
+    for (int note = 0; note < 3; ++note) {
+        int start = rate / 2 + note * rate * 7 / 2;
+        for (int i = 0; i < rate * 3 / 2; ++i) {
+            float env = std::min(1.f, float(i) / 500.f);
+            for (int h = 1; h <= 3; ++h) {
+                signal[start + i] += env * (0.3f / h) *
+                    sinf(2.f * M_PI * freqs[note] * h * i / rate);
+            }
+        }
+    }
+
+    for (bool normalise : { false, true }) {
+        BOOST_TEST_CONTEXT("normalise " << normalise) {
+            CoreFeatures::Parameters params;
+            params.pyinFixedLag = false;
+            params.normalise = normalise;
+            auto whole = extract(signal, params);
+
+            params.splitAtSilence = true;
+            auto split = extract(signal, params);
+
+            // Both silences are long enough to split at
+            BOOST_CHECK_EQUAL(whole.segments, 1);
+            BOOST_CHECK_EQUAL(split.segments, 3);
+
+            BOOST_CHECK(whole.power == split.power);
+            BOOST_CHECK(whole.fractions == split.fractions);
+            BOOST_CHECK(whole.notes == split.notes);
+
+            // Unvoiced values in the silences may come out differently,
+            // but the voiced ones should not
+            BOOST_REQUIRE_EQUAL(whole.pitch.size(), split.pitch.size());
+            for (int i = 0; i < int(whole.pitch.size()); ++i) {
+                if (whole.pitch[i] > 0.0 || split.pitch[i] > 0.0) {
+                    BOOST_CHECK_EQUAL(whole.pitch[i], split.pitch[i]);
+                }
+            }
+            BOOST_CHECK(!whole.notes.empty());
+        }
+    }
+}
+
+static
+Vamp::Plugin::FeatureSet
+runOnsets(const std::vector<std::vector<float>> &channels, bool separate)
+{
+    Onsets plugin(testSignalRate);
+    plugin.setParameter("separateChannels", separate ? 1.f : 0.f);
+    int bs = plugin.getPreferredBlockSize();
+    int hop = plugin.getPreferredStepSize();
+    int n = int(channels.size());
+    BOOST_REQUIRE(plugin.initialise(n, hop, bs));
+    std::vector<const float *> blocks(n);
+    for (int i = 0; i + bs <= int(channels[0].size()); i += hop) {
+        for (int c = 0; c < n; ++c) {
+            blocks[c] = channels[c].data() + i;
+        }
+        plugin.process(blocks.data(),
+                       Vamp::RealTime::frame2RealTime(i, testSignalRate));
+    }
+    return plugin.getRemainingFeatures();
+}
+
+static
+int
+outputIndex(string identifier)
+{
+    auto outputs = Onsets(testSignalRate).getOutputDescriptors();
+    for (int i = 0; i < int(outputs.size()); ++i) {
+        if (outputs[i].identifier == identifier) {
+            return i;
+        }
+    }
+    BOOST_FAIL("Output " << identifier << " not found");
+    return -1;
+}
+
+BOOST_AUTO_TEST_CASE(multiChannel)
+{
+    auto a = makeTestSignal();
+
+    // Second channel has the same material a quarter-second later
+    int delay = testSignalRate / 4;
+    std::vector<float> b(a.size(), 0.f);
+    std::copy(a.begin(), a.end() - delay, b.begin() + delay);
+
+    int onsetOutput = outputIndex("onsets");
+    int channelOutput = outputIndex("channelonsets");
+    int mergedOutput = outputIndex("mergedonsets");
+
+    auto monoA = runOnsets({ a }, false);
+    auto monoB = runOnsets({ b }, false);
+    BOOST_REQUIRE(!monoA[onsetOutput].empty());
+
+    // Mixing two identical channels down gives the mono input back
+    auto mixed = runOnsets({ a, a }, false);
+    BOOST_REQUIRE_EQUAL(mixed[onsetOutput].size(), monoA[onsetOutput].size());
+    for (int i = 0; i < int(mixed[onsetOutput].size()); ++i) {
+        BOOST_CHECK_EQUAL(mixed[onsetOutput][i].timestamp,
+                          monoA[onsetOutput][i].timestamp);
+        BOOST_CHECK_EQUAL(mixed[onsetOutput][i].label,
+                          monoA[onsetOutput][i].label);
+    }
+
+    // Analysed separately, each channel's onsets are those of the
+    // channel on its own
+    auto separate = runOnsets({ a, b }, true);
+    std::vector<Vamp::Plugin::FeatureSet> mono { monoA, monoB };
+    for (int c = 0; c < 2; ++c) {
+        BOOST_TEST_CONTEXT("channel " << c) {
+            std::vector<Vamp::Plugin::Feature> found;
+            for (const auto &f : separate[channelOutput]) {
+                BOOST_REQUIRE_EQUAL(f.values.size(), 1);
+                if (int(f.values[0]) == c + 1) {
+                    found.push_back(f);
+                }
+            }
+            const auto &expected = mono[c].at(onsetOutput);
+            BOOST_REQUIRE_EQUAL(found.size(), expected.size());
+            for (int i = 0; i < int(found.size()); ++i) {
+                BOOST_CHECK_EQUAL(found[i].timestamp, expected[i].timestamp);
+                BOOST_CHECK_EQUAL(found[i].label, expected[i].label);
+            }
+        }
+    }
+
+    // The first channel is also reported on the ordinary outputs
+    BOOST_CHECK_EQUAL(separate[onsetOutput].size(), monoA[onsetOutput].size());
+
+    // Every merged onset accounts for at least one channel onset
+    const auto &merged = separate[mergedOutput];
+    BOOST_CHECK(!merged.empty());
+    BOOST_CHECK(merged.size() <= separate[channelOutput].size());
+    for (const auto &f : merged) {
+        BOOST_CHECK(f.values[0] >= 1.f && f.values[0] <= 2.f);
+    }
+}
+
+static
+Vamp::Plugin::FeatureSet
+runPlugin(Vamp::Plugin &plugin, const std::vector<float> &signal)
+{
+    int bs = plugin.getPreferredBlockSize();
+    int hop = plugin.getPreferredStepSize();
+    BOOST_REQUIRE(plugin.initialise(1, hop, bs));
+    for (int i = 0; i + bs <= int(signal.size()); i += hop) {
+        const float *block = signal.data() + i;
+        plugin.process(&block,
+                       Vamp::RealTime::frame2RealTime(i, testSignalRate));
+    }
+    return plugin.getRemainingFeatures();
+}
+
+BOOST_AUTO_TEST_CASE(comparePresets)
+{
+    auto signal = makeTestSignal();
+
+    SemanticOnsets comparing(testSignalRate);
+    auto params = comparing.getParameterDescriptors();
+    auto pitr = std::find_if(params.begin(), params.end(),
+                             [](const Vamp::Plugin::ParameterDescriptor &d) {
+                                 return d.identifier == "comparePresets";
+                             });
+    BOOST_REQUIRE(pitr != params.end());
+    auto names = pitr->valueNames;
+    auto nitr = std::find(names.begin(), names.end(), "Signal type");
+    BOOST_REQUIRE(nitr != names.end());
+    comparing.setParameter("comparePresets", float(nitr - names.begin()));
+
+    int outputsPerPreset = int(SemanticOnsets(testSignalRate)
+                               .getOutputDescriptors().size());
+    int presets = int(comparing.getOutputDescriptors().size()) /
+        outputsPerPreset;
+    BOOST_CHECK(presets > 1);
+
+    // Each preset's outputs should be those of a plain run with that
+    // instrument type. The plain runs come first, each with its
+    // plugin destroyed before the next starts, so that no run can
+    // pick up another's frame data from the cache
+    std::vector<Vamp::Plugin::FeatureSet> expected;
+    for (int k = 0; k < presets; ++k) {
+        SemanticOnsets single(testSignalRate);
+        single.setParameter("instrumentType", float(k));
+        expected.push_back(runPlugin(single, signal));
+    }
+
+    auto compared = runPlugin(comparing, signal);
+
+    for (int k = 0; k < presets; ++k) {
+        BOOST_TEST_CONTEXT("preset " << k) {
+            for (int o = 0; o < outputsPerPreset; ++o) {
+                const auto &e = expected[k][o];
+                const auto &c = compared[k * outputsPerPreset + o];
+                BOOST_REQUIRE_EQUAL(e.size(), c.size());
+                for (int i = 0; i < int(e.size()); ++i) {
+                    BOOST_CHECK_EQUAL(e[i].timestamp, c[i].timestamp);
+                    BOOST_CHECK_EQUAL(e[i].duration, c[i].duration);
+                    BOOST_CHECK(e[i].values == c[i].values);
+                    BOOST_CHECK_EQUAL(e[i].label, c[i].label);
+                }
+            }
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
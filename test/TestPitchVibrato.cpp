@@ -14,6 +14,9 @@
 #include "../src/PitchVibrato.h"
 
 #include <iostream>
+#include <random>
+#include <set>
+#include <cmath>
 using std::cerr;
 using std::endl;
 
@@ -25,20 +28,21 @@ BOOST_AUTO_TEST_SUITE(TestPitchVibrato)
 
 static void testVibratoClassification(std::string testName,
                                       const std::vector<double> &pitch_Hz,
-                                      const CoreFeatures::OnsetOffsetMap &onsetOffsets,
+                                      const CoreFeatures::NoteTable &onsetOffsets,
                                       std::string expectedClassification)
 {
     (void)testName;
     
     PitchVibrato pv(44100.f);
     pv.initialise(1, pv.getPreferredStepSize(), pv.getPreferredBlockSize());
+    CoreFeatures coreFeatures(44100.f);
 
 //    cerr << endl << testName << " test: Running extractElements" << endl;
     
     vector<int> rawPeaks;
     vector<double> smoothedPitch_semis;
     auto elements = pv.extractElementsWithoutGlides
-        (pitch_Hz, onsetOffsets, smoothedPitch_semis, rawPeaks);
+        (coreFeatures, pitch_Hz, onsetOffsets, smoothedPitch_semis, rawPeaks);
 /*
     cerr << endl << testName << " test: extractElements finished" << endl;
     
@@ -59,7 +63,7 @@ static void testVibratoClassification(std::string testName,
 
     cerr << endl << testName << " test: Running classify" << endl;
 */
-    auto classification = pv.classify(elements, onsetOffsets);
+    auto classification = pv.classify(coreFeatures, elements, onsetOffsets);
 /*
     cerr << endl << testName << " test: classify finished" << endl;
     
@@ -108,9 +112,10 @@ BOOST_AUTO_TEST_CASE(huberman_812)
         1232.28
     };
 
-    CoreFeatures::OnsetOffsetMap onsetOffsets;
+    CoreFeatures::NoteTable onsetOffsets;
     // (the type is irrelevant)
-    onsetOffsets[17] = { 66, CoreFeatures::OffsetType::PowerDrop };
+    onsetOffsets.add({ 17, 66, CoreFeatures::OnsetType::SpectralLevelRise,
+                       CoreFeatures::OffsetType::PowerDrop });
 
     // There is one vibrato element found here, with a low correlation
     // of 0.498 - which we find but Tilo's app doesn't as its lowest
@@ -171,9 +176,10 @@ BOOST_AUTO_TEST_CASE(huberman_11400)
         470.62, 468.476, 469.216
     };
 
-    CoreFeatures::OnsetOffsetMap onsetOffsets;
+    CoreFeatures::NoteTable onsetOffsets;
     // (the type is irrelevant)
-    onsetOffsets[36] = { 145, CoreFeatures::OffsetType::PowerDrop };
+    onsetOffsets.add({ 36, 145, CoreFeatures::OnsetType::SpectralLevelRise,
+                       CoreFeatures::OffsetType::PowerDrop });
 
     // Here Frithjof provides an expected summary of "4Sn:"
     // I don't see how we can achieve that at all with this method.
@@ -255,9 +261,10 @@ BOOST_AUTO_TEST_CASE(szeryng_300)
         1123.15, 1122.81, 1121.5, 1122.82, 1123.07 // 170
     };
 
-    CoreFeatures::OnsetOffsetMap onsetOffsets;
+    CoreFeatures::NoteTable onsetOffsets;
     // (the type is irrelevant)
-    onsetOffsets[30] = { 138, CoreFeatures::OffsetType::PowerDrop };
+    onsetOffsets.add({ 30, 138, CoreFeatures::OnsetType::SpectralLevelRise,
+                       CoreFeatures::OffsetType::PowerDrop });
 
     // Here we have a range of about 51 cents (medium, with the
     // default boundaries), a rate around 7.2 Hz (just on the boundary
@@ -303,9 +310,10 @@ BOOST_AUTO_TEST_CASE(szeryng_6400)
         520.7                                       // 130
     };
 
-    CoreFeatures::OnsetOffsetMap onsetOffsets;
+    CoreFeatures::NoteTable onsetOffsets;
     // (the type is irrelevant)
-    onsetOffsets[22] = { 97, CoreFeatures::OffsetType::PowerDrop };
+    onsetOffsets.add({ 22, 97, CoreFeatures::OnsetType::SpectralLevelRise,
+                       CoreFeatures::OffsetType::PowerDrop });
 
     // Here we have a range of about 52 cents (medium, with the
     // default boundaries), a rate around 7.5 Hz (fast), and stable
@@ -315,5 +323,252 @@ BOOST_AUTO_TEST_CASE(szeryng_6400)
         ("Szeryng 6.4s", pitch_Hz, onsetOffsets, "4Fm=");
 }
 
+// The mean filter as originally written, summing each window afresh
+static std::vector<double> smoothBySummingWindows(const std::vector<double> &semis,
+                                                  int filterLength_steps)
+{
+    int n = int(semis.size());
+    std::vector<double> smoothed(n, 0.0);
+    for (int i = 0; i < n; ++i) {
+        if (semis[i] != 0.0) {
+            double total = 0.0;
+            int count = 0;
+            for (int j = 0; j < filterLength_steps/2; ++j) {
+                int ix = i - j;
+                if (ix < 0 || semis[ix] == 0.0) {
+                    break;
+                }
+                total += semis[ix];
+                count += 1;
+            }
+            for (int j = 0; j < filterLength_steps/2; ++j) {
+                int ix = i + j;
+                if (ix >= n || semis[ix] == 0.0) {
+                    break;
+                }
+                total += semis[ix];
+                count += 1;
+            }
+            if (count > 0) {
+                smoothed[i] = total / count;
+            }
+        }
+    }
+    return smoothed;
+}
+
+// Local maxima as picked by extractElements, but treating values
+// within the given tolerance of one another as equal
+static std::vector<int> findLocalMaxima(const std::vector<double> &smoothed,
+                                        double tolerance)
+{
+    int n = int(smoothed.size());
+    std::vector<int> peaks;
+    for (int i = 0; i < n; ++i) {
+        if (smoothed[i] <= 0.0) {
+            continue;
+        }
+        bool left = (i == 0 ||
+                     smoothed[i-1] <= 0.0 ||
+                     smoothed[i] > smoothed[i-1] + tolerance);
+        bool right = (i + 1 == n ||
+                      smoothed[i+1] <= 0.0 ||
+                      smoothed[i] >= smoothed[i+1] - tolerance);
+        if (left && right) {
+            peaks.push_back(i);
+        }
+    }
+    return peaks;
+}
+
+BOOST_AUTO_TEST_CASE(smoothing)
+{
+    PitchVibrato pv(44100.f);
+    int stepSize = pv.getPreferredStepSize();
+    pv.initialise(1, stepSize, pv.getPreferredBlockSize());
+    CoreFeatures coreFeatures(44100.f);
+    int filterLength_steps = coreFeatures.msToSteps
+        (pv.getParameter("smoothingWindowLength"), stepSize, true);
+    int half = filterLength_steps / 2;
+    BOOST_REQUIRE(half > 1);
+
+    // Random pitch tracks made of unvoiced gaps, plateaus of constant
+    // pitch, vibrato, and jittery pitch. The smoothed track should
+    // match the original filter's to well within anything that
+    // matters, but the peaks should match those found in the original
+    // filter's output only once its last-bit differences along
+    // plateaus are disregarded, as the new filter has none
+    std::mt19937 rng(24);
+    std::uniform_int_distribution<int> kind(0, 3);
+    std::uniform_int_distribution<int> length(1, 80);
+    std::uniform_real_distribution<double> centre(45.0, 90.0);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+    for (int trial = 0; trial < 100; ++trial) {
+        BOOST_TEST_CONTEXT("trial " << trial) {
+            std::vector<double> pitch_Hz;
+            std::vector<std::pair<int, int>> plateaus;
+            while (pitch_Hz.size() < 2000) {
+                int k = kind(rng);
+                int len = length(rng);
+                int start = int(pitch_Hz.size());
+                double c = centre(rng);
+                double phase = unit(rng) * 2.0 * M_PI;
+                double rate = 0.1 + unit(rng) * 0.3;
+                for (int i = 0; i < len; ++i) {
+                    switch (k) {
+                    case 0:
+                        pitch_Hz.push_back(0.0);
+                        break;
+                    case 1:
+                        pitch_Hz.push_back(CoreFeatures::pitchToHz(c));
+                        break;
+                    case 2:
+                        pitch_Hz.push_back(CoreFeatures::pitchToHz
+                                           (c + 0.5 * sin(phase + i * rate)));
+                        break;
+                    default:
+                        pitch_Hz.push_back(CoreFeatures::pitchToHz
+                                           (c + 0.2 * (unit(rng) - 0.5)));
+                        break;
+                    }
+                }
+                if (k == 1) {
+                    plateaus.push_back({ start, start + len - 1 });
+                }
+            }
+
+            std::vector<double> semis;
+            for (auto hz : pitch_Hz) {
+                semis.push_back(hz > 0.0 ? CoreFeatures::hzToPitch(hz) : 0.0);
+            }
+            auto expected = smoothBySummingWindows(semis, filterLength_steps);
+
+            std::vector<double> smoothed;
+            std::vector<int> rawPeaks;
+            (void)pv.extractElements(coreFeatures, pitch_Hz,
+                                     smoothed, rawPeaks);
+
+            BOOST_REQUIRE_EQUAL(smoothed.size(), expected.size());
+            for (int i = 0; i < int(smoothed.size()); ++i) {
+                BOOST_CHECK_EQUAL(smoothed[i] == 0.0, expected[i] == 0.0);
+                BOOST_CHECK_SMALL(smoothed[i] - expected[i], 1.0e-9);
+            }
+
+            BOOST_CHECK(rawPeaks == findLocalMaxima(expected, 1.0e-9));
+            BOOST_CHECK(rawPeaks == findLocalMaxima(smoothed, 0.0));
+
+            // Every hop whose window lies within a plateau should
+            // have exactly the same smoothed value
+            for (auto p : plateaus) {
+                for (int i = p.first + half; i + half <= p.second; ++i) {
+                    BOOST_CHECK_EQUAL(smoothed[i], smoothed[p.first + half - 1]);
+                }
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(threadedNotes)
+{
+    // Several dozen notes of different lengths, with vibrato of
+    // various rates and ranges and a short gap after each. There are
+    // enough to use threads in the segmented modes, and enough work
+    // in them for the threads to share it, but whether threads are
+    // used and how many there are should make no difference to the
+    // result
+    
+    std::mt19937 rng(18);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+    std::vector<double> pitch_Hz(20, 0.0);
+    CoreFeatures::NoteTable onsetOffsets;
+    
+    for (int n = 0; n < 48; ++n) {
+        int onset = int(pitch_Hz.size());
+        int length = 200 + int(unit(rng) * 1000);
+        double centre = 60.0 + (n % 12);
+        double rate = 0.15 + unit(rng) * 0.15; // radians per hop
+        double range = 0.2 + unit(rng) * 0.6; // semitones
+        for (int i = 0; i < length; ++i) {
+            pitch_Hz.push_back(CoreFeatures::pitchToHz
+                               (centre + range * sin(i * rate)));
+        }
+        onsetOffsets.add({ onset, onset + length - 1,
+                           CoreFeatures::OnsetType::Pitch,
+                           CoreFeatures::OffsetType::PowerDrop });
+        pitch_Hz.resize(pitch_Hz.size() + 10, 0.0);
+    }
+
+    CoreFeatures coreFeatures(44100.f);
+
+    PitchVibrato serial(44100.f);
+    serial.initialise(1, serial.getPreferredStepSize(),
+                      serial.getPreferredBlockSize());
+    serial.setNoteThreadCount(1);
+
+    PitchVibrato threaded(44100.f);
+    threaded.initialise(1, threaded.getPreferredStepSize(),
+                        threaded.getPreferredBlockSize());
+    threaded.setNoteThreadCount(4);
+
+    for (bool withoutGlides : { false, true }) {
+        BOOST_TEST_CONTEXT("without glides: " << withoutGlides) {
+
+            std::vector<double> expectedSmoothed, actualSmoothed;
+            std::vector<int> expectedPeaks, actualPeaks;
+            std::vector<PitchVibrato::VibratoElement> expected, actual;
+
+            if (withoutGlides) {
+                expected = serial.extractElementsWithoutGlidesAndSegmented
+                    (coreFeatures, pitch_Hz, onsetOffsets,
+                     expectedSmoothed, expectedPeaks);
+                actual = threaded.extractElementsWithoutGlidesAndSegmented
+                    (coreFeatures, pitch_Hz, onsetOffsets,
+                     actualSmoothed, actualPeaks);
+            } else {
+                expected = serial.extractElementsSegmented
+                    (coreFeatures, pitch_Hz, onsetOffsets,
+                     expectedSmoothed, expectedPeaks);
+                actual = threaded.extractElementsSegmented
+                    (coreFeatures, pitch_Hz, onsetOffsets,
+                     actualSmoothed, actualPeaks);
+            }
+
+            // Elements from most of the notes, not just a few
+            std::set<int> notesWithElements;
+            for (const auto &e : expected) {
+                auto itr = onsetOffsets.upper_bound(e.hop);
+                if (itr != onsetOffsets.begin()) {
+                    notesWithElements.insert((--itr)->onset);
+                }
+            }
+            BOOST_CHECK_GE(notesWithElements.size(), 8);
+
+            BOOST_CHECK(actualSmoothed == expectedSmoothed);
+            BOOST_CHECK(actualPeaks == expectedPeaks);
+
+            BOOST_REQUIRE_EQUAL(actual.size(), expected.size());
+            for (int i = 0; i < int(actual.size()); ++i) {
+                BOOST_TEST_CONTEXT("element " << i) {
+                    BOOST_CHECK_EQUAL(actual[i].hop, expected[i].hop);
+                    BOOST_CHECK_EQUAL(actual[i].peakIndex,
+                                      expected[i].peakIndex);
+                    BOOST_CHECK_EQUAL(actual[i].followingHop,
+                                      expected[i].followingHop);
+                    BOOST_CHECK_EQUAL(actual[i].range_semis,
+                                      expected[i].range_semis);
+                    BOOST_CHECK_EQUAL(actual[i].position_sec,
+                                      expected[i].position_sec);
+                    BOOST_CHECK_EQUAL(actual[i].waveLength_sec,
+                                      expected[i].waveLength_sec);
+                    BOOST_CHECK_EQUAL(actual[i].correlation,
+                                      expected[i].correlation);
+                }
+            }
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 